@@ -4,6 +4,7 @@
 \*************************************************************************/
 
 #include "asyncexec.h"
+#include "tracer.h"
 
 #include <epicsEvent.h>
 #include <epicsMutex.h>
@@ -22,16 +23,23 @@ class TaskQueue {
         epicsMutex mutex;
         epicsEvent event;
         std::list<T> que;
+        std::atomic<unsigned long> count{0};
 
     public:
         void enqueue(const T& task)
         {
             mutex.lock();
             que.emplace_back(task);
+            count = que.size();
             mutex.unlock();
             event.signal();
         }
 
+        unsigned long size() const
+        {
+            return count;
+        }
+
         bool dequeue(double timeout, T& task)
         {
             bool found = false;
@@ -44,21 +52,37 @@ class TaskQueue {
             if (!que.empty()) {
                 task = std::move(que.front());
                 que.pop_front();
+                count = que.size();
                 found = true;
             }
             mutex.unlock();
             return found;
         }
 };
-static TaskQueue<AsyncExec::Callback> g_tasks;
+struct Task {
+    AsyncExec::Callback callback;
+    const char* name;
+};
+static TaskQueue<Task> g_tasks;
+static std::atomic<unsigned long long> g_scheduled{0};
+
+class WorkerThread;
+static thread_local WorkerThread* g_self = nullptr;
+// Task executed by a thread other than workers
+static thread_local const char* g_current = nullptr;
 
 class WorkerThread : public epicsThreadRunable {
     public:
         epicsThread thread;
+        std::string name;
         std::atomic<bool> running{true};
+        std::atomic<AsyncExec::State> state{AsyncExec::State::IDLE};
+        std::atomic<const char*> current{nullptr};
+        std::atomic<unsigned long long> tasks{0};
 
         WorkerThread(const std::string& id)
         : thread(*this, id.c_str(), epicsThreadGetStackSize(epicsThreadStackMedium))
+        , name(id)
         {
             thread.start();
         }
@@ -71,10 +95,23 @@ class WorkerThread : public epicsThreadRunable {
 
         void run() override
         {
+            g_self = this;
             while (running) {
-                AsyncExec::Callback cb;
-                if (g_tasks.dequeue(1.0, cb)) {
-                    cb();
+                Task task;
+                if (g_tasks.dequeue(1.0, task)) {
+                    if (task.name != nullptr) {
+                        Tracer::event(Tracer::QUEUE_END, task.name);
+                    }
+                    current = task.name;
+                    state = AsyncExec::State::EXECUTING;
+                    {
+                        Tracer::Span span(Tracer::TASK_BEGIN, task.name);
+                        task.callback();
+                    }
+                    state = AsyncExec::State::IDLE;
+                    current = nullptr;
+                    // Only this thread modifies the counter
+                    tasks.store(tasks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
                 }
             }
         }
@@ -112,10 +149,77 @@ void AsyncExec::shutdown()
     g_workers.clear();
 }
 
-bool AsyncExec::schedule(const AsyncExec::Callback& callback)
+bool AsyncExec::schedule(const AsyncExec::Callback& callback, const char* name)
 {
     if (g_workers.empty() || !callback)
         return false;
-    g_tasks.enqueue(callback);
+    if (name != nullptr) {
+        Tracer::event(Tracer::QUEUE_BEGIN, name);
+    }
+    g_tasks.enqueue({callback, name});
+    g_scheduled.fetch_add(1, std::memory_order_relaxed);
     return true;
 }
+
+void AsyncExec::execute(const AsyncExec::Callback& callback, const char* name)
+{
+    auto prev = g_current;
+    g_current = name;
+    {
+        Tracer::Span span(Tracer::TASK_BEGIN, name);
+        callback();
+    }
+    g_current = prev;
+}
+
+bool AsyncExec::idle()
+{
+    if (g_tasks.size() > 0) {
+        return false;
+    }
+    for (auto& worker: g_workers) {
+        if (worker->state.load(std::memory_order_relaxed) != State::IDLE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void AsyncExec::setState(AsyncExec::State state)
+{
+    if (g_self != nullptr) {
+        g_self->state.store(state, std::memory_order_relaxed);
+    }
+}
+
+const char* AsyncExec::current()
+{
+    return (g_self != nullptr ? g_self->current.load(std::memory_order_relaxed) : g_current);
+}
+
+AsyncExec::Stats AsyncExec::stats()
+{
+    Stats stats;
+    stats.queued = g_tasks.size();
+    stats.scheduled = g_scheduled;
+    for (auto& worker: g_workers) {
+        WorkerStats w;
+        w.name = worker->name;
+        w.state = worker->state;
+        const char* current = worker->current;
+        w.record = (current != nullptr ? current : "");
+        w.tasks = worker->tasks;
+        stats.workers.push_back(w);
+    }
+    return stats;
+}
+
+const char* AsyncExec::stateName(AsyncExec::State state)
+{
+    switch (state) {
+    case State::IDLE:        return "idle";
+    case State::EXECUTING:   return "executing";
+    case State::WAITING_GIL: return "waiting GIL";
+    default:                 return "unknown";
+    }
+}
@@ -7,13 +7,58 @@
 #define ASYNCEXEC_H
 
 #include <functional>
+#include <string>
+#include <vector>
 
 class AsyncExec {
     public:
         using Callback = std::function<void()>;
+        enum class State {
+            IDLE,
+            EXECUTING,
+            WAITING_GIL,
+        };
+        struct WorkerStats {
+            std::string name;
+            State state;
+            std::string record;
+            unsigned long long tasks;
+        };
+        struct Stats {
+            unsigned long queued;
+            unsigned long long scheduled;
+            std::vector<WorkerStats> workers;
+        };
+
         static void init(unsigned numThreads);
         static void shutdown();
-        static bool schedule(const Callback& callback);
+        /**
+         * Schedule callback for execution in one of the worker threads.
+         *
+         * Optional name must remain valid for the lifetime of the program,
+         * it's displayed as currently processed item in reports.
+         */
+        static bool schedule(const Callback& callback, const char* name=nullptr);
+        /**
+         * Execute callback in the calling thread as if it was a named task,
+         * so that current() and timeline events work the same.
+         */
+        static void execute(const Callback& callback, const char* name);
+        /**
+         * True when no tasks are queued and all workers are idle.
+         */
+        static bool idle();
+        /**
+         * Update state of the calling worker thread, no-op for other threads.
+         */
+        static void setState(State state);
+        /**
+         * Name of the task being executed by the calling thread, nullptr
+         * when not executing a task or for unnamed tasks.
+         */
+        static const char* current();
+        static Stats stats();
+        static const char* stateName(State state);
 };
 
 #endif // ASYNCEXEC_H
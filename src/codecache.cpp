@@ -0,0 +1,167 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include "codecache.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <thread>
+
+#ifdef _WIN32
+#  include <process.h>
+#  define getpid _getpid
+#else
+#  include <unistd.h>
+#endif
+
+static const char g_header[] = "PYDEVCODE1";
+static std::string g_dir;
+static std::atomic<unsigned long long> g_loaded{0};
+static std::atomic<unsigned long long> g_stored{0};
+static std::atomic<unsigned long long> g_misses{0};
+static std::atomic<unsigned long long> g_errors{0};
+
+/**
+ * FNV-1a, names of cache files must not change between runs or builds.
+ */
+static uint64_t hash(const std::string& text)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c: text) {
+        h = (h ^ c) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static std::string filename(const std::string& source, long magic)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx.%lx.pydev", static_cast<unsigned long long>(hash(source)), magic);
+    return g_dir + "/" + name;
+}
+
+static bool readSize(FILE* f, uint64_t& size)
+{
+    unsigned char buf[8];
+    if (fread(buf, 1, sizeof(buf), f) != sizeof(buf)) {
+        return false;
+    }
+    size = 0;
+    for (int i = 7; i >= 0; i--) {
+        size = (size << 8) | buf[i];
+    }
+    return true;
+}
+
+static bool writeSize(FILE* f, uint64_t size)
+{
+    unsigned char buf[8];
+    for (int i = 0; i < 8; i++) {
+        buf[i] = static_cast<unsigned char>(size >> (8 * i));
+    }
+    return fwrite(buf, 1, sizeof(buf), f) == sizeof(buf);
+}
+
+static bool readString(FILE* f, std::string& str)
+{
+    uint64_t size;
+    if (!readSize(f, size) || size > (1ULL << 30)) {
+        return false;
+    }
+    str.resize(size);
+    return size == 0 || fread(&str[0], 1, size, f) == size;
+}
+
+static bool writeString(FILE* f, const std::string& str)
+{
+    return writeSize(f, str.size()) && (str.empty() || fwrite(str.data(), 1, str.size(), f) == str.size());
+}
+
+void CodeCache::setDirectory(const std::string& dir)
+{
+    g_dir = dir;
+    while (g_dir.size() > 1 && g_dir.back() == '/') {
+        g_dir.pop_back();
+    }
+}
+
+bool CodeCache::enabled()
+{
+    return !g_dir.empty();
+}
+
+bool CodeCache::load(const std::string& source, long magic, std::string& data)
+{
+    if (g_dir.empty()) {
+        return false;
+    }
+
+    FILE* f = fopen(filename(source, magic).c_str(), "rb");
+    if (f == nullptr) {
+        g_misses++;
+        return false;
+    }
+    char header[sizeof(g_header)];
+    std::string cached;
+    bool found = (fread(header, 1, sizeof(header), f) == sizeof(header) &&
+                  std::string(header, sizeof(header)) == std::string(g_header, sizeof(g_header)) &&
+                  readString(f, cached) && cached == source && readString(f, data));
+    fclose(f);
+    if (found) {
+        g_loaded++;
+    } else {
+        // Hash collision or file of other PyDevice version, overwritten when stored
+        g_misses++;
+    }
+    return found;
+}
+
+void CodeCache::store(const std::string& source, long magic, const std::string& data)
+{
+    if (g_dir.empty()) {
+        return;
+    }
+
+    auto path = filename(source, magic);
+    auto tmp = path + "." + std::to_string(getpid()) + "." +
+               std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (f == nullptr) {
+        if (g_errors++ == 0) {
+            printf("PyDevice can't write code cache file %s\n", tmp.c_str());
+        }
+        return;
+    }
+    bool ok = (fwrite(g_header, 1, sizeof(g_header), f) == sizeof(g_header) &&
+               writeString(f, source) && writeString(f, data));
+    ok = (fclose(f) == 0 && ok);
+#ifdef _WIN32
+    // Can't rename over existing file, another IOC may have stored it already
+    remove(path.c_str());
+#endif
+    if (ok && rename(tmp.c_str(), path.c_str()) == 0) {
+        g_stored++;
+    } else {
+        remove(tmp.c_str());
+        g_errors++;
+    }
+}
+
+CodeCache::Stats CodeCache::stats()
+{
+    return Stats{g_loaded, g_stored, g_misses, g_errors};
+}
+
+void CodeCache::report()
+{
+    if (g_dir.empty()) {
+        return;
+    }
+    auto s = stats();
+    printf("Code cache directory %s: %llu loaded, %llu stored, %llu misses, %llu errors\n",
+           g_dir.c_str(), s.loaded, s.stored, s.misses, s.errors);
+}
@@ -0,0 +1,45 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef CODECACHE_H
+#define CODECACHE_H
+
+#include <string>
+
+/**
+ * On-disk cache of compiled record code, kept across IOC restarts.
+ *
+ * Each code is stored in its own file named after the hash of the source
+ * and the Python magic number, which changes whenever bytecode format does,
+ * so IOCs running different Python versions can share the directory. File
+ * holds the source too, lookup only succeeds when it matches. Files are
+ * written to a temporary name first and renamed, concurrent IOCs either
+ * see a complete file or none. Data is opaque here, PyWrapper stores
+ * marshalled code objects.
+ */
+class CodeCache {
+    public:
+        struct Stats {
+            unsigned long long loaded;
+            unsigned long long stored;
+            unsigned long long misses;
+            unsigned long long errors;
+        };
+
+        /**
+         * Set existing directory for cache files, empty disables caching.
+         */
+        static void setDirectory(const std::string& dir);
+        static bool enabled();
+        /**
+         * Get data stored for source with given magic, false when not found.
+         */
+        static bool load(const std::string& source, long magic, std::string& data);
+        static void store(const std::string& source, long magic, const std::string& data);
+        static Stats stats();
+        static void report();
+};
+
+#endif // CODECACHE_H
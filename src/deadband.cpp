@@ -0,0 +1,77 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include "deadband.h"
+
+#include <epicsMutex.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <map>
+
+static epicsMutex g_mutex;
+static std::map<std::string, Deadband*> g_records;
+
+void Deadband::init(const char* record)
+{
+    m_record = record;
+    g_mutex.lock();
+    g_records[record] = this;
+    g_mutex.unlock();
+}
+
+bool Deadband::changed(RecordFields& fields, unsigned generation)
+{
+    auto& inputs = m_now;
+    fields.sample(inputs);
+    if (inputs.empty()) {
+        return true;
+    }
+
+    bool changed = (!m_valid || m_generation != generation || m_last.size() != inputs.size());
+    for (size_t i = 0; i < inputs.size() && !changed; i++) {
+        auto& now = inputs[i];
+        auto& last = m_last[i];
+        if (now.numeric != last.numeric) {
+            changed = true;
+        } else if (!now.numeric) {
+            changed = (now.checksum != last.checksum);
+        } else if (std::isnan(now.value) || std::isnan(last.value)) {
+            changed = (std::isnan(now.value) != std::isnan(last.value));
+        } else {
+            double limit = (m_relative ? m_deadband * std::fabs(last.value) : m_deadband);
+            changed = (std::fabs(now.value - last.value) > limit);
+        }
+    }
+
+    if (changed) {
+        m_last.swap(inputs);
+        m_generation = generation;
+        m_valid = true;
+    }
+    return changed;
+}
+
+bool Deadband::set(const std::string& record, const char* deadband)
+{
+    char* end;
+    double value = strtod(deadband, &end);
+    bool relative = (*end == '%');
+    if (end == deadband || (*end != 0 && !(relative && end[1] == 0)) || !(value >= 0.0)) {
+        return false;
+    }
+
+    g_mutex.lock();
+    auto it = g_records.find(record);
+    bool found = (it != g_records.end());
+    if (found) {
+        it->second->m_enabled = true;
+        it->second->m_relative = relative;
+        it->second->m_deadband = (relative ? value / 100.0 : value);
+        it->second->m_valid = false;
+    }
+    g_mutex.unlock();
+    return found;
+}
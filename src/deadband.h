@@ -0,0 +1,58 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef DEADBAND_H
+#define DEADBAND_H
+
+#include "recfields.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * Skip executions when inputs of record code did not change.
+ *
+ * Inputs are the fields bound for code substitution, sampled raw without
+ * rendering their text. Records opt in with a deadband applied to all
+ * scalar numeric inputs, absolute or relative to the value of the last
+ * execution. Arrays, strings and links are compared by checksum, any
+ * change counts. Values are compared with the ones from the
+ * last execution rather than the last check, so slow drifts still trigger
+ * execution eventually. Code without any inputs always executes, and so
+ * does code that changed since the last execution.
+ */
+class Deadband {
+    public:
+        void init(const char* record);
+        bool enabled() const { return m_enabled; }
+        /**
+         * Returns true when any input moved beyond deadband, values are then
+         * remembered as the ones of the last execution.
+         */
+        bool changed(RecordFields& fields, unsigned generation);
+        /**
+         * Forget last values so that next check reports a change, ie. after failed execution.
+         */
+        void reset() { m_valid = false; }
+
+        /**
+         * Set deadband of a record by name from "<value>" or "<percent>%".
+         *
+         * Returns false if record is unknown or deadband can't be parsed.
+         */
+        static bool set(const std::string& record, const char* deadband);
+
+    private:
+        const char* m_record{nullptr};
+        bool m_enabled{false};
+        bool m_relative{false};
+        double m_deadband{0.0};
+        bool m_valid{false};
+        unsigned m_generation{0};
+        std::vector<RecordFields::Sample> m_last;
+        std::vector<RecordFields::Sample> m_now;
+};
+
+#endif // DEADBAND_H
@@ -0,0 +1,213 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include "devgroup.h"
+#include "asyncexec.h"
+
+#include <dbAccess.h>
+#include <dbCommon.h>
+#include <dbLock.h>
+#include <epicsMutex.h>
+
+#include <cstdio>
+#include <map>
+
+static epicsMutex g_mutex;
+static std::map<std::string, DevGroup::Member*> g_records;
+static std::map<std::string, DevGroup*> g_groups;
+
+void DevGroup::Member::init(dbCommon* rec, CALLBACK* callback)
+{
+    m_rec = rec;
+    m_callback = callback;
+    callbackSetCallback(notify, &m_notify);
+    callbackSetUser(this, &m_notify);
+    g_mutex.lock();
+    g_records[rec->name] = this;
+    g_mutex.unlock();
+}
+
+bool DevGroup::Member::take(Result& result)
+{
+    g_mutex.lock();
+    if (m_delivered) {
+        result = m_result;
+        m_delivered = false;
+        g_mutex.unlock();
+        return true;
+    }
+
+    auto group = m_group;
+    bool scheduled = group->m_scheduled;
+    if (!scheduled) {
+        scheduled = AsyncExec::schedule([group]() {
+            group->execute();
+        }, group->m_name.c_str());
+        group->m_scheduled = scheduled;
+    }
+    m_waiting = scheduled;
+    g_mutex.unlock();
+
+    if (!scheduled) {
+        result.value = PyWrapper::MultiTypeValue();
+        epicsTimeGetCurrent(&result.time);
+        result.failed = true;
+    }
+    return !scheduled;
+}
+
+/**
+ * Process member that was not processing when result was delivered.
+ *
+ * Result may already be taken by processing in the meantime, which
+ * makes another processing unnecessary.
+ */
+void DevGroup::Member::notify(CALLBACK* callback)
+{
+    void* user;
+    callbackGetUser(user, callback);
+    auto member = reinterpret_cast<Member*>(user);
+
+    dbScanLock(member->m_rec);
+    g_mutex.lock();
+    bool delivered = member->m_delivered;
+    member->m_notified = false;
+    g_mutex.unlock();
+    if (delivered && member->m_rec->pact == 0) {
+        dbProcess(member->m_rec);
+    }
+    dbScanUnlock(member->m_rec);
+}
+
+DevGroup* DevGroup::get(const std::string& name)
+{
+    auto it = g_groups.find(name);
+    if (it == g_groups.end()) {
+        // Groups live as long as the records, name is used for the task
+        it = g_groups.emplace(name, new DevGroup(name)).first;
+    }
+    return it->second;
+}
+
+void DevGroup::define(const std::string& group, const std::string& code)
+{
+    g_mutex.lock();
+    auto g = get(group);
+    if (!g->m_code.empty() && g->m_code != code) {
+        printf("Redefining code of group %s\n", group.c_str());
+    }
+    g->m_code = code;
+    g_mutex.unlock();
+}
+
+bool DevGroup::join(const std::string& record, const std::string& spec)
+{
+    auto sep = spec.find(' ');
+    auto start = spec.find_first_not_of(' ', sep);
+    if (sep == 0 || sep == std::string::npos || start == std::string::npos) {
+        return false;
+    }
+    std::string name = spec.substr(0, sep);
+    std::string key = spec.substr(start, spec.find_last_not_of(' ') + 1 - start);
+
+    g_mutex.lock();
+    auto it = g_records.find(record);
+    bool found = (it != g_records.end() && it->second->m_group == nullptr);
+    if (found) {
+        auto member = it->second;
+        auto group = get(name);
+        member->m_group = group;
+        group->m_members.push_back(member);
+        group->m_keys.push_back(key);
+#ifdef epicsTimeEventDeviceTime
+        // Keep the group timestamp set by device support
+        if (member->m_rec->tse == 0) {
+            member->m_rec->tse = epicsTimeEventDeviceTime;
+        }
+#endif
+    }
+    g_mutex.unlock();
+    return found;
+}
+
+/**
+ * Execute group code in worker thread and deliver results to all members.
+ *
+ * Members are only added during IOC initialization, before any execution.
+ */
+void DevGroup::execute()
+{
+    bool debug = false;
+    for (auto member: m_members) {
+        debug |= (member->m_rec->tpro == 1);
+    }
+
+    g_mutex.lock();
+    std::string code = m_code;
+    g_mutex.unlock();
+
+    std::vector<PyWrapper::MultiTypeValue> values;
+    bool failed = false;
+    try {
+        values = PyWrapper::execItems(code, debug, m_keys);
+    } catch (...) {
+        failed = true;
+    }
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+
+    std::vector<Member*> waiting, notify;
+    g_mutex.lock();
+    m_scheduled = false;
+    m_executions++;
+    if (failed) {
+        m_errors++;
+    }
+    for (size_t i = 0; i < m_members.size(); i++) {
+        auto member = m_members[i];
+        member->m_result.value = (failed ? PyWrapper::MultiTypeValue() : values[i]);
+        member->m_result.time = now;
+        member->m_result.failed = failed;
+        member->m_delivered = true;
+        if (member->m_waiting) {
+            member->m_waiting = false;
+            waiting.push_back(member);
+        } else if (!member->m_notified) {
+            member->m_notified = true;
+            notify.push_back(member);
+        }
+    }
+    g_mutex.unlock();
+
+    for (auto member: waiting) {
+        callbackRequestProcessCallback(member->m_callback, member->m_rec->prio, member->m_rec);
+    }
+    for (auto member: notify) {
+        callbackSetPriority(member->m_rec->prio, &member->m_notify);
+        callbackRequest(&member->m_notify);
+    }
+}
+
+void DevGroup::report(int level)
+{
+    g_mutex.lock();
+    unsigned long long members = 0, executions = 0, errors = 0;
+    for (auto& it: g_groups) {
+        members += it.second->m_members.size();
+        executions += it.second->m_executions;
+        errors += it.second->m_errors;
+    }
+    printf("Groups: %zu, members: %llu, executions: %llu, errors: %llu\n",
+           g_groups.size(), members, executions, errors);
+    if (level > 0 && !g_groups.empty()) {
+        printf("  %-30s %10s %12s %10s  %s\n", "group", "members", "executions", "errors", "code");
+        for (auto& it: g_groups) {
+            auto group = it.second;
+            printf("  %-30s %10zu %12llu %10llu  %s\n", group->m_name.c_str(), group->m_members.size(),
+                   group->m_executions, group->m_errors, group->m_code.c_str());
+        }
+    }
+    g_mutex.unlock();
+}
@@ -0,0 +1,97 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef DEVGROUP_H
+#define DEVGROUP_H
+
+#include "pywrapper.h"
+
+#include <callback.h>
+#include <epicsTime.h>
+
+#include <string>
+#include <vector>
+
+struct dbCommon;
+
+/**
+ * Input records sharing a single execution of group code.
+ *
+ * Group code returns a dict or a sequence with values of all members, ie.
+ * read from device in one transaction. Processing any member schedules
+ * group code unless it's already pending, then every member picks its
+ * value by key, all with the same timestamp. Members that are processing
+ * complete, the others are processed to receive their value, so that the
+ * whole group updates from one execution. Record code of members is not
+ * executed.
+ */
+class DevGroup {
+    public:
+        struct Result {
+            PyWrapper::MultiTypeValue value;
+            epicsTimeStamp time;
+            bool failed;
+        };
+
+        /**
+         * Group membership of a record, part of its device support context.
+         */
+        class Member {
+            public:
+                /**
+                 * Make record available for joining, callback completes asynchronous processing.
+                 */
+                void init(dbCommon* rec, CALLBACK* callback);
+                bool joined() const { return m_group != nullptr; }
+                /**
+                 * Take result delivered by group execution, or schedule one.
+                 *
+                 * Returns false when record must wait for the result, it is
+                 * processed again once the result is delivered. Failure to
+                 * schedule execution is returned as failed result.
+                 */
+                bool take(Result& result);
+
+            private:
+                friend class DevGroup;
+                static void notify(CALLBACK* callback);
+
+                dbCommon* m_rec{nullptr};
+                CALLBACK* m_callback{nullptr};
+                CALLBACK m_notify;
+                DevGroup* m_group{nullptr};
+                Result m_result;
+                bool m_delivered{false};    // result not taken yet
+                bool m_waiting{false};      // processing waits for result
+                bool m_notified{false};     // processing requested to take result
+        };
+
+        /**
+         * Set code of a group, group is created when needed.
+         */
+        static void define(const std::string& group, const std::string& code);
+        /**
+         * Add record by name to a group, spec is "<group> <key>".
+         *
+         * Returns false if record is unknown, can't be a member or spec is invalid.
+         */
+        static bool join(const std::string& record, const std::string& spec);
+        static void report(int level);
+
+    private:
+        explicit DevGroup(const std::string& name) : m_name(name) {}
+        static DevGroup* get(const std::string& name);
+        void execute();
+
+        std::string m_name;
+        std::string m_code;
+        std::vector<Member*> m_members;
+        std::vector<std::string> m_keys;
+        bool m_scheduled{false};
+        unsigned long long m_executions{0};
+        unsigned long long m_errors{0};
+};
+
+#endif // DEVGROUP_H
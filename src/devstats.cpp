@@ -0,0 +1,153 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include "devstats.h"
+#include "asyncexec.h"
+#include "codecache.h"
+#include "devgroup.h"
+#include "inlineexec.h"
+#include "memstats.h"
+#include "pywrapper.h"
+#include "slowexec.h"
+#include "tracer.h"
+#include "util.h"
+
+#include <epicsMutex.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <vector>
+
+static epicsMutex g_mutex;
+static std::vector<DevStats*> g_records;
+
+static inline uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Single writer, see class description
+static inline void add(std::atomic<uint64_t>& counter, uint64_t value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+void DevStats::init(const char* record, const char* type)
+{
+    m_record = record;
+    m_type = type;
+    g_mutex.lock();
+    g_records.push_back(this);
+    g_mutex.unlock();
+}
+
+void DevStats::setIoIntr(const std::string& param)
+{
+    m_ioIntr = param;
+    MemStats::setIoIntr(m_record, param);
+}
+
+void DevStats::scheduled()
+{
+    Tracer::event(Tracer::RECORD_BEGIN, m_record);
+    m_scheduled = now();
+}
+
+void DevStats::skipped()
+{
+    add(m_skipped, 1);
+}
+
+void DevStats::completed(bool success)
+{
+    Tracer::event(Tracer::RECORD_END, m_record);
+    add(m_executions, 1);
+    if (!success) {
+        add(m_errors, 1);
+    }
+    if (m_scheduled != 0) {
+        auto latency = now() - m_scheduled;
+        add(m_latencySum, latency);
+        if (latency > m_latencyMax.load(std::memory_order_relaxed)) {
+            m_latencyMax.store(latency, std::memory_order_relaxed);
+        }
+        m_scheduled = 0;
+    }
+}
+
+void DevStats::report(int level, const char* type)
+{
+    g_mutex.lock();
+    std::vector<DevStats*> records = g_records;
+    g_mutex.unlock();
+
+    if (type == nullptr) {
+        auto exec = AsyncExec::stats();
+        printf("PyDevice executor: %zu workers, %lu tasks queued, %llu scheduled\n",
+               exec.workers.size(), exec.queued, exec.scheduled);
+        for (auto& w: exec.workers) {
+            printf("  %-20s %-12s %10llu tasks  %s\n", w.name.c_str(), AsyncExec::stateName(w.state), w.tasks, w.record.c_str());
+        }
+    }
+
+    uint64_t numRecords = 0, executions = 0, skipped = 0, errors = 0, latencySum = 0, latencyMax = 0;
+    std::map<std::string, unsigned> fanout;
+    for (auto rec: records) {
+        if (type != nullptr && strcmp(rec->m_type, type) != 0) {
+            continue;
+        }
+        numRecords++;
+        executions += rec->m_executions;
+        errors += rec->m_errors;
+        skipped += rec->m_skipped;
+        latencySum += rec->m_latencySum;
+        latencyMax = std::max(latencyMax, rec->m_latencyMax.load());
+        if (!rec->m_ioIntr.empty()) {
+            fanout[rec->m_ioIntr]++;
+        }
+    }
+    printf("%s records: %llu, executions: %llu, skipped: %llu, errors: %llu, latency mean: %.1f us, max: %.1f us\n",
+           (type ? type : "PyDevice"), (unsigned long long)numRecords, (unsigned long long)executions,
+           (unsigned long long)skipped, (unsigned long long)errors, (executions > 0 ? 1e-3 * latencySum / executions : 0.0), 1e-3 * latencyMax);
+
+    if (type == nullptr) {
+        auto py = PyWrapper::stats();
+        auto lookups = py.handleCacheHits + py.handleCacheMisses;
+        printf("Handle cache: %llu hits, %llu misses (%.1f%% hit rate)\n", py.handleCacheHits, py.handleCacheMisses,
+               (lookups > 0 ? 100.0 * py.handleCacheHits / lookups : 0.0));
+        printf("Code cache: %llu precompiled, %llu hits, %zu distinct record code templates\n",
+               py.codeCacheSize, py.codeCacheHits, Util::Template::interned());
+        CodeCache::report();
+        SlowExec::report(level);
+        InlineExec::report();
+        DevGroup::report(level);
+
+        if (level > 0 && !py.ioIntrNotifications.empty()) {
+            printf("  %-30s %10s %14s\n", "I/O Intr parameter", "records", "notifications");
+            for (auto& it: py.ioIntrNotifications) {
+                printf("  %-30s %10u %14llu\n", it.first.c_str(), fanout[it.first], it.second);
+            }
+        }
+    }
+
+    if (level > 0) {
+        printf("  %-30s %-10s %10s %10s %8s %10s %10s\n", "record", "type", "executions", "skipped", "errors", "mean[us]", "max[us]");
+        for (auto rec: records) {
+            if (type != nullptr && strcmp(rec->m_type, type) != 0) {
+                continue;
+            }
+            uint64_t n = rec->m_executions;
+            if (n == 0 && level < 2) {
+                continue;
+            }
+            printf("  %-30s %-10s %10llu %10llu %8llu %10.1f %10.1f\n", rec->m_record, rec->m_type,
+                   (unsigned long long)n, (unsigned long long)rec->m_skipped.load(), (unsigned long long)rec->m_errors.load(),
+                   (n > 0 ? 1e-3 * rec->m_latencySum / n : 0.0), 1e-3 * rec->m_latencyMax);
+        }
+    }
+}
@@ -0,0 +1,49 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef DEVSTATS_H
+#define DEVSTATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * Always-on per-record processing counters.
+ *
+ * Record processing is serialized by PACT, so each instance has a single
+ * writer and counters are updated without atomic read-modify-write
+ * operations. Reports can read them from any thread at any time.
+ */
+class DevStats {
+    public:
+        void init(const char* record, const char* type);
+        void setIoIntr(const std::string& param);
+        void scheduled();
+        void completed(bool success);
+        /**
+         * Processing completed without executing code, previous result was reused.
+         */
+        void skipped();
+
+        /**
+         * Print statistics of records of given type, or all records and
+         * executor state when type is nullptr.
+         */
+        static void report(int level, const char* type=nullptr);
+
+    private:
+        const char* m_record{nullptr};
+        const char* m_type{nullptr};
+        std::string m_ioIntr;
+        uint64_t m_scheduled{0};
+        std::atomic<uint64_t> m_executions{0};
+        std::atomic<uint64_t> m_errors{0};
+        std::atomic<uint64_t> m_skipped{0};
+        std::atomic<uint64_t> m_latencySum{0};
+        std::atomic<uint64_t> m_latencyMax{0};
+};
+
+#endif // DEVSTATS_H
@@ -0,0 +1,316 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef DEVSUPPORT_H
+#define DEVSUPPORT_H
+
+#include <alarm.h>
+#include <callback.h>
+#include <cantProceed.h>
+#include <dbScan.h>
+#include <devSup.h>
+#include <recGbl.h>
+
+#include <chrono>
+#include <map>
+#include <string>
+
+#include "asyncexec.h"
+#include "deadband.h"
+#include "devgroup.h"
+#include "devstats.h"
+#include "inlineexec.h"
+#include "latency.h"
+#include "precompile.h"
+#include "pywrapper.h"
+#include "recfields.h"
+#include "util.h"
+
+struct PyDevContext {
+    CALLBACK callback;
+    IOSCANPVT scan;
+    int processCbStatus;
+    Latency::Trace trace;
+    DevStats stats;
+    Util::Template code;
+    RecordFields fields;
+    InlineExec inlined;
+    Deadband deadband;
+    DevGroup::Member group;
+};
+
+/**
+ * Defaults for record traits, record specific traits override as needed.
+ *
+ * Traits must also define:
+ * - Record type
+ * - static const char* type() returning record type name
+ * - static DBLINK& link(Record*) returning INP or OUT link with the code
+ * - static bool exec(Record*, const std::string& code) executing code and
+ *   storing the result, returning false when result can't be converted
+ *
+ * Input records that can be DevGroup members also set groups and define
+ * static bool store(Record*, const PyWrapper::MultiTypeValue&) storing
+ * the result, which exec() usually shares.
+ */
+struct DevTraits {
+    /**
+     * Return value of init_record, 2 tells output record not to convert.
+     */
+    static const long initStatus = 0;
+    /**
+     * Return value of the completed processing, 2 tells input record not to convert.
+     */
+    static const long successStatus = 0;
+
+    /**
+     * Whether record can be a member of DevGroup.
+     */
+    static const bool groups = false;
+
+    /**
+     * Called before fields are read for code substitution.
+     */
+    template <typename Record>
+    static void prepare(Record* /*rec*/) {}
+
+    /**
+     * Store result of group code, only called when groups is true.
+     */
+    template <typename Record>
+    static bool store(Record* /*rec*/, const PyWrapper::MultiTypeValue& /*value*/) { return false; }
+
+    /**
+     * Record specific formatting of fields.
+     */
+    static const RecordFields::Overrides& overrides()
+    {
+        static const RecordFields::Overrides none;
+        return none;
+    }
+};
+
+/**
+ * Asynchronous device support functions shared by all record types.
+ *
+ * Record processing schedules the code with AsyncExec and completes in the
+ * second pass, once the worker thread executed code and requested record
+ * processing. Records that opted in with InlineExec execute cheap code
+ * in the processing thread and complete synchronously instead. Members
+ * of a DevGroup take their value from the shared group execution.
+ * Record specifics come from the Traits, see DevTraits.
+ */
+template <typename Traits>
+class DevSupport {
+    public:
+        using Record = typename Traits::Record;
+
+        static long initRecord(Record* rec)
+        {
+            std::string addr = Traits::link(rec).value.instio.string;
+            void *buffer = callocMustSucceed(1, sizeof(PyDevContext), "PyDev::initRecord");
+            PyDevContext* ctx = new (buffer) PyDevContext;
+            rec->dpvt = ctx;
+            ctx->trace.init(rec->name);
+            ctx->stats.init(rec->name, Traits::type());
+            ctx->inlined.init(rec->name);
+            ctx->deadband.init(rec->name);
+            Precompile::add(rec->name, &ctx->code, Traits::link(rec).value.instio.string);
+            if (Traits::groups) {
+                ctx->group.init(reinterpret_cast<dbCommon*>(rec), &ctx->callback);
+            }
+
+            // This could be better checked with regex
+            if (addr.find("pydev.iointr('") == 0 && addr.substr(addr.size()-2) == "')") {
+                std::string param = addr.substr(14, addr.size()-16);
+                auto it = ioScanPvts.find(param);
+                if (it == ioScanPvts.end()) {
+                    scanIoInit( &ioScanPvts[param] );
+                    PyWrapper::Callback cb = std::bind(scanCallback, ioScanPvts[param]);
+                    PyWrapper::registerIoIntr(param, cb);
+                    it = ioScanPvts.find(param);
+                }
+                ctx->scan = it->second;
+                ctx->stats.setIoIntr(param);
+            } else {
+                ctx->scan = nullptr;
+            }
+
+            return Traits::initStatus;
+        }
+
+        static long getIointInfo(int /*direction*/, Record *rec, IOSCANPVT* io)
+        {
+            auto ctx = reinterpret_cast<PyDevContext*>(rec->dpvt);
+            if (ctx != nullptr && ctx->scan != nullptr) {
+                *io = ctx->scan;
+            }
+            return 0;
+        }
+
+        static long processRecord(Record* rec)
+        {
+            auto ctx = reinterpret_cast<PyDevContext*>(rec->dpvt);
+            if (ctx == nullptr) {
+                // Keep PACT=1 to prevent further processing
+                rec->pact = 1;
+                recGblSetSevr(rec, epicsAlarmUDF, epicsSevInvalid);
+                return -1;
+            }
+
+            if (ctx->group.joined()) {
+                return processGroup(rec);
+            }
+
+            if (rec->pact == 1) {
+                rec->pact = 0;
+                ctx->trace.complete();
+                ctx->stats.completed(ctx->processCbStatus >= 0);
+                return ctx->processCbStatus;
+            }
+
+            ctx->code.fields(Traits::link(rec).value.instio.string);
+            ctx->fields.bind(reinterpret_cast<dbCommon*>(rec), ctx->code, Traits::overrides());
+
+            // Unchanged inputs complete right away, keeping previous value
+            if (ctx->deadband.enabled() && !ctx->fields.foreign()) {
+                if (!ctx->deadband.changed(ctx->fields, ctx->code.generation())) {
+                    ctx->stats.scheduled();
+                    ctx->stats.skipped();
+                    ctx->stats.completed(ctx->processCbStatus >= 0);
+                    return ctx->processCbStatus;
+                }
+            }
+
+            ctx->trace.mark(Latency::SCHEDULED);
+            ctx->stats.scheduled();
+
+            // Foreign fields are locked while reading, not safe with this record locked
+            if (ctx->inlined.use() && !ctx->fields.foreign() && AsyncExec::idle()) {
+                // Code putting to this record must not process it again meanwhile
+                rec->pact = 1;
+                AsyncExec::execute([rec]() {
+                    execute(rec, true);
+                }, rec->name);
+                rec->pact = 0;
+                ctx->trace.complete();
+                ctx->stats.completed(ctx->processCbStatus >= 0);
+                return ctx->processCbStatus;
+            }
+
+            rec->pact = 1;
+            auto scheduled = AsyncExec::schedule([rec]() {
+                processRecordCb(rec);
+            }, rec->name);
+            return (scheduled ? 0 : -1);
+        }
+
+        static long report(int level)
+        {
+            DevStats::report(level, Traits::type());
+            return 0;
+        }
+
+    private:
+        static std::map<std::string, IOSCANPVT> ioScanPvts;
+
+        static void scanCallback(IOSCANPVT scan)
+        {
+#ifdef VERSION_INT
+#  if EPICS_VERSION_INT < VERSION_INT(3,16,0,0)
+            scanIoRequest(scan);
+#  else
+            scanIoImmediate(scan, priorityHigh);
+            scanIoImmediate(scan, priorityMedium);
+            scanIoImmediate(scan, priorityLow);
+#  endif
+#else
+            scanIoRequest(scan);
+#endif
+        }
+
+        /**
+         * Complete processing of a group member with the result of group execution.
+         */
+        static long processGroup(Record* rec)
+        {
+            auto ctx = reinterpret_cast<PyDevContext*>(rec->dpvt);
+            if (rec->pact == 0) {
+                ctx->trace.mark(Latency::SCHEDULED);
+                ctx->stats.scheduled();
+            }
+
+            DevGroup::Result result;
+            if (!ctx->group.take(result)) {
+                rec->pact = 1;
+                return 0;
+            }
+            rec->pact = 0;
+
+            if (!result.failed && Traits::store(rec, result.value)) {
+                ctx->processCbStatus = Traits::successStatus;
+            } else {
+                if (rec->tpro == 1 && !result.failed) {
+                    printf("ERROR: Can't convert group value to record type\n");
+                }
+                recGblSetSevr(rec, epicsAlarmCalc, epicsSevInvalid);
+                ctx->processCbStatus = -1;
+            }
+            rec->time = result.time;
+
+            ctx->trace.complete();
+            ctx->stats.completed(ctx->processCbStatus >= 0);
+            return ctx->processCbStatus;
+        }
+
+        /**
+         * Execute record code and store the result, in worker or processing thread.
+         */
+        static void execute(Record* rec, bool inlined)
+        {
+            auto ctx = reinterpret_cast<PyDevContext*>(rec->dpvt);
+            Latency::Scope latency(ctx->trace);
+
+            Traits::prepare(rec);
+
+            ctx->fields.get(ctx->code.fields());
+            const std::string& code = ctx->code.render();
+
+            auto start = std::chrono::steady_clock::now();
+            try {
+                if (Traits::exec(rec, code) == true) {
+                    ctx->processCbStatus = Traits::successStatus;
+                } else {
+                    if (rec->tpro == 1) {
+                        printf("ERROR: Can't convert returned Python type to record type\n");
+                    }
+                    recGblSetSevr(rec, epicsAlarmCalc, epicsSevInvalid);
+                    ctx->processCbStatus = -1;
+                }
+            } catch (...) {
+                recGblSetSevr(rec, epicsAlarmCalc, epicsSevInvalid);
+                ctx->processCbStatus = -1;
+            }
+            if (ctx->processCbStatus == -1) {
+                ctx->deadband.reset();
+            }
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            ctx->inlined.executed(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), inlined);
+        }
+
+        static void processRecordCb(Record* rec)
+        {
+            auto ctx = reinterpret_cast<PyDevContext*>(rec->dpvt);
+            execute(rec, false);
+
+            ctx->trace.mark(Latency::REQUESTED);
+            callbackRequestProcessCallback(&ctx->callback, rec->prio, rec);
+        }
+};
+
+template <typename Traits>
+std::map<std::string, IOSCANPVT> DevSupport<Traits>::ioScanPvts;
+
+#endif // DEVSUPPORT_H
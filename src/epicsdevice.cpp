@@ -3,12 +3,31 @@
 * in file LICENSE that is included with this distribution.
 \*************************************************************************/
 
+#include <dbAccess.h>
+#include <dbStaticLib.h>
 #include <epicsExit.h>
 #include <epicsExport.h>
+#include <initHooks.h>
 #include <iocsh.h>
 
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+
 #include "asyncexec.h"
+#include "codecache.h"
+#include "deadband.h"
+#include "devgroup.h"
+#include "devstats.h"
+#include "gilstats.h"
+#include "inlineexec.h"
+#include "latency.h"
+#include "memstats.h"
+#include "precompile.h"
+#include "profiler.h"
+#include "slowexec.h"
 #include "pywrapper.h"
+#include "tracer.h"
 #include "util.h"
 
 extern "C"
@@ -32,6 +51,232 @@ static void pydevCall(const iocshArgBuf * args)
     pydev(args[0].sval);
 }
 
+static const iocshArg pydevLatencyArg0 = { "record", iocshArgString };
+static const iocshArg pydevLatencyArg1 = { "reset", iocshArgInt };
+static const iocshArg *const pydevLatencyArgs[] = { &pydevLatencyArg0, &pydevLatencyArg1 };
+static const iocshFuncDef pydevLatencyDef = { "pydevLatency", 2, pydevLatencyArgs };
+static void pydevLatencyCall(const iocshArgBuf * args)
+{
+    Latency::report(args[0].sval ? args[0].sval : "", args[1].ival != 0);
+}
+
+static const iocshArg pydevLatencyEnableArg0 = { "level", iocshArgInt };
+static const iocshArg *const pydevLatencyEnableArgs[] = { &pydevLatencyEnableArg0 };
+static const iocshFuncDef pydevLatencyEnableDef = { "pydevLatencyEnable", 1, pydevLatencyEnableArgs };
+static void pydevLatencyEnableCall(const iocshArgBuf * args)
+{
+    Latency::setLevel(args[0].ival);
+}
+
+static const iocshArg pydevGilReportArg0 = { "reset", iocshArgInt };
+static const iocshArg *const pydevGilReportArgs[] = { &pydevGilReportArg0 };
+static const iocshFuncDef pydevGilReportDef = { "pydevGilReport", 1, pydevGilReportArgs };
+static void pydevGilReportCall(const iocshArgBuf * args)
+{
+    GilStats::report(args[0].ival != 0);
+}
+
+static const iocshArg pydevGilSamplerArg0 = { "period", iocshArgDouble };
+static const iocshArg *const pydevGilSamplerArgs[] = { &pydevGilSamplerArg0 };
+static const iocshFuncDef pydevGilSamplerDef = { "pydevGilSampler", 1, pydevGilSamplerArgs };
+static void pydevGilSamplerCall(const iocshArgBuf * args)
+{
+    GilStats::startSampler(args[0].dval);
+}
+
+static const iocshArg pydevReportArg0 = { "level", iocshArgInt };
+static const iocshArg *const pydevReportArgs[] = { &pydevReportArg0 };
+static const iocshFuncDef pydevReportDef = { "pydevReport", 1, pydevReportArgs };
+static void pydevReportCall(const iocshArgBuf * args)
+{
+    DevStats::report(args[0].ival);
+}
+
+static const iocshArg pydevTraceEnableArg0 = { "eventsPerThread", iocshArgInt };
+static const iocshArg *const pydevTraceEnableArgs[] = { &pydevTraceEnableArg0 };
+static const iocshFuncDef pydevTraceEnableDef = { "pydevTraceEnable", 1, pydevTraceEnableArgs };
+static void pydevTraceEnableCall(const iocshArgBuf * args)
+{
+    Tracer::enable(args[0].ival > 0 ? args[0].ival : 0);
+}
+
+static const iocshArg pydevTraceDumpArg0 = { "filename", iocshArgString };
+static const iocshArg *const pydevTraceDumpArgs[] = { &pydevTraceDumpArg0 };
+static const iocshFuncDef pydevTraceDumpDef = { "pydevTraceDump", 1, pydevTraceDumpArgs };
+static void pydevTraceDumpCall(const iocshArgBuf * args)
+{
+    Tracer::dump(args[0].sval ? args[0].sval : "pydev_trace.json");
+}
+
+static const iocshArg pydevProfileArg0 = { "record", iocshArgString };
+static const iocshArg pydevProfileArg1 = { "executions", iocshArgInt };
+static const iocshArg pydevProfileArg2 = { "filename", iocshArgString };
+static const iocshArg *const pydevProfileArgs[] = { &pydevProfileArg0, &pydevProfileArg1, &pydevProfileArg2 };
+static const iocshFuncDef pydevProfileDef = { "pydevProfile", 3, pydevProfileArgs };
+static void pydevProfileCall(const iocshArgBuf * args)
+{
+    if (args[0].sval == nullptr) {
+        printf("Usage: pydevProfile <record> <executions> [filename]\n");
+        return;
+    }
+    std::string record = args[0].sval;
+    if (args[1].ival <= 0) {
+        Profiler::stop(record);
+    } else {
+        std::string filename = (args[2].sval ? args[2].sval : record + ".prof");
+        if (Profiler::start(record, args[1].ival, filename)) {
+            printf("Profiling next %d executions of %s\n", args[1].ival, record.c_str());
+        }
+    }
+}
+
+static const iocshArg pydevSlowThresholdArg0 = { "ms", iocshArgDouble };
+static const iocshArg pydevSlowThresholdArg1 = { "record", iocshArgString };
+static const iocshArg *const pydevSlowThresholdArgs[] = { &pydevSlowThresholdArg0, &pydevSlowThresholdArg1 };
+static const iocshFuncDef pydevSlowThresholdDef = { "pydevSlowThreshold", 2, pydevSlowThresholdArgs };
+static void pydevSlowThresholdCall(const iocshArgBuf * args)
+{
+    if (args[1].sval != nullptr && args[1].sval[0] != 0) {
+        SlowExec::setThreshold(args[1].sval, 1e-3 * args[0].dval);
+    } else {
+        SlowExec::setThreshold(1e-3 * args[0].dval);
+    }
+}
+
+static const iocshArg pydevSlowLogArg0 = { "rate", iocshArgDouble };
+static const iocshArg pydevSlowLogArg1 = { "stack", iocshArgInt };
+static const iocshArg *const pydevSlowLogArgs[] = { &pydevSlowLogArg0, &pydevSlowLogArg1 };
+static const iocshFuncDef pydevSlowLogDef = { "pydevSlowLog", 2, pydevSlowLogArgs };
+static void pydevSlowLogCall(const iocshArgBuf * args)
+{
+    SlowExec::setLogging(args[0].dval, args[1].ival != 0);
+}
+
+static const iocshArg pydevMemTrackArg0 = { "enable", iocshArgInt };
+static const iocshArg *const pydevMemTrackArgs[] = { &pydevMemTrackArg0 };
+static const iocshFuncDef pydevMemTrackDef = { "pydevMemTrack", 1, pydevMemTrackArgs };
+static void pydevMemTrackCall(const iocshArgBuf * args)
+{
+    MemStats::enable(args[0].ival != 0);
+}
+
+static const iocshArg pydevMemReportArg0 = { "top", iocshArgInt };
+static const iocshArg pydevMemReportArg1 = { "reset", iocshArgInt };
+static const iocshArg *const pydevMemReportArgs[] = { &pydevMemReportArg0, &pydevMemReportArg1 };
+static const iocshFuncDef pydevMemReportDef = { "pydevMemReport", 2, pydevMemReportArgs };
+static void pydevMemReportCall(const iocshArgBuf * args)
+{
+    MemStats::report(args[0].ival > 0 ? args[0].ival : 10, args[1].ival != 0);
+}
+
+static const iocshArg pydevGroupArg0 = { "group", iocshArgString };
+static const iocshArg pydevGroupArg1 = { "code", iocshArgString };
+static const iocshArg *const pydevGroupArgs[] = { &pydevGroupArg0, &pydevGroupArg1 };
+static const iocshFuncDef pydevGroupDef = { "pydevGroup", 2, pydevGroupArgs };
+static void pydevGroupCall(const iocshArgBuf * args)
+{
+    if (args[0].sval == nullptr || args[1].sval == nullptr) {
+        printf("Usage: pydevGroup <group> <code>\n");
+        return;
+    }
+    DevGroup::define(args[0].sval, args[1].sval);
+}
+
+static const iocshArg pydevInlineBudgetArg0 = { "us", iocshArgDouble };
+static const iocshArg *const pydevInlineBudgetArgs[] = { &pydevInlineBudgetArg0 };
+static const iocshFuncDef pydevInlineBudgetDef = { "pydevInlineBudget", 1, pydevInlineBudgetArgs };
+static void pydevInlineBudgetCall(const iocshArgBuf * args)
+{
+    InlineExec::setBudget(1e-6 * args[0].dval);
+}
+
+/**
+ * Parse and compile code of all records before they first process.
+ *
+ * PYDEV_INIT_THREADS sets number of parsing threads, 0 disables precompiling.
+ * PYDEV_CODE_CACHE names directory where compiled code is kept across restarts.
+ */
+static void precompile()
+{
+    const char* dir = getenv("PYDEV_CODE_CACHE");
+    CodeCache::setDirectory(dir != nullptr ? dir : "");
+
+    unsigned threads = Util::getEnvConfig("PYDEV_INIT_THREADS", std::max(1u, std::thread::hardware_concurrency()));
+    auto stats = Precompile::run(threads);
+    if (stats.records > 0) {
+        printf("PyDevice precompiled code of %zu records in %.1f ms, parsing with %u threads %.1f ms, "
+               "%zu unique code cached (%zu loaded from disk), %zu checked, %zu syntax errors\n",
+               stats.records, 1e3 * (stats.parseTime + stats.compileTime), threads, 1e3 * stats.parseTime,
+               stats.cached, stats.loaded, stats.checked, stats.errors);
+    }
+}
+
+/**
+ * Configure records with info tags:
+ * - pydev:profile "<executions> [filename]" starts profiling
+ * - pydev:slow "<ms>" sets slow execution threshold
+ * - pydev:inline "ON|AUTO|OFF" selects inline execution
+ * - pydev:deadband "<value>|<percent>%" skips executions with unchanged inputs
+ * - pydev:group "<group> <key>" makes input record a member of group
+ * - pydev:groupcode "<code>" sets code of the record's group
+ * Code of all records is precompiled afterwards.
+ */
+static void pydevInitHook(initHookState state)
+{
+    if (state != initHookAfterInitDatabase) {
+        return;
+    }
+
+    DBENTRY entry;
+    dbInitEntry(pdbbase, &entry);
+    for (long status = dbFirstRecordType(&entry); status == 0; status = dbNextRecordType(&entry)) {
+        for (status = dbFirstRecord(&entry); status == 0; status = dbNextRecord(&entry)) {
+            if (dbIsAlias(&entry)) {
+                continue;
+            }
+            std::string record = dbGetRecordName(&entry);
+            if (dbFindInfo(&entry, "pydev:slow") == 0) {
+                SlowExec::setThreshold(record, 1e-3 * atof(dbGetInfoString(&entry)));
+            }
+            if (dbFindInfo(&entry, "pydev:inline") == 0) {
+                InlineExec::Mode mode;
+                if (InlineExec::parseMode(dbGetInfoString(&entry), mode)) {
+                    InlineExec::setMode(record, mode);
+                } else {
+                    printf("Invalid pydev:inline info tag of %s, expecting ON, AUTO or OFF\n", record.c_str());
+                }
+            }
+            if (dbFindInfo(&entry, "pydev:deadband") == 0 && !Deadband::set(record, dbGetInfoString(&entry))) {
+                printf("Invalid pydev:deadband info tag of %s, expecting \"<value>\" or \"<percent>%%\"\n", record.c_str());
+            }
+            if (dbFindInfo(&entry, "pydev:group") == 0) {
+                std::string spec = dbGetInfoString(&entry);
+                if (!DevGroup::join(record, spec)) {
+                    printf("Invalid pydev:group info tag of %s, expecting \"<group> <key>\" on pydev input record\n", record.c_str());
+                } else if (dbFindInfo(&entry, "pydev:groupcode") == 0) {
+                    DevGroup::define(spec.substr(0, spec.find(' ')), dbGetInfoString(&entry));
+                }
+            }
+            if (dbFindInfo(&entry, "pydev:profile") != 0) {
+                continue;
+            }
+            const char* info = dbGetInfoString(&entry);
+            char* end;
+            unsigned long executions = strtoul(info, &end, 10);
+            while (*end == ' ') end++;
+            std::string filename = (*end != 0 ? end : record + ".prof");
+            if (executions > 0) {
+                Profiler::start(record, executions, filename);
+            } else {
+                printf("Invalid pydev:profile info tag of %s, expecting \"<executions> [filename]\"\n", record.c_str());
+            }
+        }
+    }
+    dbFinishEntry(&entry);
+
+    precompile();
+}
+
 static void pydevUnregister(void*)
 {
     AsyncExec::shutdown();
@@ -49,7 +294,24 @@ static void pydevRegister(void)
 
         PyWrapper::init();
         AsyncExec::init(numThreads);
+        SlowExec::setThreshold(1e-3 * Util::getEnvConfig("PYDEV_SLOW_THRESHOLD_MS", 0));
+        InlineExec::setBudget(1e-6 * Util::getEnvConfig("PYDEV_INLINE_BUDGET_US", 100));
         iocshRegister(&pydevDef, pydevCall);
+        iocshRegister(&pydevLatencyDef, pydevLatencyCall);
+        iocshRegister(&pydevLatencyEnableDef, pydevLatencyEnableCall);
+        iocshRegister(&pydevGilReportDef, pydevGilReportCall);
+        iocshRegister(&pydevGilSamplerDef, pydevGilSamplerCall);
+        iocshRegister(&pydevReportDef, pydevReportCall);
+        iocshRegister(&pydevTraceEnableDef, pydevTraceEnableCall);
+        iocshRegister(&pydevTraceDumpDef, pydevTraceDumpCall);
+        iocshRegister(&pydevProfileDef, pydevProfileCall);
+        iocshRegister(&pydevSlowThresholdDef, pydevSlowThresholdCall);
+        iocshRegister(&pydevSlowLogDef, pydevSlowLogCall);
+        iocshRegister(&pydevMemTrackDef, pydevMemTrackCall);
+        iocshRegister(&pydevMemReportDef, pydevMemReportCall);
+        iocshRegister(&pydevInlineBudgetDef, pydevInlineBudgetCall);
+        iocshRegister(&pydevGroupDef, pydevGroupCall);
+        initHookRegister(pydevInitHook);
         epicsAtExit(pydevUnregister, 0);
     }
 }
@@ -0,0 +1,196 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include "gilstats.h"
+
+#include <Python.h>
+
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+
+// Probe waiting longer than that means somebody was holding GIL
+static const uint64_t HELD_THRESHOLD_NS = 20000;
+
+struct ThreadSlot {
+    std::string name;
+    std::atomic<uint64_t> acquisitions{0};
+    std::atomic<uint64_t> waitNs{0};
+    std::atomic<uint64_t> maxWaitNs{0};
+    std::atomic<uint64_t> holdNs{0};
+};
+
+static epicsMutex g_mutex;
+static std::vector<std::unique_ptr<ThreadSlot>> g_slots;
+static thread_local ThreadSlot* g_slot = nullptr;
+static std::atomic<int> g_pydevHolders{0};
+static std::atomic<uint64_t> g_samples{0};
+static std::atomic<uint64_t> g_heldByPydev{0};
+static std::atomic<uint64_t> g_heldByOthers{0};
+
+// Only the owning thread modifies its slot, no need for atomic increments
+static inline void add(std::atomic<uint64_t>& counter, uint64_t value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+static ThreadSlot* getSlot()
+{
+    if (g_slot == nullptr) {
+        auto slot = new ThreadSlot;
+        slot->name = epicsThreadGetNameSelf();
+        g_mutex.lock();
+        g_slots.emplace_back(slot);
+        g_mutex.unlock();
+        g_slot = slot;
+    }
+    return g_slot;
+}
+
+class SamplerThread : public epicsThreadRunable {
+    public:
+        epicsThread thread;
+        epicsEvent event;
+        std::atomic<bool> running{true};
+        double period;
+
+        SamplerThread(double period_)
+        : thread(*this, "PyDeviceGilSampler", epicsThreadGetStackSize(epicsThreadStackSmall))
+        , period(period_)
+        {
+            thread.start();
+        }
+
+        ~SamplerThread()
+        {
+            running = false;
+            event.signal();
+            thread.exitWait();
+        }
+
+        void run() override
+        {
+            while (running) {
+                event.wait(period);
+                if (!running) {
+                    break;
+                }
+
+                int pydevHolders = g_pydevHolders;
+                auto t0 = GilStats::now();
+                PyGILState_STATE state = PyGILState_Ensure();
+                auto waited = GilStats::now() - t0;
+                PyGILState_Release(state);
+
+                g_samples++;
+                if (waited > HELD_THRESHOLD_NS) {
+                    if (pydevHolders > 0) {
+                        g_heldByPydev++;
+                    } else {
+                        g_heldByOthers++;
+                    }
+                }
+            }
+        }
+};
+static std::unique_ptr<SamplerThread> g_sampler;
+
+uint64_t GilStats::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t GilStats::acquired(uint64_t requestedAt)
+{
+    auto t = now();
+    auto slot = getSlot();
+    auto waited = t - requestedAt;
+    add(slot->acquisitions, 1);
+    add(slot->waitNs, waited);
+    if (waited > slot->maxWaitNs.load(std::memory_order_relaxed)) {
+        slot->maxWaitNs.store(waited, std::memory_order_relaxed);
+    }
+    g_pydevHolders++;
+    return t;
+}
+
+void GilStats::released(uint64_t acquiredAt)
+{
+    g_pydevHolders--;
+    add(getSlot()->holdNs, now() - acquiredAt);
+}
+
+void GilStats::startSampler(double period)
+{
+    g_sampler.reset();
+    if (period > 0.0) {
+        g_sampler.reset(new SamplerThread(period));
+    }
+}
+
+void GilStats::stopSampler()
+{
+    g_sampler.reset();
+}
+
+GilStats::Report GilStats::get(bool reset)
+{
+    Report report;
+
+    g_mutex.lock();
+    for (auto& slot: g_slots) {
+        ThreadStats stats;
+        stats.name = slot->name;
+        stats.acquisitions = slot->acquisitions;
+        stats.waitNs = slot->waitNs;
+        stats.maxWaitNs = slot->maxWaitNs;
+        stats.holdNs = slot->holdNs;
+        report.threads.push_back(stats);
+        if (reset) {
+            // Racy with the owning thread, may lose an update or two
+            slot->acquisitions = 0;
+            slot->waitNs = 0;
+            slot->maxWaitNs = 0;
+            slot->holdNs = 0;
+        }
+    }
+    g_mutex.unlock();
+
+    report.samples = g_samples;
+    report.heldByPydev = g_heldByPydev;
+    report.heldByOthers = g_heldByOthers;
+    if (reset) {
+        g_samples = 0;
+        g_heldByPydev = 0;
+        g_heldByOthers = 0;
+    }
+    return report;
+}
+
+void GilStats::report(bool reset)
+{
+    auto report = get(reset);
+
+    printf("%-20s %12s %12s %12s %12s %12s\n", "thread", "acquired", "wait[ms]", "avg wait[us]", "max wait[us]", "hold[ms]");
+    for (auto& t: report.threads) {
+        double avgWait = (t.acquisitions > 0 ? 1e-3 * t.waitNs / t.acquisitions : 0.0);
+        printf("%-20s %12llu %12.1f %12.1f %12.1f %12.1f\n", t.name.c_str(), (unsigned long long)t.acquisitions,
+               1e-6 * t.waitNs, avgWait, 1e-3 * t.maxWaitNs, 1e-6 * t.holdNs);
+    }
+
+    if (report.samples == 0) {
+        printf("GIL sampler not running, start it with pydevGilSampler(period)\n");
+    } else {
+        printf("GIL held by PyDevice threads: %.1f%%, by other threads: %.1f%% (%llu samples)\n",
+               100.0 * report.heldByPydev / report.samples,
+               100.0 * report.heldByOthers / report.samples,
+               (unsigned long long)report.samples);
+    }
+}
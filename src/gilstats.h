@@ -0,0 +1,51 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef GILSTATS_H
+#define GILSTATS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Python GIL contention statistics.
+ *
+ * Every PyDevice thread acquiring GIL accounts time spent waiting for GIL
+ * and time holding it. Optional sampler thread periodically probes GIL
+ * to estimate how much of the time GIL is held by threads not belonging
+ * to PyDevice, ie. Python threads started by user code.
+ */
+class GilStats {
+    public:
+        struct ThreadStats {
+            std::string name;
+            uint64_t acquisitions;
+            uint64_t waitNs;
+            uint64_t maxWaitNs;
+            uint64_t holdNs;
+        };
+        struct Report {
+            std::vector<ThreadStats> threads;
+            uint64_t samples;
+            uint64_t heldByPydev;
+            uint64_t heldByOthers;
+        };
+
+        /**
+         * Return timestamp to be passed to acquired() once GIL is taken.
+         */
+        static uint64_t now();
+        static uint64_t acquired(uint64_t requestedAt);
+        static void released(uint64_t acquiredAt);
+
+        static void startSampler(double period);
+        static void stopSampler();
+
+        static Report get(bool reset=false);
+        static void report(bool reset);
+};
+
+#endif // GILSTATS_H
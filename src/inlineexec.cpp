@@ -0,0 +1,105 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include "inlineexec.h"
+
+#include <epicsMutex.h>
+#include <epicsString.h>
+
+#include <cstdio>
+#include <map>
+
+static epicsMutex g_mutex;
+static std::map<std::string, InlineExec*> g_records;
+static std::atomic<uint64_t> g_budget{100000};
+static std::atomic<uint64_t> g_inlined{0};
+static std::atomic<uint64_t> g_fallbacks{0};
+
+void InlineExec::init(const char* record)
+{
+    m_record = record;
+    g_mutex.lock();
+    g_records[record] = this;
+    g_mutex.unlock();
+}
+
+void InlineExec::executed(uint64_t ns, bool inlined)
+{
+    auto budget = g_budget.load(std::memory_order_relaxed);
+    m_mean = (m_samples == 0 ? ns : m_mean - m_mean / 8 + ns / 8);
+    m_samples++;
+
+    if (inlined) {
+        g_inlined.fetch_add(1, std::memory_order_relaxed);
+        if (ns > budget) {
+            m_eligible = false;
+            m_demoted = true;
+            m_mean = ns;
+            m_samples = 1;
+            g_fallbacks.fetch_add(1, std::memory_order_relaxed);
+            printf("Inline execution of %s took %.1f us, over %.1f us budget, switching to asynchronous\n",
+                   m_record, 1e-3 * ns, 1e-3 * budget);
+        }
+    } else if (m_mode != OFF) {
+        // Hysteresis prevents switching back and forth around the budget
+        auto limit = (m_demoted ? budget / 2 : budget);
+        if (m_mode == ON && !m_demoted) {
+            m_eligible = (ns <= limit);
+        } else {
+            m_eligible = (m_samples >= AUTO_SAMPLES && m_mean <= limit);
+        }
+    }
+}
+
+bool InlineExec::setMode(const std::string& record, InlineExec::Mode mode)
+{
+    g_mutex.lock();
+    auto it = g_records.find(record);
+    bool found = (it != g_records.end());
+    if (found) {
+        it->second->m_mode = mode;
+        it->second->m_eligible = false;
+        it->second->m_demoted = false;
+    }
+    g_mutex.unlock();
+    return found;
+}
+
+bool InlineExec::parseMode(const char* str, InlineExec::Mode& mode)
+{
+    if (epicsStrCaseCmp(str, "ON") == 0 || epicsStrCaseCmp(str, "YES") == 0 || epicsStrCaseCmp(str, "1") == 0) {
+        mode = ON;
+    } else if (epicsStrCaseCmp(str, "AUTO") == 0) {
+        mode = AUTO;
+    } else if (epicsStrCaseCmp(str, "OFF") == 0 || epicsStrCaseCmp(str, "NO") == 0 || epicsStrCaseCmp(str, "0") == 0) {
+        mode = OFF;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void InlineExec::setBudget(double seconds)
+{
+    g_budget = (seconds > 0.0 ? seconds * 1e9 : 0);
+}
+
+void InlineExec::report()
+{
+    unsigned on = 0, eligible = 0;
+    g_mutex.lock();
+    for (auto& it: g_records) {
+        if (it.second->m_mode != OFF) {
+            on++;
+            if (it.second->use()) {
+                eligible++;
+            }
+        }
+    }
+    g_mutex.unlock();
+
+    printf("Inline execution: %u records opted in, %u currently inline, %llu executions, %llu fallbacks, budget %.1f us\n",
+           on, eligible, (unsigned long long)g_inlined, (unsigned long long)g_fallbacks, 1e-3 * g_budget);
+}
@@ -0,0 +1,67 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef INLINEEXEC_H
+#define INLINEEXEC_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * Opt-in execution of record code directly in the record processing thread.
+ *
+ * For cheap code, scheduling the task, waking up a worker and processing
+ * the record again costs more than executing the code. Records opt in
+ * with a mode, ON executes inline after the first execution and AUTO once
+ * the mean execution time of several executions is within the time budget.
+ * Executions can't be interrupted, one that exceeds the budget switches
+ * record back to asynchronous execution until the mean time drops well
+ * below the budget again. Record is also processed asynchronously
+ * whenever worker threads are busy, as it would likely wait for GIL.
+ */
+class InlineExec {
+    public:
+        enum Mode {
+            OFF,
+            ON,
+            AUTO,
+        };
+
+        void init(const char* record);
+        /**
+         * Whether to execute code in the calling thread this time.
+         */
+        bool use() const
+        {
+            return (m_mode != OFF && m_eligible.load(std::memory_order_relaxed));
+        }
+        /**
+         * Account for execution time of code, inline or asynchronous.
+         */
+        void executed(uint64_t ns, bool inlined);
+
+        /**
+         * Set mode of a record by name, returns false if record is unknown.
+         */
+        static bool setMode(const std::string& record, Mode mode);
+        /**
+         * Parse mode from string: ON, AUTO or OFF, case insensitive.
+         */
+        static bool parseMode(const char* str, Mode& mode);
+        static void setBudget(double seconds);
+        static void report();
+
+    private:
+        static const unsigned AUTO_SAMPLES = 8;
+        const char* m_record{nullptr};
+        Mode m_mode{OFF};
+        std::atomic<bool> m_eligible{false};
+        uint64_t m_mean{0};     // exponential moving average of execution time
+        unsigned m_samples{0};
+        bool m_demoted{false};
+};
+
+#endif // INLINEEXEC_H
@@ -0,0 +1,231 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include "latency.h"
+
+#include <epicsMutex.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+
+namespace Latency {
+
+static unsigned bucketIndex(uint64_t ns)
+{
+    const uint64_t subBuckets = 1 << Histogram::SUB_BUCKET_BITS;
+    if (ns < subBuckets) {
+        return ns;
+    }
+    unsigned msb = 63 - __builtin_clzll(ns);
+    if (msb >= Histogram::MAX_BITS) {
+        return Histogram::NUM_BUCKETS - 1;
+    }
+    unsigned shift = msb - Histogram::SUB_BUCKET_BITS;
+    return ((shift + 1) << Histogram::SUB_BUCKET_BITS) + ((ns >> shift) & (subBuckets - 1));
+}
+
+static uint64_t bucketValue(unsigned index)
+{
+    const uint64_t subBuckets = 1 << Histogram::SUB_BUCKET_BITS;
+    if (index < subBuckets) {
+        return index;
+    }
+    unsigned shift = (index >> Histogram::SUB_BUCKET_BITS) - 1;
+    uint64_t lower = (subBuckets + (index & (subBuckets - 1))) << shift;
+    // Middle of the bucket
+    return lower + (((uint64_t)1 << shift) >> 1);
+}
+
+void Histogram::record(uint64_t ns, bool exclusive)
+{
+    auto& bucket = m_buckets[bucketIndex(ns)];
+    if (exclusive) {
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        m_sum.store(m_sum.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+        if (ns > m_max.load(std::memory_order_relaxed)) {
+            m_max.store(ns, std::memory_order_relaxed);
+        }
+        return;
+    }
+
+    bucket.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while (ns > max && !m_max.compare_exchange_weak(max, ns, std::memory_order_relaxed));
+}
+
+void Histogram::reset()
+{
+    for (auto& bucket: m_buckets) {
+        bucket = 0;
+    }
+    m_sum = 0;
+    m_max = 0;
+}
+
+uint64_t Histogram::count() const
+{
+    uint64_t total = 0;
+    for (auto& bucket: m_buckets) {
+        total += bucket.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t Histogram::percentile(double p) const
+{
+    uint64_t total = count();
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t threshold = total * p / 100.0;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < NUM_BUCKETS; i++) {
+        seen += m_buckets[i];
+        if (seen > threshold) {
+            return std::min(bucketValue(i), m_max.load());
+        }
+    }
+    return m_max;
+}
+
+#ifdef PYDEV_LATENCY
+
+static const char* stageNames[NUM_STAGES] = {
+    "queue", "prepare", "gil", "compile", "exec", "convert", "complete", "total"
+};
+
+static void printStats(const char* title, const Histogram* stages)
+{
+    printf("%s\n", title);
+    printf("  %-10s %10s %10s %10s %10s %10s\n", "stage", "count", "mean[us]", "p50[us]", "p99[us]", "max[us]");
+    for (int i = 0; i < NUM_STAGES; i++) {
+        auto& h = stages[i];
+        auto count = h.count();
+        double mean = (count > 0 ? 1e-3 * h.sum() / count : 0.0);
+        printf("  %-10s %10llu %10.1f %10.1f %10.1f %10.1f\n", stageNames[i],
+               (unsigned long long)count, mean, 1e-3*h.percentile(50), 1e-3*h.percentile(99), 1e-3*h.max());
+    }
+}
+
+std::atomic<int> g_level{0};
+thread_local Trace* g_current = nullptr;
+static RecordStats g_global;
+static epicsMutex g_mutex;
+static std::map<std::string, Trace*> g_traces;
+
+void Trace::init(const char* name)
+{
+    g_mutex.lock();
+    g_traces[name] = this;
+    g_mutex.unlock();
+}
+
+void Trace::complete()
+{
+    auto level = g_level.load(std::memory_order_relaxed);
+    if (level == 0 || m_points[SCHEDULED] == 0) {
+        return;
+    }
+    m_points[COMPLETED] = now();
+
+    RecordStats* stats = m_stats.load(std::memory_order_acquire);
+    if (stats == nullptr && level > 1) {
+        // Only ever called from record's processing context, no race
+        stats = new RecordStats;
+        m_stats.store(stats, std::memory_order_release);
+    }
+
+    static const Point stageBounds[NUM_STAGES][2] = {
+        { SCHEDULED,    STARTED      }, // QUEUE
+        { STARTED,      EXEC_BEGIN   }, // PREPARE
+        { EXEC_BEGIN,   GIL_ACQUIRED }, // GIL
+        { GIL_ACQUIRED, COMPILED     }, // COMPILE
+        { COMPILED,     EXECUTED     }, // EXEC
+        { EXECUTED,     REQUESTED    }, // CONVERT
+        { REQUESTED,    COMPLETED    }, // COMPLETE
+        { SCHEDULED,    COMPLETED    }, // TOTAL
+    };
+    for (int i = 0; i < NUM_STAGES; i++) {
+        auto begin = m_points[stageBounds[i][0]];
+        auto end = m_points[stageBounds[i][1]];
+        if (begin == 0 || end < begin) {
+            continue;
+        }
+        g_global.stages[i].record(end - begin);
+        if (stats != nullptr) {
+            stats->stages[i].record(end - begin, true);
+        }
+    }
+
+    for (auto& point: m_points) {
+        point = 0;
+    }
+}
+
+void Trace::reset()
+{
+    auto stats = m_stats.load();
+    if (stats != nullptr) {
+        for (auto& h: stats->stages) {
+            h.reset();
+        }
+    }
+}
+
+void setLevel(int level)
+{
+    g_level = level;
+}
+
+void report(const std::string& record, bool reset)
+{
+    if (g_level == 0) {
+        printf("Latency measuring disabled, enable with pydevLatencyEnable(1)\n");
+    }
+    if (record.empty()) {
+        printStats("All records:", g_global.stages);
+        if (reset) {
+            for (auto& h: g_global.stages) {
+                h.reset();
+            }
+        }
+        return;
+    }
+
+    g_mutex.lock();
+    auto it = g_traces.find(record);
+    Trace* trace = (it != g_traces.end() ? it->second : nullptr);
+    g_mutex.unlock();
+
+    if (trace == nullptr) {
+        printf("Record '%s' not found\n", record.c_str());
+    } else if (trace->stats() == nullptr) {
+        printf("No latency data for record '%s', enable with pydevLatencyEnable(2)\n", record.c_str());
+    } else {
+        printStats(("Record " + record + ":").c_str(), trace->stats()->stages);
+        if (reset) {
+            trace->reset();
+        }
+    }
+}
+
+#else
+
+void setLevel(int)
+{
+    printf("PyDevice built without latency instrumentation, rebuild with PYDEV_LATENCY=YES\n");
+}
+
+void report(const std::string&, bool)
+{
+    printf("PyDevice built without latency instrumentation, rebuild with PYDEV_LATENCY=YES\n");
+}
+
+#endif
+
+}; // namespace Latency
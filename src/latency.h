@@ -0,0 +1,171 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/**
+ * Record processing latency instrumentation.
+ *
+ * Each record context keeps a Trace with timestamps of processing stages,
+ * the stage durations are accumulated into global and optionally per-record
+ * histograms when the record completes processing. Everything compiles to
+ * nothing unless PYDEV_LATENCY is defined, and measuring is disabled until
+ * setLevel() enables it.
+ */
+namespace Latency {
+
+enum Point {
+    SCHEDULED,      // processRecord() pushed the task to the queue
+    STARTED,        // worker thread picked up the task
+    EXEC_BEGIN,     // fields substituted, PyWrapper::exec() called
+    GIL_ACQUIRED,   // worker owns GIL
+    COMPILED,       // Python code compiled
+    EXECUTED,       // Python code returned
+    REQUESTED,      // value converted, callbackRequestProcessCallback() called
+    COMPLETED,      // second processRecord() pass finished
+    NUM_POINTS
+};
+
+enum Stage {
+    QUEUE,
+    PREPARE,
+    GIL,
+    COMPILE,
+    EXEC,
+    CONVERT,
+    COMPLETE,
+    TOTAL,
+    NUM_STAGES
+};
+
+/**
+ * Lock-free log-linear histogram of durations in nanoseconds.
+ *
+ * Each power of 2 range is split in 4 linear sub-buckets, which gives
+ * relative error of less than 25% for values up to ~18 minutes.
+ */
+class Histogram {
+    public:
+        static const unsigned SUB_BUCKET_BITS = 2;
+        static const unsigned MAX_BITS = 40;
+        static const unsigned NUM_BUCKETS = (MAX_BITS - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+        /**
+         * Add sample to histogram.
+         *
+         * When exclusive is true the caller guarantees there are no
+         * concurrent writers, which avoids more expensive atomic
+         * read-modify-write operations.
+         */
+        void record(uint64_t ns, bool exclusive=false);
+        void reset();
+        uint64_t count() const;
+        uint64_t sum() const { return m_sum; }
+        uint64_t max() const { return m_max; }
+        uint64_t percentile(double p) const;
+
+    private:
+        std::atomic<uint32_t> m_buckets[NUM_BUCKETS] = {};
+        std::atomic<uint64_t> m_sum{0};
+        std::atomic<uint64_t> m_max{0};
+};
+
+struct RecordStats {
+    Histogram stages[NUM_STAGES];
+};
+
+class Trace {
+    public:
+        void init(const char* name);
+        void mark(Point point);
+        void complete();
+        const RecordStats* stats() const { return m_stats; }
+        void reset();
+#ifdef PYDEV_LATENCY
+    private:
+        uint64_t m_points[NUM_POINTS] = {};
+        std::atomic<RecordStats*> m_stats{nullptr};
+#else
+    private:
+        static constexpr RecordStats* m_stats = nullptr;
+#endif
+};
+
+/**
+ * Makes trace current for the calling thread for the lifetime of the object.
+ *
+ * Allows PyWrapper to mark stages of the record being processed without
+ * passing the trace through the call chain.
+ */
+class Scope {
+    public:
+        explicit Scope(Trace& trace);
+        ~Scope();
+};
+
+/**
+ * Mark point on the trace current to the calling thread, if any.
+ */
+void mark(Point point);
+
+/**
+ * Select what is being measured: 0 - disabled (default), 1 - global
+ * histograms only, 2 - global and per-record histograms.
+ */
+void setLevel(int level);
+void report(const std::string& record, bool reset);
+
+#ifdef PYDEV_LATENCY
+extern std::atomic<int> g_level;
+extern thread_local Trace* g_current;
+
+static inline uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void Trace::mark(Point point)
+{
+    if (g_level.load(std::memory_order_relaxed) > 0) {
+        m_points[point] = now();
+    }
+}
+
+inline Scope::Scope(Trace& trace)
+{
+    trace.mark(STARTED);
+    g_current = &trace;
+}
+
+inline Scope::~Scope()
+{
+    g_current = nullptr;
+}
+
+inline void mark(Point point)
+{
+    if (g_current != nullptr) {
+        g_current->mark(point);
+    }
+}
+#else
+inline void Trace::init(const char*) {}
+inline void Trace::mark(Point) {}
+inline void Trace::complete() {}
+inline void Trace::reset() {}
+inline Scope::Scope(Trace&) {}
+inline Scope::~Scope() {}
+inline void mark(Point) {}
+#endif
+
+}; // namespace Latency
+
+#endif // LATENCY_H
@@ -0,0 +1,219 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include "memstats.h"
+#include "asyncexec.h"
+
+#include <Python.h>
+
+#include <epicsMutex.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <vector>
+
+struct MemEntry {
+    uint64_t executions{0};
+    int64_t net{0};
+    uint64_t churn{0};
+};
+
+std::atomic<bool> MemStats::s_enabled{false};
+static epicsMutex g_mutex;
+static std::map<std::string, MemEntry> g_records;
+static std::map<std::string, std::string> g_params;
+// Only accessed while holding GIL
+static PyObject* g_tracemalloc = nullptr;
+static PyObject* g_getTracedMemory = nullptr;
+static PyObject* g_resetPeak = nullptr;
+static bool g_started = false;
+
+/**
+ * Get current and peak size of traced memory, must hold GIL.
+ */
+static bool sample(long long& current, long long& peak)
+{
+    if (g_getTracedMemory == nullptr) {
+        return false;
+    }
+    PyObject* r = PyObject_CallObject(g_getTracedMemory, nullptr);
+    bool ok = (r != nullptr && PyArg_ParseTuple(r, "LL", &current, &peak));
+    Py_DecRef(r);
+    if (!ok) {
+        PyErr_Clear();
+    }
+    return ok;
+}
+
+static PyObject* callMethod(PyObject* obj, const char* method)
+{
+    return PyObject_CallMethod(obj, const_cast<char*>(method), nullptr);
+}
+
+bool MemStats::enable(bool enabled)
+{
+    bool ok = true;
+    PyGILState_STATE state = PyGILState_Ensure();
+    if (enabled && g_tracemalloc == nullptr) {
+        g_tracemalloc = PyImport_ImportModule("tracemalloc");
+        PyObject* tracing = (g_tracemalloc != nullptr ? callMethod(g_tracemalloc, "is_tracing") : nullptr);
+        if (tracing == nullptr) {
+            printf("Python tracemalloc module not available\n");
+            PyErr_Clear();
+            Py_DecRef(g_tracemalloc);
+            g_tracemalloc = nullptr;
+            ok = false;
+        } else {
+            if (!PyObject_IsTrue(tracing)) {
+                Py_DecRef(callMethod(g_tracemalloc, "start"));
+                g_started = true;
+            }
+            Py_DecRef(tracing);
+            g_getTracedMemory = PyObject_GetAttrString(g_tracemalloc, "get_traced_memory");
+            // Python 3.9+, without it peak covers the whole tracing period
+            g_resetPeak = PyObject_GetAttrString(g_tracemalloc, "reset_peak");
+            PyErr_Clear();
+            s_enabled = (g_getTracedMemory != nullptr);
+            ok = s_enabled;
+        }
+    } else if (!enabled && g_tracemalloc != nullptr) {
+        s_enabled = false;
+        if (g_started) {
+            Py_DecRef(callMethod(g_tracemalloc, "stop"));
+            g_started = false;
+        }
+        Py_DecRef(g_getTracedMemory);
+        Py_DecRef(g_resetPeak);
+        Py_DecRef(g_tracemalloc);
+        g_getTracedMemory = g_resetPeak = g_tracemalloc = nullptr;
+        PyErr_Clear();
+    }
+    PyGILState_Release(state);
+    return ok;
+}
+
+void MemStats::setIoIntr(const char* record, const std::string& param)
+{
+    g_mutex.lock();
+    g_params[record] = param;
+    g_mutex.unlock();
+}
+
+void MemStats::Scope::begin()
+{
+    const char* record = AsyncExec::current();
+    long long current, peak;
+    if (record == nullptr || !sample(current, peak)) {
+        return;
+    }
+    if (g_resetPeak != nullptr) {
+        Py_DecRef(PyObject_CallObject(g_resetPeak, nullptr));
+        PyErr_Clear();
+    }
+    m_start = current;
+    m_record = record;
+}
+
+void MemStats::Scope::end()
+{
+    // Don't clobber error of the measured code
+    PyObject *type, *value, *traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    long long current, peak;
+    bool ok = sample(current, peak);
+    PyErr_Restore(type, value, traceback);
+    if (!ok) {
+        return;
+    }
+
+    g_mutex.lock();
+    auto& entry = g_records[m_record];
+    entry.executions++;
+    entry.net += current - m_start;
+    if (g_resetPeak != nullptr && peak > m_start) {
+        entry.churn += peak - m_start;
+    }
+    g_mutex.unlock();
+}
+
+void MemStats::report(unsigned top, bool reset)
+{
+    if (top == 0) {
+        top = 10;
+    }
+
+    g_mutex.lock();
+    std::vector<std::pair<std::string, MemEntry>> records(g_records.begin(), g_records.end());
+    std::map<std::string, MemEntry> params;
+    for (auto& it: g_records) {
+        auto param = g_params.find(it.first);
+        if (param != g_params.end()) {
+            auto& entry = params[param->second];
+            entry.executions += it.second.executions;
+            entry.net += it.second.net;
+            entry.churn += it.second.churn;
+        }
+    }
+    if (reset) {
+        g_records.clear();
+    }
+    g_mutex.unlock();
+
+    if (!s_enabled) {
+        printf("Memory accounting disabled, enable with pydevMemTrack(1)\n");
+    }
+
+    auto byNet = [](const std::pair<std::string, MemEntry>& a, const std::pair<std::string, MemEntry>& b) {
+        return a.second.net > b.second.net;
+    };
+    auto print = [top](const char* title, const std::vector<std::pair<std::string, MemEntry>>& entries) {
+        printf("  %-40s %12s %14s %12s %14s\n", title, "executions", "net bytes", "net/exec", "peak/exec");
+        for (size_t i = 0; i < entries.size() && i < top; i++) {
+            auto& e = entries[i].second;
+            printf("  %-40s %12llu %14lld %12.1f %14.1f\n", entries[i].first.c_str(),
+                   (unsigned long long)e.executions, (long long)e.net,
+                   (e.executions > 0 ? double(e.net) / e.executions : 0.0),
+                   (e.executions > 0 ? double(e.churn) / e.executions : 0.0));
+        }
+    };
+
+    std::sort(records.begin(), records.end(), byNet);
+    print("record", records);
+    if (!params.empty()) {
+        std::vector<std::pair<std::string, MemEntry>> sorted(params.begin(), params.end());
+        std::sort(sorted.begin(), sorted.end(), byNet);
+        print("I/O Intr parameter", sorted);
+    }
+
+    // Source lines holding most memory right now
+    PyGILState_STATE state = PyGILState_Ensure();
+    if (g_tracemalloc != nullptr) {
+        PyObject* snapshot = callMethod(g_tracemalloc, "take_snapshot");
+        PyObject* stats = nullptr;
+        if (snapshot != nullptr) {
+            stats = PyObject_CallMethod(snapshot, const_cast<char*>("statistics"), const_cast<char*>("s"), "lineno");
+            Py_DecRef(snapshot);
+        }
+        if (stats != nullptr && PyList_Check(stats)) {
+            printf("  Top allocating source lines:\n");
+            for (Py_ssize_t i = 0; i < PyList_Size(stats) && i < top; i++) {
+                PyObject* str = PyObject_Str(PyList_GetItem(stats, i));
+#if PY_MAJOR_VERSION < 3
+                const char* line = (str != nullptr ? PyString_AsString(str) : nullptr);
+#else
+                const char* line = (str != nullptr ? PyUnicode_AsUTF8(str) : nullptr);
+#endif
+                if (line != nullptr) {
+                    printf("    %s\n", line);
+                }
+                Py_DecRef(str);
+            }
+        }
+        Py_DecRef(stats);
+        PyErr_Clear();
+    }
+    PyGILState_Release(state);
+}
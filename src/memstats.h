@@ -0,0 +1,64 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef MEMSTATS_H
+#define MEMSTATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * Opt-in Python memory accounting per record.
+ *
+ * When enabled, tracemalloc is started and traced memory is sampled
+ * before and after every PyWrapper::exec() call made on behalf of a record.
+ * Net change accumulates per record and per I/O Intr parameter, together
+ * with the peak of temporary allocations which drives garbage collection.
+ * Allocations made by other threads while the record released GIL are
+ * attributed to the record, so numbers are approximate.
+ */
+class MemStats {
+    public:
+        static bool enable(bool enabled);
+        /**
+         * Associate record with I/O Intr parameter, for per-parameter totals.
+         */
+        static void setIoIntr(const char* record, const std::string& param);
+        /**
+         * Print top records and parameters by net allocation, and top
+         * source lines currently holding memory.
+         */
+        static void report(unsigned top, bool reset);
+
+        /**
+         * Measures the enclosing scope, must be created while holding GIL.
+         */
+        class Scope {
+            public:
+                Scope()
+                {
+                    if (s_enabled.load(std::memory_order_relaxed)) {
+                        begin();
+                    }
+                }
+                ~Scope()
+                {
+                    if (m_record != nullptr) {
+                        end();
+                    }
+                }
+            private:
+                void begin();
+                void end();
+                const char* m_record{nullptr};
+                int64_t m_start{0};
+        };
+
+    private:
+        static std::atomic<bool> s_enabled;
+};
+
+#endif // MEMSTATS_H
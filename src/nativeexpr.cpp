@@ -0,0 +1,843 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include "nativeexpr.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+// Integers beyond this range are left to Python, converting them to double would lose precision
+static const int64_t MAX_EXACT_INT = (1LL << 53);
+
+enum Op : uint8_t {
+    PUSH_CONST,
+    PUSH_VAR,
+    NEG,
+    POS,
+    NOT,
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    FLOORDIV,
+    MOD,
+    POW,
+    POW_VAR,            // variable base, negative value binds like -x**y after substitution
+    LT,
+    LE,
+    GT,
+    GE,
+    EQ,
+    NE,
+    CMP_OR_JUMP,        // chained comparison, arg is the comparison
+    JUMP,
+    JUMP_IF_FALSE,      // pops condition
+    JUMP_IF_FALSE_OR_POP,
+    JUMP_IF_TRUE_OR_POP,
+    CALL,               // arg is function, target number of arguments
+};
+
+enum Func : uint8_t {
+    ABS,
+    MIN,
+    MAX,
+    FPOW,
+    INT,
+    FLOAT,
+    BOOL,
+};
+
+using Value = NativeExpr::Value;
+using Type = NativeExpr::Value::Type;
+
+static Value makeInt(int64_t i)
+{
+    Value v;
+    v.type = Type::INTEGER;
+    v.i = i;
+    return v;
+}
+
+static Value makeFloat(double f)
+{
+    Value v;
+    v.type = Type::FLOAT;
+    v.f = f;
+    return v;
+}
+
+static Value makeBool(bool b)
+{
+    Value v;
+    v.type = Type::BOOL;
+    v.i = b;
+    return v;
+}
+
+static double toDouble(const Value& v)
+{
+    return (v.type == Type::FLOAT ? v.f : static_cast<double>(v.i));
+}
+
+static bool isTrue(const Value& v)
+{
+    return (v.type == Type::FLOAT ? v.f != 0.0 : v.i != 0);
+}
+
+static bool isExact(int64_t i)
+{
+    return (i <= MAX_EXACT_INT && i >= -MAX_EXACT_INT);
+}
+
+/**
+ * Python float ** float, false where Python raises or returns complex.
+ */
+static bool floatPow(double a, double b, double& out)
+{
+    if (a == 0.0 && b < 0.0) {
+        return false;
+    }
+    if (a < 0.0 && std::isfinite(a) && std::isfinite(b) && b != std::floor(b)) {
+        return false;
+    }
+    out = std::pow(a, b);
+    return !(std::isinf(out) && std::isfinite(a) && std::isfinite(b));
+}
+
+static bool power(const Value& a, const Value& b, Value& out)
+{
+    if (a.type != Type::FLOAT && b.type != Type::FLOAT && b.i >= 0) {
+        int64_t result = 1, base = a.i, exp = b.i;
+        while (exp > 0) {
+            if (exp & 1) {
+                if (base != 0 && std::llabs(result) > MAX_EXACT_INT / std::llabs(base)) {
+                    return false;
+                }
+                result *= base;
+            }
+            exp >>= 1;
+            if (exp > 0) {
+                if (std::llabs(base) > MAX_EXACT_INT / std::max<int64_t>(std::llabs(base), 1)) {
+                    return false;
+                }
+                base *= base;
+            }
+        }
+        out = makeInt(result);
+        return true;
+    }
+    double f;
+    if (!floatPow(toDouble(a), toDouble(b), f)) {
+        return false;
+    }
+    out = makeFloat(f);
+    return true;
+}
+
+static bool arith(Op op, const Value& a, const Value& b, Value& out)
+{
+    if (a.type != Type::FLOAT && b.type != Type::FLOAT) {
+        int64_t x = a.i, y = b.i, r;
+        switch (op) {
+        case ADD: r = x + y; break;
+        case SUB: r = x - y; break;
+        case MUL:
+            if (x != 0 && std::llabs(y) > MAX_EXACT_INT / std::llabs(x)) {
+                return false;
+            }
+            r = x * y;
+            break;
+        case DIV:
+            if (y == 0) {
+                return false;
+            }
+            out = makeFloat(static_cast<double>(x) / static_cast<double>(y));
+            return true;
+        case FLOORDIV:
+            if (y == 0) {
+                return false;
+            }
+            r = x / y;
+            if (x % y != 0 && ((x < 0) != (y < 0))) {
+                r--;
+            }
+            break;
+        case MOD:
+            if (y == 0) {
+                return false;
+            }
+            r = x % y;
+            if (r != 0 && ((r < 0) != (y < 0))) {
+                r += y;
+            }
+            break;
+        default:
+            return false;
+        }
+        if (!isExact(r)) {
+            return false;
+        }
+        out = makeInt(r);
+        return true;
+    }
+
+    double x = toDouble(a), y = toDouble(b);
+    switch (op) {
+    case ADD: out = makeFloat(x + y); return true;
+    case SUB: out = makeFloat(x - y); return true;
+    case MUL: out = makeFloat(x * y); return true;
+    case DIV:
+        if (y == 0.0) {
+            return false;
+        }
+        out = makeFloat(x / y);
+        return true;
+    case FLOORDIV:
+    case MOD: {
+        // Same as Python's float divmod
+        if (y == 0.0) {
+            return false;
+        }
+        double mod = std::fmod(x, y);
+        double div = (x - mod) / y;
+        if (mod != 0.0) {
+            if ((y < 0.0) != (mod < 0.0)) {
+                mod += y;
+                div -= 1.0;
+            }
+        } else {
+            mod = std::copysign(0.0, y);
+        }
+        double floordiv;
+        if (div != 0.0) {
+            floordiv = std::floor(div);
+            if (div - floordiv > 0.5) {
+                floordiv += 1.0;
+            }
+        } else {
+            floordiv = std::copysign(0.0, x / y);
+        }
+        out = makeFloat(op == MOD ? mod : floordiv);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+static bool compare(Op op, const Value& a, const Value& b)
+{
+    if (a.type != Type::FLOAT && b.type != Type::FLOAT) {
+        switch (op) {
+        case LT: return a.i <  b.i;
+        case LE: return a.i <= b.i;
+        case GT: return a.i >  b.i;
+        case GE: return a.i >= b.i;
+        case EQ: return a.i == b.i;
+        default: return a.i != b.i;
+        }
+    }
+    double x = toDouble(a), y = toDouble(b);
+    switch (op) {
+    case LT: return x <  y;
+    case LE: return x <= y;
+    case GT: return x >  y;
+    case GE: return x >= y;
+    case EQ: return x == y;
+    default: return x != y;
+    }
+}
+
+static bool call(Func func, const Value* args, unsigned nargs, Value& out)
+{
+    switch (func) {
+    case ABS:
+        if (args[0].type == Type::FLOAT) {
+            out = makeFloat(std::fabs(args[0].f));
+        } else {
+            out = makeInt(std::llabs(args[0].i));
+        }
+        return true;
+    case MIN:
+    case MAX:
+        // Python returns the first of equal values
+        out = args[0];
+        for (unsigned i = 1; i < nargs; i++) {
+            if (compare(func == MIN ? LT : GT, args[i], out)) {
+                out = args[i];
+            }
+        }
+        return true;
+    case FPOW:
+        return power(args[0], args[1], out);
+    case INT:
+        if (args[0].type == Type::FLOAT) {
+            if (!std::isfinite(args[0].f) || std::fabs(args[0].f) > MAX_EXACT_INT) {
+                return false;
+            }
+            out = makeInt(static_cast<int64_t>(std::trunc(args[0].f)));
+        } else {
+            out = makeInt(args[0].i);
+        }
+        return true;
+    case FLOAT:
+        out = makeFloat(toDouble(args[0]));
+        return true;
+    case BOOL:
+        out = makeBool(isTrue(args[0]));
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Recursive descent parser following Python grammar precedence.
+ *
+ * Each rule returns its own code, jumps are relative so that code
+ * of subexpressions can be appended in any order.
+ */
+class NativeExpr::Parser {
+    public:
+        using Code = std::vector<NativeExpr::Instr>;
+
+        Parser(const char* code, const std::vector<std::string>& variables)
+        : m_pos(code)
+        , m_variables(variables)
+        {
+            next();
+        }
+
+        bool parse(Code& code, uint64_t& used)
+        {
+            if (!expression(code) || m_token != END) {
+                return false;
+            }
+            used = m_used;
+            return true;
+        }
+
+    private:
+        enum Token {
+            END,
+            ERROR,
+            NUMBER,
+            NAME,
+            VARIABLE,
+            OPERATOR,
+        };
+
+        const char* m_pos;
+        const std::vector<std::string>& m_variables;
+        Token m_token{ERROR};
+        std::string m_text;
+        Value m_number;
+        size_t m_variable{0};
+        uint64_t m_used{0};
+
+        bool isOp(const char* op) const
+        {
+            return (m_token == OPERATOR && m_text == op);
+        }
+
+        bool isName(const char* name) const
+        {
+            return (m_token == NAME && m_text == name);
+        }
+
+        bool findVariable(const std::string& name)
+        {
+            for (size_t i = 0; i < m_variables.size() && i < 64; i++) {
+                if (m_variables[i] == name) {
+                    m_variable = i;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void next()
+        {
+            while (*m_pos == ' ' || *m_pos == '\t') {
+                m_pos++;
+            }
+            m_text.clear();
+
+            const char* start = m_pos;
+            if (*m_pos == 0) {
+                m_token = END;
+            } else if (isdigit(*m_pos) || (*m_pos == '.' && isdigit(m_pos[1]))) {
+                bool isFloat = false;
+                while (isdigit(*m_pos)) m_pos++;
+                if (*m_pos == '.') {
+                    isFloat = true;
+                    m_pos++;
+                    while (isdigit(*m_pos)) m_pos++;
+                }
+                if ((*m_pos == 'e' || *m_pos == 'E') &&
+                    (isdigit(m_pos[1]) || ((m_pos[1] == '+' || m_pos[1] == '-') && isdigit(m_pos[2])))) {
+                    isFloat = true;
+                    m_pos += 2;
+                    while (isdigit(*m_pos)) m_pos++;
+                }
+                m_text.assign(start, m_pos);
+                m_token = NUMBER;
+                if (isFloat) {
+                    m_number = makeFloat(strtod(m_text.c_str(), nullptr));
+                } else if (m_text.length() > 16 || (m_text[0] == '0' && m_text.find_first_not_of('0') != std::string::npos)) {
+                    // Too big or leading zeros, which Python doesn't allow
+                    m_token = ERROR;
+                } else {
+                    m_number = makeInt(strtoll(m_text.c_str(), nullptr, 10));
+                    if (!isExact(m_number.i)) {
+                        m_token = ERROR;
+                    }
+                }
+            } else if (isalpha(*m_pos) || *m_pos == '_') {
+                while (isalnum(*m_pos) || *m_pos == '_') m_pos++;
+                m_text.assign(start, m_pos);
+                m_token = (findVariable(m_text) ? VARIABLE : NAME);
+            } else {
+                // %NAME% is substituted same as NAME
+                if (*m_pos == '%') {
+                    const char* end = strchr(m_pos + 1, '%');
+                    if (end != nullptr && findVariable(std::string(m_pos + 1, end))) {
+                        m_pos = end + 1;
+                        m_token = VARIABLE;
+                        return;
+                    }
+                }
+                static const char* ops[] = {
+                    "**", "//", "<=", ">=", "==", "!=",
+                    "+", "-", "*", "/", "%", "<", ">", "(", ")", ",",
+                };
+                m_token = ERROR;
+                for (auto op: ops) {
+                    if (strncmp(m_pos, op, strlen(op)) == 0) {
+                        m_text = op;
+                        m_pos += strlen(op);
+                        m_token = OPERATOR;
+                        break;
+                    }
+                }
+            }
+        }
+
+        static void emit(Code& code, Op op, uint8_t arg=0, uint16_t target=0)
+        {
+            Instr instr;
+            instr.op = op;
+            instr.arg = arg;
+            instr.target = target;
+            instr.value = makeInt(0);
+            code.push_back(instr);
+        }
+
+        static void append(Code& code, const Code& other)
+        {
+            code.insert(code.end(), other.begin(), other.end());
+        }
+
+        // expression := disjunction ['if' disjunction 'else' expression]
+        bool expression(Code& code)
+        {
+            Code value;
+            if (!disjunction(value)) {
+                return false;
+            }
+            if (!isName("if")) {
+                append(code, value);
+                return true;
+            }
+            next();
+            Code cond, other;
+            if (!disjunction(cond) || !isName("else")) {
+                return false;
+            }
+            next();
+            if (!expression(other)) {
+                return false;
+            }
+            append(code, cond);
+            emit(code, JUMP_IF_FALSE, 0, value.size() + 2);
+            append(code, value);
+            emit(code, JUMP, 0, other.size() + 1);
+            append(code, other);
+            return true;
+        }
+
+        // disjunction := conjunction ('or' conjunction)*
+        bool disjunction(Code& code)
+        {
+            if (!conjunction(code)) {
+                return false;
+            }
+            while (isName("or")) {
+                next();
+                Code other;
+                if (!conjunction(other)) {
+                    return false;
+                }
+                emit(code, JUMP_IF_TRUE_OR_POP, 0, other.size() + 1);
+                append(code, other);
+            }
+            return true;
+        }
+
+        // conjunction := inversion ('and' inversion)*
+        bool conjunction(Code& code)
+        {
+            if (!inversion(code)) {
+                return false;
+            }
+            while (isName("and")) {
+                next();
+                Code other;
+                if (!inversion(other)) {
+                    return false;
+                }
+                emit(code, JUMP_IF_FALSE_OR_POP, 0, other.size() + 1);
+                append(code, other);
+            }
+            return true;
+        }
+
+        // inversion := 'not' inversion | comparison
+        bool inversion(Code& code)
+        {
+            if (isName("not")) {
+                next();
+                if (!inversion(code)) {
+                    return false;
+                }
+                emit(code, NOT);
+                return true;
+            }
+            return comparison(code);
+        }
+
+        bool comparisonOp(Op& op)
+        {
+            if      (isOp("<"))  op = LT;
+            else if (isOp("<=")) op = LE;
+            else if (isOp(">"))  op = GT;
+            else if (isOp(">=")) op = GE;
+            else if (isOp("==")) op = EQ;
+            else if (isOp("!=")) op = NE;
+            else return false;
+            next();
+            return true;
+        }
+
+        // comparison := sum (compare_op sum)*
+        bool comparison(Code& code)
+        {
+            if (!sum(code)) {
+                return false;
+            }
+            Op op;
+            std::vector<size_t> jumps;
+            while (comparisonOp(op)) {
+                if (!sum(code)) {
+                    return false;
+                }
+                emit(code, op);
+                // a < b < c is a < b and b < c with b evaluated once
+                if (isOp("<") || isOp("<=") || isOp(">") || isOp(">=") || isOp("==") || isOp("!=")) {
+                    code.back().op = CMP_OR_JUMP;
+                    code.back().arg = op;
+                    jumps.push_back(code.size() - 1);
+                }
+            }
+            for (auto jump: jumps) {
+                code[jump].target = code.size() - jump;
+            }
+            return true;
+        }
+
+        // sum := term (('+'|'-') term)*
+        bool sum(Code& code)
+        {
+            if (!term(code)) {
+                return false;
+            }
+            while (isOp("+") || isOp("-")) {
+                Op op = (isOp("+") ? ADD : SUB);
+                next();
+                if (!term(code)) {
+                    return false;
+                }
+                emit(code, op);
+            }
+            return true;
+        }
+
+        // term := factor (('*'|'/'|'//'|'%') factor)*
+        bool term(Code& code)
+        {
+            if (!factor(code)) {
+                return false;
+            }
+            while (isOp("*") || isOp("/") || isOp("//") || isOp("%")) {
+                Op op = (isOp("*") ? MUL : isOp("/") ? DIV : isOp("//") ? FLOORDIV : MOD);
+                next();
+                if (!factor(code)) {
+                    return false;
+                }
+                emit(code, op);
+            }
+            return true;
+        }
+
+        // factor := ('+'|'-') factor | power
+        bool factor(Code& code)
+        {
+            if (isOp("+") || isOp("-")) {
+                Op op = (isOp("+") ? POS : NEG);
+                next();
+                if (!factor(code)) {
+                    return false;
+                }
+                emit(code, op);
+                return true;
+            }
+            return power(code);
+        }
+
+        // power := primary ['**' factor]
+        bool power(Code& code)
+        {
+            bool variable = (m_token == VARIABLE);
+            if (!primary(code)) {
+                return false;
+            }
+            if (isOp("**")) {
+                next();
+                if (!factor(code)) {
+                    return false;
+                }
+                emit(code, (variable ? POW_VAR : POW));
+            }
+            return true;
+        }
+
+        // primary := NUMBER | VARIABLE | True | False | '(' expression ')' | function '(' args ')'
+        bool primary(Code& code)
+        {
+            if (m_token == NUMBER) {
+                emit(code, PUSH_CONST);
+                code.back().value = m_number;
+                next();
+                return true;
+            }
+            if (m_token == VARIABLE) {
+                emit(code, PUSH_VAR, m_variable);
+                m_used |= (1ULL << m_variable);
+                next();
+                return true;
+            }
+            if (isOp("(")) {
+                next();
+                if (!expression(code) || !isOp(")")) {
+                    return false;
+                }
+                next();
+                return true;
+            }
+            if (isName("True") || isName("False")) {
+                emit(code, PUSH_CONST);
+                code.back().value = makeBool(isName("True"));
+                next();
+                return true;
+            }
+
+            static const struct {
+                const char* name;
+                Func func;
+                unsigned minArgs;
+                unsigned maxArgs;
+            } funcs[] = {
+                { "abs",   ABS,   1, 1 },
+                { "min",   MIN,   2, MAX_STACK / 2 },
+                { "max",   MAX,   2, MAX_STACK / 2 },
+                { "pow",   FPOW,  2, 2 },
+                { "int",   INT,   1, 1 },
+                { "float", FLOAT, 1, 1 },
+                { "bool",  BOOL,  1, 1 },
+            };
+            for (auto& f: funcs) {
+                if (!isName(f.name)) {
+                    continue;
+                }
+                next();
+                if (!isOp("(")) {
+                    return false;
+                }
+                next();
+                unsigned nargs = 0;
+                while (!isOp(")")) {
+                    if (nargs > 0) {
+                        if (!isOp(",")) {
+                            return false;
+                        }
+                        next();
+                    }
+                    if (!expression(code)) {
+                        return false;
+                    }
+                    nargs++;
+                }
+                next();
+                if (nargs < f.minArgs || nargs > f.maxArgs) {
+                    return false;
+                }
+                emit(code, CALL, f.func, nargs);
+                return true;
+            }
+            return false;
+        }
+};
+
+bool NativeExpr::compile(const char* code, const std::vector<std::string>& variables)
+{
+    if (m_parsed && m_code.compare(code) == 0) {
+        return compiled();
+    }
+    m_parsed = true;
+    m_code = code;
+    m_program.clear();
+    m_variables = 0;
+
+    // References to other records are substituted differently, %B%C% is not %B% followed by C%
+    if (!Util::getReferences(code).empty()) {
+        return false;
+    }
+
+    Parser parser(code, variables);
+    if (!parser.parse(m_program, m_variables)) {
+        m_program.clear();
+        m_variables = 0;
+    }
+    return compiled();
+}
+
+bool NativeExpr::eval(const Value* variables, Value& result) const
+{
+    Value stack[MAX_STACK];
+    unsigned sp = 0;
+
+    for (size_t pc = 0; pc < m_program.size(); pc++) {
+        auto& instr = m_program[pc];
+        switch (instr.op) {
+        case PUSH_CONST:
+        case PUSH_VAR:
+            if (sp == MAX_STACK) {
+                return false;
+            }
+            stack[sp++] = (instr.op == PUSH_CONST ? instr.value : variables[instr.arg]);
+            break;
+        case NEG:
+            if (stack[sp-1].type == Type::FLOAT) {
+                stack[sp-1].f = -stack[sp-1].f;
+            } else {
+                stack[sp-1] = makeInt(-stack[sp-1].i);
+            }
+            break;
+        case POS:
+            if (stack[sp-1].type == Type::BOOL) {
+                stack[sp-1].type = Type::INTEGER;
+            }
+            break;
+        case NOT:
+            stack[sp-1] = makeBool(!isTrue(stack[sp-1]));
+            break;
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case FLOORDIV:
+        case MOD:
+            sp--;
+            if (!arith(static_cast<Op>(instr.op), stack[sp-1], stack[sp], stack[sp-1])) {
+                return false;
+            }
+            break;
+        case POW:
+            sp--;
+            if (!power(stack[sp-1], stack[sp], stack[sp-1])) {
+                return false;
+            }
+            break;
+        case POW_VAR: {
+            sp--;
+            auto& base = stack[sp-1];
+            bool negative = (base.type == Type::FLOAT ? std::signbit(base.f) : base.i < 0);
+            if (negative) {
+                base = (base.type == Type::FLOAT ? makeFloat(-base.f) : makeInt(-base.i));
+            }
+            if (!power(base, stack[sp], base)) {
+                return false;
+            }
+            if (negative) {
+                base = (base.type == Type::FLOAT ? makeFloat(-base.f) : makeInt(-base.i));
+            }
+            break;
+        }
+        case LT:
+        case LE:
+        case GT:
+        case GE:
+        case EQ:
+        case NE:
+            sp--;
+            stack[sp-1] = makeBool(compare(static_cast<Op>(instr.op), stack[sp-1], stack[sp]));
+            break;
+        case CMP_OR_JUMP:
+            sp--;
+            if (!compare(static_cast<Op>(instr.arg), stack[sp-1], stack[sp])) {
+                stack[sp-1] = makeBool(false);
+                pc += instr.target - 1;
+            } else {
+                stack[sp-1] = stack[sp];
+            }
+            break;
+        case JUMP:
+            pc += instr.target - 1;
+            break;
+        case JUMP_IF_FALSE:
+            sp--;
+            if (!isTrue(stack[sp])) {
+                pc += instr.target - 1;
+            }
+            break;
+        case JUMP_IF_FALSE_OR_POP:
+        case JUMP_IF_TRUE_OR_POP:
+            if (isTrue(stack[sp-1]) == (instr.op == JUMP_IF_TRUE_OR_POP)) {
+                pc += instr.target - 1;
+            } else {
+                sp--;
+            }
+            break;
+        case CALL:
+            sp -= instr.target;
+            if (!call(static_cast<Func>(instr.arg), &stack[sp], instr.target, stack[sp])) {
+                return false;
+            }
+            sp++;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    if (sp != 1) {
+        return false;
+    }
+    result = stack[0];
+    return true;
+}
@@ -0,0 +1,74 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef NATIVEEXPR_H
+#define NATIVEEXPR_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Evaluator for simple arithmetic expressions that don't need Python.
+ *
+ * Expressions are compiled into a small stack based program when they only
+ * use numbers, variables, arithmetic and comparison operators, and/or/not,
+ * conditional expressions and abs/min/max/pow/int/float/bool builtins.
+ * Anything else is left to Python. Evaluation follows Python semantics,
+ * including int and float types of the result. Whenever Python would raise
+ * an exception, or integer result would exceed the range where double is
+ * exact, eval() fails and caller should execute the same code in Python,
+ * which yields the same result or error message as without this evaluator.
+ *
+ * Variables are substituted into the code as text before it gets to Python,
+ * which evaluator emulates, ie. -3**2 is -9 when variable in A**2 is -3.
+ */
+class NativeExpr {
+    public:
+        struct Value {
+            enum class Type {
+                BOOL,
+                INTEGER,
+                FLOAT,
+            } type;
+            union {
+                int64_t i;  // also BOOL
+                double f;
+            };
+        };
+
+        /**
+         * Compile expression when it changed, returns whether it is supported.
+         *
+         * Variable names can also be surrounded by % signs in expression.
+         */
+        bool compile(const char* code, const std::vector<std::string>& variables);
+        bool compiled() const { return !m_program.empty(); }
+        /**
+         * Whether compiled expression references variable with given index.
+         */
+        bool uses(size_t variable) const { return (m_variables & (1ULL << variable)) != 0; }
+        /**
+         * Evaluate compiled expression, returns false when Python is needed.
+         */
+        bool eval(const Value* variables, Value& result) const;
+
+    private:
+        struct Instr {
+            uint8_t op;
+            uint8_t arg;
+            uint16_t target;
+            Value value;
+        };
+        class Parser;
+
+        static const unsigned MAX_STACK = 32;
+        std::string m_code;
+        bool m_parsed{false};
+        std::vector<Instr> m_program;
+        uint64_t m_variables{0};
+};
+
+#endif // NATIVEEXPR_H
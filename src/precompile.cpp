@@ -0,0 +1,198 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include "precompile.h"
+#include "codecache.h"
+#include "pywrapper.h"
+
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+struct Entry {
+    const char* record;
+    Util::Template* code;
+    const char* text;
+    std::string rendered;   // code as compiled
+    bool constant;          // no fields, rendered code is what gets executed
+};
+
+static epicsMutex g_mutex;
+static std::vector<Entry> g_entries;
+
+/**
+ * Work on items picked from the shared index, until all are done.
+ */
+struct Job {
+    std::function<void(size_t)>& work;
+    size_t count;
+    std::atomic<size_t>& next;
+    epicsEvent done;
+
+    Job(std::function<void(size_t)>& work_, size_t count_, std::atomic<size_t>& next_)
+    : work(work_)
+    , count(count_)
+    , next(next_)
+    {}
+
+    void run()
+    {
+        for (size_t i = next++; i < count; i = next++) {
+            work(i);
+        }
+        done.signal();
+    }
+
+    static void thread(void* arg)
+    {
+        reinterpret_cast<Job*>(arg)->run();
+    }
+};
+
+/**
+ * Call work for every index from 0 to count, calling thread works as well.
+ */
+static void parallel(unsigned threads, size_t count, std::function<void(size_t)> work)
+{
+    std::atomic<size_t> next{0};
+    std::vector<std::unique_ptr<Job>> jobs;
+    for (unsigned i = 1; i < threads && i < count; i++) {
+        jobs.emplace_back(new Job(work, count, next));
+        std::string name = "PyDevInit_" + std::to_string(i);
+        epicsThreadCreate(name.c_str(), epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackMedium),
+                          Job::thread, jobs.back().get());
+    }
+    Job self(work, count, next);
+    self.run();
+    for (auto& job: jobs) {
+        job->done.wait();
+    }
+}
+
+/**
+ * References render unchanged unless resolved, placeholder keeps the
+ * syntax of substituted value. Field names are valid identifiers.
+ */
+static void parse(Entry& entry)
+{
+    auto& fields = entry.code->fields(entry.text);
+    entry.constant = fields.empty();
+    std::vector<std::string> defaults;
+    for (auto& field: fields) {
+        defaults.push_back(field.second);
+        if (field.first.find_first_of(":.") != std::string::npos) {
+            field.second = "0";
+        }
+    }
+    entry.rendered = entry.code->render();
+    for (size_t i = 0; i < fields.size(); i++) {
+        fields[i].second = defaults[i];
+    }
+}
+
+/**
+ * Compile code that is executed as is, using CodeCache when enabled.
+ *
+ * Files are read and written by several threads, Python only unmarshals
+ * code found and compiles the rest.
+ */
+static std::vector<std::string> compileCached(const std::vector<std::string>& lines, unsigned threads, size_t& loaded)
+{
+    if (!CodeCache::enabled()) {
+        loaded = 0;
+        return PyWrapper::compile(lines, true);
+    }
+
+    long magic = PyWrapper::magic();
+    std::vector<std::string> data(lines.size());
+    parallel(threads, lines.size(), [&](size_t i) {
+        CodeCache::load(lines[i], magic, data[i]);
+    });
+    loaded = PyWrapper::loadCompiled(lines, data);
+    auto errors = PyWrapper::compile(lines, true);
+
+    std::vector<std::string> compiled;
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (data[i].empty() && errors[i].empty()) {
+            compiled.push_back(lines[i]);
+        }
+    }
+    data = PyWrapper::dumpCompiled(compiled);
+    parallel(threads, compiled.size(), [&](size_t i) {
+        if (!data[i].empty()) {
+            CodeCache::store(compiled[i], magic, data[i]);
+        }
+    });
+    return errors;
+}
+
+void Precompile::add(const char* record, Util::Template* code, const char* text)
+{
+    g_mutex.lock();
+    g_entries.push_back(Entry{record, code, text, std::string(), false});
+    g_mutex.unlock();
+}
+
+Precompile::Stats Precompile::run(unsigned threads)
+{
+    std::vector<Entry> entries;
+    g_mutex.lock();
+    entries.swap(g_entries);
+    g_mutex.unlock();
+
+    Stats stats{0, 0, 0, 0, 0, 0.0, 0.0};
+    if (threads == 0) {
+        return stats;
+    }
+    stats.records = entries.size();
+    auto t0 = std::chrono::steady_clock::now();
+
+    parallel(threads, entries.size(), [&](size_t i) {
+        parse(entries[i]);
+    });
+    auto t1 = std::chrono::steady_clock::now();
+
+    // Records generated from the same template often have identical code
+    std::vector<std::string> lines[2];
+    std::vector<std::vector<size_t>> users[2];
+    std::unordered_map<std::string, size_t> unique[2];
+    for (size_t i = 0; i < entries.size(); i++) {
+        int kind = (entries[i].constant ? 0 : 1);
+        auto it = unique[kind].emplace(entries[i].rendered, lines[kind].size());
+        if (it.second) {
+            lines[kind].push_back(entries[i].rendered);
+            users[kind].emplace_back();
+        }
+        users[kind][it.first->second].push_back(i);
+    }
+    stats.cached = lines[0].size();
+    stats.checked = lines[1].size();
+
+    for (int kind = 0; kind < 2; kind++) {
+        auto errors = (kind == 0 ? compileCached(lines[kind], threads, stats.loaded) : PyWrapper::compile(lines[kind], false));
+        for (size_t i = 0; i < errors.size(); i++) {
+            if (errors[i].empty()) {
+                continue;
+            }
+            for (auto entry: users[kind][i]) {
+                printf("Syntax error in %s: %s\n    %s\n", entries[entry].record, errors[i].c_str(), entries[entry].text);
+                stats.errors++;
+            }
+        }
+    }
+    auto t2 = std::chrono::steady_clock::now();
+
+    stats.parseTime = std::chrono::duration<double>(t1 - t0).count();
+    stats.compileTime = std::chrono::duration<double>(t2 - t1).count();
+    return stats;
+}
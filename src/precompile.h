@@ -0,0 +1,49 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef PRECOMPILE_H
+#define PRECOMPILE_H
+
+#include "util.h"
+
+#include <cstddef>
+
+/**
+ * Parse and compile code of all records during IOC initialization.
+ *
+ * Records register their code template when initialized. Templates are
+ * parsed by several threads at once, which is pure C++, then Python
+ * compiles the code under single GIL acquisition. Code without fields
+ * is the same for every execution, its compiled code is kept for
+ * PyWrapper::exec(). Code with fields is compiled with placeholder values
+ * only to check the syntax, reporting errors with record names at boot
+ * rather than at first processing.
+ */
+class Precompile {
+    public:
+        struct Stats {
+            size_t records;
+            size_t cached;      // unique code without fields, compiled for exec()
+            size_t loaded;      // cached code loaded from CodeCache instead of compiling
+            size_t checked;     // unique code with fields, compiled for syntax check
+            size_t errors;
+            double parseTime;
+            double compileTime;
+        };
+
+        /**
+         * Register record code, template and text must remain valid until run().
+         */
+        static void add(const char* record, Util::Template* code, const char* text);
+        /**
+         * Precompile all registered code and forget it, syntax errors are printed.
+         *
+         * Threads also read and write CodeCache files when enabled. No
+         * threads only forgets the code, it will be compiled when executed.
+         */
+        static Stats run(unsigned threads);
+};
+
+#endif // PRECOMPILE_H
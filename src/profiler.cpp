@@ -0,0 +1,189 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include "profiler.h"
+#include "asyncexec.h"
+
+#include <Python.h>
+
+#include <epicsMutex.h>
+
+#include <cstdio>
+#include <map>
+
+struct Profiler::Session {
+    std::string record;
+    std::string filename;
+    unsigned remaining;
+    unsigned executions{0};
+    unsigned skipped{0};
+    PyObject* profile{nullptr};
+    // Being executed, only the thread that set the flag may modify session
+    bool busy{false};
+};
+
+std::atomic<unsigned> Profiler::s_active{0};
+static epicsMutex g_mutex;
+static std::map<std::string, Profiler::Session> g_sessions;
+
+static PyObject* callMethod(PyObject* obj, const char* method)
+{
+    return PyObject_CallMethod(obj, const_cast<char*>(method), nullptr);
+}
+
+/**
+ * Write collected statistics and remove session, must hold GIL.
+ */
+void Profiler::finish(Session* session)
+{
+    if (session->profile != nullptr && session->executions > 0) {
+        PyObject* r = PyObject_CallMethod(session->profile, const_cast<char*>("dump_stats"), const_cast<char*>("s"), session->filename.c_str());
+        if (r != nullptr) {
+            printf("Profiled %u executions of %s, statistics written to '%s'\n",
+                   session->executions, session->record.c_str(), session->filename.c_str());
+            if (session->skipped > 0) {
+                printf("%u executions skipped, another profiler was active\n", session->skipped);
+            }
+        } else {
+            printf("Failed to write profile of %s to '%s'\n", session->record.c_str(), session->filename.c_str());
+            PyErr_Print();
+        }
+        Py_DecRef(r);
+    }
+    Py_DecRef(session->profile);
+
+    g_mutex.lock();
+    g_sessions.erase(session->record);
+    s_active = g_sessions.size();
+    g_mutex.unlock();
+}
+
+bool Profiler::start(const std::string& record, unsigned executions, const std::string& filename)
+{
+    if (executions == 0) {
+        return false;
+    }
+
+    g_mutex.lock();
+    auto it = g_sessions.find(record);
+    if (it != g_sessions.end()) {
+        g_mutex.unlock();
+        printf("Record %s is already being profiled\n", record.c_str());
+        return false;
+    }
+    auto& session = g_sessions[record];
+    session.record = record;
+    session.filename = filename;
+    session.remaining = executions;
+    s_active = g_sessions.size();
+    g_mutex.unlock();
+    return true;
+}
+
+bool Profiler::stop(const std::string& record)
+{
+    // Lock ordering GIL before mutex, same as Scope
+    PyGILState_STATE state = PyGILState_Ensure();
+    Session* session = nullptr;
+    bool found = false;
+
+    g_mutex.lock();
+    auto it = g_sessions.find(record);
+    if (it != g_sessions.end()) {
+        found = true;
+        if (it->second.busy) {
+            // Let executing thread finish the session
+            it->second.remaining = 1;
+        } else {
+            session = &it->second;
+            session->busy = true;
+        }
+    }
+    g_mutex.unlock();
+
+    if (session != nullptr) {
+        finish(session);
+    }
+    PyGILState_Release(state);
+
+    if (!found) {
+        printf("Record %s is not being profiled\n", record.c_str());
+    }
+    return found;
+}
+
+void Profiler::Scope::begin()
+{
+    const char* record = AsyncExec::current();
+    if (record == nullptr) {
+        return;
+    }
+
+    Session* session = nullptr;
+    g_mutex.lock();
+    auto it = g_sessions.find(record);
+    if (it != g_sessions.end() && !it->second.busy) {
+        session = &it->second;
+        session->busy = true;
+    }
+    g_mutex.unlock();
+    if (session == nullptr) {
+        return;
+    }
+
+    if (session->profile == nullptr) {
+        PyObject* mod = PyImport_ImportModule("cProfile");
+        if (mod != nullptr) {
+            session->profile = callMethod(mod, "Profile");
+            Py_DecRef(mod);
+        }
+        if (session->profile == nullptr) {
+            printf("Failed to start profiling record %s\n", record);
+            PyErr_Print();
+            finish(session);
+            return;
+        }
+    }
+
+    PyObject* r = callMethod(session->profile, "enable");
+    if (r == nullptr) {
+        // Python 3.12+ allows only one active profiler at a time
+        PyErr_Clear();
+        g_mutex.lock();
+        session->skipped++;
+        session->busy = false;
+        g_mutex.unlock();
+        return;
+    }
+    Py_DecRef(r);
+    m_session = session;
+}
+
+void Profiler::Scope::end()
+{
+    auto session = m_session;
+
+    // Don't clobber error of the profiled code
+    PyObject *type, *value, *traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    PyObject* r = callMethod(session->profile, "disable");
+    if (r == nullptr) {
+        PyErr_Clear();
+    }
+    Py_DecRef(r);
+    PyErr_Restore(type, value, traceback);
+
+    session->executions++;
+    g_mutex.lock();
+    bool done = (--session->remaining == 0);
+    if (!done) {
+        session->busy = false;
+    }
+    g_mutex.unlock();
+
+    if (done) {
+        finish(session);
+    }
+}
@@ -0,0 +1,63 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <string>
+
+/**
+ * On-demand cProfile sessions for individual records.
+ *
+ * A session profiles Python code executed on behalf of a single record
+ * for a given number of executions, and writes aggregated statistics in
+ * pstats format to a file when done. Records are identified by the name
+ * of the task being executed in AsyncExec worker thread. While there's
+ * no session, checking for one costs one relaxed atomic load.
+ */
+class Profiler {
+    public:
+        /**
+         * Start profiling record for next number of executions.
+         */
+        static bool start(const std::string& record, unsigned executions, const std::string& filename);
+        /**
+         * Stop profiling record, statistics collected so far are written to file.
+         */
+        static bool stop(const std::string& record);
+
+        struct Session;
+
+        /**
+         * Profiles the enclosing scope when calling thread executes
+         * a record being profiled. Must be created while holding GIL.
+         */
+        class Scope {
+            public:
+                Scope()
+                {
+                    if (s_active.load(std::memory_order_relaxed) > 0) {
+                        begin();
+                    }
+                }
+                ~Scope()
+                {
+                    if (m_session != nullptr) {
+                        end();
+                    }
+                }
+            private:
+                void begin();
+                void end();
+                Session* m_session{nullptr};
+        };
+
+    private:
+        static void finish(Session* session);
+        static std::atomic<unsigned> s_active;
+};
+
+#endif // PROFILER_H
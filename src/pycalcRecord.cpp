@@ -18,14 +18,24 @@
 #include "devSup.h"
 #include "epicsVersion.h"
 #include "errlog.h"
+#include "menuYesNo.h"
 #include "recSup.h"
 #include "recGbl.h"
 
 #include <string>
+#include <cmath>
+#include <functional>
+#include <cstdlib>
 #include <cstring>
 
 #include "asyncexec.h"
+#include "deadband.h"
+#include "devstats.h"
+#include "latency.h"
+#include "nativeexpr.h"
+#include "precompile.h"
 #include "pywrapper.h"
+#include "recfields.h"
 #include "util.h"
 
 #define GEN_SIZE_OFFSET
@@ -46,16 +56,52 @@
 #  define RECSUPFUN_CAST (RECSUPFUN)
 #endif
 
+#ifdef HAVE_EPICS_INT64
+#  include "dbCa.h"
+#  include "dbLink.h"
+#  define HAVE_LINK_UPDATES
+#endif
+
 static long initRecord(dbCommon *, int);
 static long processRecord(dbCommon *);
 //static long updateRecordField(DBADDR *addr, int after);
 static long convertDbAddr(DBADDR *addr);
 static long getArrayInfo(DBADDR *paddr, long *no_elements, long *offset);
+static long putArrayInfo(DBADDR *paddr, long nNew);
 static long fetchValues(pycalcRecord *rec);
+static std::string convertArg(pycalcRecord* rec, int arg);
+static bool evalNative(pycalcRecord *rec);
+
+/**
+ * Input A-J as last fetched from its link and converted to Python text.
+ *
+ * Value is a copy of the field when it was last fetched or converted,
+ * field written directly or fetched with a different value invalidates
+ * the text.
+ */
+struct PyCalcInput {
+    unsigned long updates;  // CA link monitor updates when fetched
+    bool fetched;           // link updates are valid
+    bool converted;         // text matches value
+    std::vector<char> value;
+    std::string text;
+};
 
 struct PyCalcRecordContext {
     CALLBACK callback;
     int processCbStatus;
+    Latency::Trace trace;
+    DevStats stats;
+    Util::Template code;
+    RecordFields fields;
+    NativeExpr native;
+    Deadband deadband;
+    PyCalcInput inputs[PYCALCREC_NARGS];
+    std::vector<std::string> outputKeys; // dict keys of VALA.. outputs, empty when only VAL
+    unsigned outputsStored; // bit per output stored by the last execution
+    bool prepared;          // fields read in processRecord()
+    bool resultValid;       // VAL is the result of code with inputsHash
+    size_t inputsHash;
 };
 
 rset pycalcRSET = {
@@ -69,7 +115,7 @@ rset pycalcRSET = {
     .get_value = NULL,
     .cvt_dbaddr = RECSUPFUN_CAST convertDbAddr,
     .get_array_info = RECSUPFUN_CAST getArrayInfo,
-    .put_array_info = NULL,
+    .put_array_info = RECSUPFUN_CAST putArrayInfo,
     .get_units = NULL,
     .get_precision = NULL,
     .get_enum_str = NULL,
@@ -81,6 +127,17 @@ rset pycalcRSET = {
 };
 epicsExportAddress(rset, pycalcRSET);
 
+static const std::vector<std::string> argNames = {
+    "A", "B", "C", "D", "E", "F", "G", "H", "I", "J",
+};
+
+/**
+ * Dict keys of outputs VALA..VALJ, lowercase so that code substitution of A..J leaves them alone.
+ */
+static const std::vector<std::string> outputNames = {
+    "a", "b", "c", "d", "e", "f", "g", "h", "i", "j",
+};
+
 static long initRecord(dbCommon *common, int pass)
 {
     auto rec = reinterpret_cast<struct pycalcRecord *>(common);
@@ -89,6 +146,10 @@ static long initRecord(dbCommon *common, int pass)
         // Allocate record context
         auto buffer = callocMustSucceed(1, sizeof(struct PyCalcRecordContext), "pycalcRecord::initRecord");
         rec->ctx = new (buffer) PyCalcRecordContext;
+        rec->ctx->trace.init(rec->name);
+        rec->ctx->stats.init(rec->name, "pycalc");
+        rec->ctx->deadband.init(rec->name);
+        Precompile::add(rec->name, &rec->ctx->code, rec->calc);
 
         // Allocate value fields
         for (int i = 0; i < PYCALCREC_NARGS; i++) {
@@ -116,6 +177,29 @@ static long initRecord(dbCommon *common, int pass)
         }
         rec->val = callocMustSucceed(rec->mevl, dbValueSize(rec->ftvl), "pycalcRecord::initRecord");
         reinterpret_cast<char*>(rec->val)[0] = 0;
+
+        // Allocate output fields, enough of them to cover all output links
+        for (int i = 0; i < PYCALCREC_NOUTS; i++) {
+            auto out = &rec->outa + i;
+            auto ft  = &rec->ftva + i;
+            auto val = &rec->vala + i;
+            auto me  = &rec->meva + i;
+
+            if (*ft > DBF_ENUM) {
+                *ft = DBF_CHAR;
+            }
+            if (*me < 1) {
+                *me = 1;
+            }
+            *val = callocMustSucceed(*me, dbValueSize(*ft), "pycalcRecord::initRecord");
+            if (!dbLinkIsConstant(out) && rec->nout <= i) {
+                rec->nout = i + 1;
+            }
+        }
+        if (rec->nout > PYCALCREC_NOUTS) {
+            rec->nout = PYCALCREC_NOUTS;
+        }
+        rec->ctx->outputKeys.assign(outputNames.begin(), outputNames.begin() + rec->nout);
         return 0;
     }
 
@@ -131,137 +215,392 @@ static long initRecord(dbCommon *common, int pass)
         }
     }
 
+    // Detect simple arithmetic expressions early, recompiled only when CALC changes
+    rec->ctx->native.compile(rec->calc, argNames);
+
     return 0;
 }
 
-static void processRecordCb(pycalcRecord* rec)
+/**
+ * Compare input field with the copy of its value, optionally update the copy.
+ */
+static bool inputMatches(pycalcRecord* rec, int arg, bool update)
+{
+    auto& input = rec->ctx->inputs[arg];
+    auto val = reinterpret_cast<const char*>(*(&rec->a + arg));
+    size_t size = *(&rec->nea + arg) * *(&rec->siza + arg);
+
+    bool matches = (input.value.size() == size && memcmp(input.value.data(), val, size) == 0);
+    if (!matches && update) {
+        input.value.assign(val, val + size);
+    }
+    return matches;
+}
+
+/**
+ * Python text of input, converted again only when value changed.
+ *
+ * Converting large arrays takes much longer than comparing them.
+ */
+static std::string argToString(const DBADDR& addr)
+{
+    auto rec = reinterpret_cast<pycalcRecord*>(addr.precord);
+    int arg = dbGetFieldIndex(&addr) - pycalcRecordA;
+    auto& input = rec->ctx->inputs[arg];
+    if (!inputMatches(rec, arg, true) || !input.converted) {
+        input.text = convertArg(rec, arg);
+        input.converted = true;
+    }
+    return input.text;
+}
+
+static std::string convertArg(pycalcRecord* rec, int arg)
 {
-    auto fields = Util::getFields(rec->calc);
-    for (auto& keyval: fields) {
-        if      (keyval.first == "NAME") keyval.second = rec->name;
-        else if (keyval.first == "TPRO") keyval.second = Util::to_string(rec->tpro);
-        else {
-            for (auto i = 0; i < PYCALCREC_NARGS; i++) {
-                std::string field = std::string(1,'A'+i);
-                if (keyval.first == field) {
-                    auto val = &rec->a   + i;
-                    auto ft  = &rec->fta + i;
-                    auto me  = &rec->mea + i;
-                    auto ne  = &rec->nea + i;
-
-                    if (*me == 1) {
-                        if      (*ft == DBR_CHAR)   keyval.second = Util::to_string(*reinterpret_cast<   epicsInt8*>(*val));
-                        else if (*ft == DBR_UCHAR)  keyval.second = Util::to_string(*reinterpret_cast<  epicsUInt8*>(*val));
-                        else if (*ft == DBR_SHORT)  keyval.second = Util::to_string(*reinterpret_cast<  epicsInt16*>(*val));
-                        else if (*ft == DBR_USHORT) keyval.second = Util::to_string(*reinterpret_cast< epicsUInt16*>(*val));
-                        else if (*ft == DBR_LONG)   keyval.second = Util::to_string(*reinterpret_cast<  epicsInt32*>(*val));
-                        else if (*ft == DBR_ULONG)  keyval.second = Util::to_string(*reinterpret_cast< epicsUInt32*>(*val));
+    auto val = &rec->a   + arg;
+    auto ft  = &rec->fta + arg;
+    auto me  = &rec->mea + arg;
+    auto ne  = &rec->nea + arg;
+
+    if (*me == 1) {
+        if      (*ft == DBR_CHAR)   return Util::to_string(*reinterpret_cast<   epicsInt8*>(*val));
+        else if (*ft == DBR_UCHAR)  return Util::to_string(*reinterpret_cast<  epicsUInt8*>(*val));
+        else if (*ft == DBR_SHORT)  return Util::to_string(*reinterpret_cast<  epicsInt16*>(*val));
+        else if (*ft == DBR_USHORT) return Util::to_string(*reinterpret_cast< epicsUInt16*>(*val));
+        else if (*ft == DBR_LONG)   return Util::to_string(*reinterpret_cast<  epicsInt32*>(*val));
+        else if (*ft == DBR_ULONG)  return Util::to_string(*reinterpret_cast< epicsUInt32*>(*val));
 #ifdef HAVE_EPICS_INT64
-                        else if (*ft == DBR_INT64)  keyval.second = Util::to_string(*reinterpret_cast<  epicsInt64*>(*val));
-                        else if (*ft == DBR_UINT64) keyval.second = Util::to_string(*reinterpret_cast< epicsUInt64*>(*val));
+        else if (*ft == DBR_INT64)  return Util::to_string(*reinterpret_cast<  epicsInt64*>(*val));
+        else if (*ft == DBR_UINT64) return Util::to_string(*reinterpret_cast< epicsUInt64*>(*val));
 #endif
-                        else if (*ft == DBR_FLOAT)  keyval.second = Util::to_string(*reinterpret_cast<epicsFloat32*>(*val));
-                        else if (*ft == DBR_DOUBLE) keyval.second = Util::to_string(*reinterpret_cast<epicsFloat64*>(*val));
-                        else if (*ft == DBR_STRING) keyval.second = std::string(reinterpret_cast<const char*>(*val));
-                    } else {
-                        if      (*ft == DBR_CHAR)   keyval.second = Util::to_pylist_string( reinterpret_cast<   epicsInt8*>(*val), *ne );
-                        else if (*ft == DBR_UCHAR)  keyval.second = Util::to_pylist_string( reinterpret_cast<  epicsUInt8*>(*val), *ne );
-                        else if (*ft == DBR_SHORT)  keyval.second = Util::to_pylist_string( reinterpret_cast<  epicsInt16*>(*val), *ne );
-                        else if (*ft == DBR_USHORT) keyval.second = Util::to_pylist_string( reinterpret_cast< epicsUInt16*>(*val), *ne );
-                        else if (*ft == DBR_LONG)   keyval.second = Util::to_pylist_string( reinterpret_cast<  epicsInt32*>(*val), *ne );
-                        else if (*ft == DBR_ULONG)  keyval.second = Util::to_pylist_string( reinterpret_cast< epicsUInt32*>(*val), *ne );
+        else if (*ft == DBR_FLOAT)  return Util::to_string(*reinterpret_cast<epicsFloat32*>(*val));
+        else if (*ft == DBR_DOUBLE) return Util::to_string(*reinterpret_cast<epicsFloat64*>(*val));
+        else if (*ft == DBR_STRING) return std::string(reinterpret_cast<const char*>(*val));
+    } else {
+        if      (*ft == DBR_CHAR)   return Util::to_pylist_string( reinterpret_cast<   epicsInt8*>(*val), *ne );
+        else if (*ft == DBR_UCHAR)  return Util::to_pylist_string( reinterpret_cast<  epicsUInt8*>(*val), *ne );
+        else if (*ft == DBR_SHORT)  return Util::to_pylist_string( reinterpret_cast<  epicsInt16*>(*val), *ne );
+        else if (*ft == DBR_USHORT) return Util::to_pylist_string( reinterpret_cast< epicsUInt16*>(*val), *ne );
+        else if (*ft == DBR_LONG)   return Util::to_pylist_string( reinterpret_cast<  epicsInt32*>(*val), *ne );
+        else if (*ft == DBR_ULONG)  return Util::to_pylist_string( reinterpret_cast< epicsUInt32*>(*val), *ne );
 #ifdef HAVE_EPICS_INT64
-                        else if (*ft == DBR_INT64)  keyval.second = Util::to_pylist_string( reinterpret_cast<  epicsInt64*>(*val), *ne );
-                        else if (*ft == DBR_UINT64) keyval.second = Util::to_pylist_string( reinterpret_cast< epicsUInt64*>(*val), *ne );
+        else if (*ft == DBR_INT64)  return Util::to_pylist_string( reinterpret_cast<  epicsInt64*>(*val), *ne );
+        else if (*ft == DBR_UINT64) return Util::to_pylist_string( reinterpret_cast< epicsUInt64*>(*val), *ne );
 #endif
-                        else if (*ft == DBR_FLOAT)  keyval.second = Util::to_pylist_string( reinterpret_cast<epicsFloat32*>(*val), *ne );
-                        else if (*ft == DBR_DOUBLE) keyval.second = Util::to_pylist_string( reinterpret_cast<epicsFloat64*>(*val), *ne );
-                        else if (*ft == DBR_STRING) {
-                            std::vector<std::string> a;
-                            const char* ptr = reinterpret_cast<const char*>(*val);
-                            for (size_t i=0; i<*ne; i++) {
-                                std::string element(ptr, dbValueSize(DBF_STRING));
-                                element.resize(element.find('\0'));
-                                a.push_back("'" + Util::escape(element) + "'");
-                                ptr += dbValueSize(DBF_STRING);
-                            }
-                            keyval.second = Util::to_pylist_string(a);
-                        }
-                    }
-                }
+        else if (*ft == DBR_FLOAT)  return Util::to_pylist_string( reinterpret_cast<epicsFloat32*>(*val), *ne );
+        else if (*ft == DBR_DOUBLE) return Util::to_pylist_string( reinterpret_cast<epicsFloat64*>(*val), *ne );
+        else if (*ft == DBR_STRING) {
+            std::vector<std::string> a;
+            const char* ptr = reinterpret_cast<const char*>(*val);
+            for (size_t i=0; i<*ne; i++) {
+                std::string element(ptr, dbValueSize(DBF_STRING));
+                element.resize(element.find('\0'));
+                a.push_back("'" + Util::escape(element) + "'");
+                ptr += dbValueSize(DBF_STRING);
             }
+            return Util::to_pylist_string(a);
         }
     }
-    std::string code = Util::replaceFields(rec->calc, fields);
+    return std::string(1, 'A' + arg);
+}
+
+static const RecordFields::Overrides argOverrides = {
+    { "A", argToString }, { "B", argToString }, { "C", argToString }, { "D", argToString }, { "E", argToString },
+    { "F", argToString }, { "G", argToString }, { "H", argToString }, { "I", argToString }, { "J", argToString },
+};
+
+/**
+ * Convert value returned by Python into a value field of given type.
+ */
+static long storeValue(const PyWrapper::MultiTypeValue& ret, epicsEnum16 ftvl, void* field, epicsUInt32 mevl, epicsUInt32& nevl)
+{
+    long status = 0;
+    nevl = 0;
+    typedef long (*convertRoutineCast)(const void*, void*, void*);
+    if (ret.type == PyWrapper::MultiTypeValue::Type::BOOL) {
+        epicsInt32 l = ret.b;
+        auto convert = reinterpret_cast<convertRoutineCast>(dbFastPutConvertRoutine[DBF_LONG][ftvl]);
+        status = convert(&l, field, 0);
+        nevl = 1;
+    } else if (ret.type == PyWrapper::MultiTypeValue::Type::INTEGER) {
+        auto convert = reinterpret_cast<convertRoutineCast>(dbFastPutConvertRoutine[DBF_LONG][ftvl]);
+        status = convert(&ret.i, field, 0);
+        nevl = 1;
+    } else if (ret.type == PyWrapper::MultiTypeValue::Type::FLOAT) {
+        auto convert = reinterpret_cast<convertRoutineCast>(dbFastPutConvertRoutine[DBF_DOUBLE][ftvl]);
+        status = convert(&ret.f, field, 0);
+        nevl = 1;
+    } else if (ret.type == PyWrapper::MultiTypeValue::Type::STRING) {
+        char s[MAX_STRING_SIZE];
+        strncpy(s, ret.s.c_str(), MAX_STRING_SIZE);
+        s[MAX_STRING_SIZE-1] = 0;
+        auto convert = reinterpret_cast<convertRoutineCast>(dbFastPutConvertRoutine[DBF_STRING][ftvl]);
+        status = convert(s, field, 0);
+        nevl = 1;
+    } else if (ret.type == PyWrapper::MultiTypeValue::Type::VECTOR_INTEGER) {
+        auto convert = reinterpret_cast<convertRoutineCast>(dbFastPutConvertRoutine[DBF_LONG][ftvl]);
+        for (size_t i=0; i<ret.vi.size() && i<mevl; i++) {
+            char* val = reinterpret_cast<char*>(field) + i*dbValueSize(ftvl);
+            status = convert(&ret.vi[i], val, 0);
+            if (status != 0) {
+                break;
+            }
+            nevl++;
+        }
+    } else if (ret.type == PyWrapper::MultiTypeValue::Type::VECTOR_FLOAT) {
+        auto convert = reinterpret_cast<convertRoutineCast>(dbFastPutConvertRoutine[DBF_DOUBLE][ftvl]);
+        for (size_t i=0; i<ret.vf.size() && i<mevl; i++) {
+            char* val = reinterpret_cast<char*>(field) + i*dbValueSize(ftvl);
+            status = convert(&ret.vf[i], val, 0);
+            if (status != 0) {
+                break;
+            }
+            nevl++;
+        }
+    } else if (ret.type == PyWrapper::MultiTypeValue::Type::VECTOR_STRING) {
+        auto convert = reinterpret_cast<convertRoutineCast>(dbFastPutConvertRoutine[DBF_STRING][ftvl]);
+        for (size_t i=0; i<ret.vs.size() && i<mevl; i++) {
+            char* val = reinterpret_cast<char*>(field) + i*dbValueSize(ftvl);
+            status = convert(ret.vs[i].c_str(), val, 0);
+            if (status != 0) {
+                break;
+            }
+            nevl++;
+        }
+    }
+    return status;
+}
+
+/**
+ * Store values of multi-output code into VALA..
+ *
+ * Outputs missing from the result keep their value and number of elements,
+ * those that fail to convert are left empty.
+ */
+static long storeOutputs(pycalcRecord* rec, const std::vector<PyWrapper::MultiTypeValue>& values)
+{
+    long status = 0;
+    rec->ctx->outputsStored = 0;
+    for (size_t i = 0; i < values.size(); i++) {
+        if (values[i].type == PyWrapper::MultiTypeValue::Type::NONE) {
+            continue;
+        }
+        auto ne = &rec->neva + i;
+        long ret = storeValue(values[i], *(&rec->ftva + i), *(&rec->vala + i), *(&rec->meva + i), *ne);
+        if (ret != 0) {
+            *ne = 0;
+            status = ret;
+        } else {
+            rec->ctx->outputsStored |= (1u << i);
+        }
+    }
+    return status;
+}
+
+/**
+ * Bind fields referenced by code, returns false when any belongs to another record.
+ */
+static bool bindFields(pycalcRecord* rec)
+{
+    auto ctx = rec->ctx;
+    ctx->code.fields(rec->calc);
+    ctx->fields.bind(reinterpret_cast<dbCommon*>(rec), ctx->code, argOverrides);
+    return !ctx->fields.foreign();
+}
+
+/**
+ * Read current values of all fields referenced by code, once per processing.
+ *
+ * Returns false when code references fields of other records, those can
+ * only be read without this record locked, ie. in processRecordCb().
+ */
+static bool prepareFields(pycalcRecord* rec, bool locked)
+{
+    auto ctx = rec->ctx;
+    if (!ctx->prepared) {
+        if (!bindFields(rec) && locked) {
+            return false;
+        }
+        ctx->fields.get(ctx->code.fields());
+        ctx->prepared = true;
+    }
+    return true;
+}
+
+static void processRecordCb(pycalcRecord* rec)
+{
+    Latency::Scope latency(rec->ctx->trace);
+
+    // PURE records got inputs hashed by reuseResult() already
+    bool hashed = (rec->ctx->prepared && rec->pure == menuYesNoYES);
+    prepareFields(rec, false);
+    const std::string& code = rec->ctx->code.render();
 
     PyWrapper::MultiTypeValue ret;
+    std::vector<PyWrapper::MultiTypeValue> outputs;
+    auto& keys = rec->ctx->outputKeys;
     long status = 0;
     try {
-        ret = PyWrapper::exec(code, (rec->tpro == 1));
+        if (keys.empty()) {
+            ret = PyWrapper::exec(code, (rec->tpro == 1));
+        } else {
+            outputs = PyWrapper::execItems(code, (rec->tpro == 1), keys, true);
+        }
     } catch (...) {
         status = -1;
     }
 
-    rec->nevl = 0;
-    if (status == 0) {
-        typedef long (*convertRoutineCast)(const void*, void*, void*);
-        if (ret.type == PyWrapper::MultiTypeValue::Type::BOOL) {
-            epicsInt32 l = ret.b;
-            auto convert = reinterpret_cast<convertRoutineCast>(dbFastPutConvertRoutine[DBF_LONG][rec->ftvl]);
-            status = convert(&l, rec->val, 0);
-            rec->nevl = 1;
-        } else if (ret.type == PyWrapper::MultiTypeValue::Type::INTEGER) {
-            auto convert = reinterpret_cast<convertRoutineCast>(dbFastPutConvertRoutine[DBF_LONG][rec->ftvl]);
-            status = convert(&ret.i, rec->val, 0);
-            rec->nevl = 1;
-        } else if (ret.type == PyWrapper::MultiTypeValue::Type::FLOAT) {
-            auto convert = reinterpret_cast<convertRoutineCast>(dbFastPutConvertRoutine[DBF_DOUBLE][rec->ftvl]);
-            status = convert(&ret.f, rec->val, 0);
-            rec->nevl = 1;
-        } else if (ret.type == PyWrapper::MultiTypeValue::Type::STRING) {
-            char s[MAX_STRING_SIZE];
-            strncpy(s, ret.s.c_str(), MAX_STRING_SIZE);
-            s[MAX_STRING_SIZE-1] = 0;
-            auto convert = reinterpret_cast<convertRoutineCast>(dbFastPutConvertRoutine[DBF_STRING][rec->ftvl]);
-            status = convert(s, rec->val, 0);
-            rec->nevl = 1;
-        } else if (ret.type == PyWrapper::MultiTypeValue::Type::VECTOR_INTEGER) {
-            auto convert = reinterpret_cast<convertRoutineCast>(dbFastPutConvertRoutine[DBF_LONG][rec->ftvl]);
-            for (size_t i=0; i<ret.vi.size() && i<rec->mevl; i++) {
-                char* val = reinterpret_cast<char*>(rec->val) + i*dbValueSize(rec->ftvl);
-                status = convert(&ret.vi[i], val, 0);
-                if (status != 0) {
-                    break;
-                }
-                rec->nevl++;
-            }
-        } else if (ret.type == PyWrapper::MultiTypeValue::Type::VECTOR_FLOAT) {
-            auto convert = reinterpret_cast<convertRoutineCast>(dbFastPutConvertRoutine[DBF_DOUBLE][rec->ftvl]);
-            for (size_t i=0; i<ret.vf.size() && i<rec->mevl; i++) {
-                char* val = reinterpret_cast<char*>(rec->val) + i*dbValueSize(rec->ftvl);
-                status = convert(&ret.vf[i], val, 0);
-                if (status != 0) {
-                    break;
-                }
-                rec->nevl++;
-            }
-        } else if (ret.type == PyWrapper::MultiTypeValue::Type::VECTOR_STRING) {
-            auto convert = reinterpret_cast<convertRoutineCast>(dbFastPutConvertRoutine[DBF_STRING][rec->ftvl]);
-            for (size_t i=0; i<ret.vs.size() && i<rec->mevl; i++) {
-                char* val = reinterpret_cast<char*>(rec->val) + i*dbValueSize(rec->ftvl);
-                status = convert(ret.vs[i].c_str(), val, 0);
-                if (status != 0) {
-                    break;
-                }
-                rec->nevl++;
-            }
-        }
+    if (status != 0) {
+        rec->nevl = 0;
+        rec->ctx->outputsStored = 0;
+    } else if (keys.empty()) {
+        status = storeValue(ret, rec->ftvl, rec->val, rec->mevl, rec->nevl);
+    } else {
+        status = storeOutputs(rec, outputs);
     }
 
+    // Errors are not reused, they may be caused by something else than inputs
+    rec->ctx->resultValid = (hashed && status == 0);
+    if (status != 0) {
+        rec->ctx->deadband.reset();
+    }
     rec->ctx->processCbStatus = (status == 0 ? 0 : -1);
+    rec->ctx->trace.mark(Latency::REQUESTED);
     callbackRequestProcessCallback(&rec->ctx->callback, rec->prio, rec);
 }
 
+/**
+ * Get argument as native evaluator value, false when it's not a number.
+ *
+ * Value must be the same as Python gets from argToString().
+ */
+static bool argToValue(pycalcRecord* rec, int arg, NativeExpr::Value& value)
+{
+    auto val = &rec->a   + arg;
+    auto ft  = &rec->fta + arg;
+    auto me  = &rec->mea + arg;
+
+    if (*me != 1) {
+        return false;
+    }
+    value.type = NativeExpr::Value::Type::INTEGER;
+    switch (*ft) {
+    case DBR_CHAR:   value.i = *reinterpret_cast<   epicsInt8*>(*val); return true;
+    case DBR_UCHAR:  value.i = *reinterpret_cast<  epicsUInt8*>(*val); return true;
+    case DBR_SHORT:  value.i = *reinterpret_cast<  epicsInt16*>(*val); return true;
+    case DBR_USHORT: value.i = *reinterpret_cast< epicsUInt16*>(*val); return true;
+    case DBR_LONG:   value.i = *reinterpret_cast<  epicsInt32*>(*val); return true;
+    case DBR_ULONG:  value.i = *reinterpret_cast< epicsUInt32*>(*val); return true;
+#ifdef HAVE_EPICS_INT64
+    case DBR_INT64:
+        value.i = *reinterpret_cast<epicsInt64*>(*val);
+        return (value.i <= (1LL << 53) && value.i >= -(1LL << 53));
+    case DBR_UINT64:
+        value.i = *reinterpret_cast<epicsUInt64*>(*val);
+        return (*reinterpret_cast<epicsUInt64*>(*val) <= (1ULL << 53));
+#endif
+    case DBR_FLOAT:
+        // Python gets float rounded to printed digits
+        value.type = NativeExpr::Value::Type::FLOAT;
+        value.f = std::strtod(Util::to_string(*reinterpret_cast<epicsFloat32*>(*val)).c_str(), nullptr);
+        return std::isfinite(value.f);
+    case DBR_DOUBLE:
+        value.type = NativeExpr::Value::Type::FLOAT;
+        value.f = *reinterpret_cast<epicsFloat64*>(*val);
+        return std::isfinite(value.f);
+    default:
+        return false;
+    }
+}
+
+/**
+ * Evaluate CALC without Python when it's a simple expression of numbers.
+ *
+ * Returns false when record needs to execute code in Python instead.
+ */
+static bool evalNative(pycalcRecord* rec)
+{
+    auto& native = rec->ctx->native;
+    if (rec->nout > 0 || !native.compile(rec->calc, argNames)) {
+        return false;
+    }
+
+    NativeExpr::Value args[PYCALCREC_NARGS];
+    for (int i = 0; i < PYCALCREC_NARGS; i++) {
+        if (native.uses(i) && !argToValue(rec, i, args[i])) {
+            return false;
+        }
+    }
+    NativeExpr::Value result;
+    if (!native.eval(args, result)) {
+        return false;
+    }
+
+    PyWrapper::MultiTypeValue ret;
+    if (result.type != NativeExpr::Value::Type::FLOAT) {
+        // PyWrapper also converts Python bool to integer
+        ret.type = PyWrapper::MultiTypeValue::Type::INTEGER;
+        ret.i = result.i;
+    } else {
+        ret.type = PyWrapper::MultiTypeValue::Type::FLOAT;
+        ret.f = result.f;
+    }
+    if (rec->tpro == 1) {
+        printf("Evaluating native expression: %s\n", rec->calc);
+    }
+    rec->ctx->processCbStatus = (storeValue(ret, rec->ftvl, rec->val, rec->mevl, rec->nevl) == 0 ? 0 : -1);
+    rec->ctx->resultValid = false;
+    if (rec->ctx->processCbStatus != 0) {
+        rec->ctx->deadband.reset();
+    }
+    return true;
+}
+
+/**
+ * With deadband configured, check whether any input moved enough to execute code.
+ */
+static bool inputsChanged(pycalcRecord* rec)
+{
+    if (!rec->ctx->deadband.enabled()) {
+        return true;
+    }
+    if (!bindFields(rec) || rec->ctx->deadband.changed(rec->ctx->fields, rec->ctx->code.generation())) {
+        return true;
+    }
+    if (rec->tpro == 1) {
+        printf("Inputs within deadband, keeping result: %s\n", rec->calc);
+    }
+    rec->ctx->stats.skipped();
+    return false;
+}
+
+/**
+ * For PURE records, check whether code with same inputs already produced VAL.
+ *
+ * Code is rendered with current values of all fields it references, so
+ * its hash covers arguments A-J as well as any other field and CALC itself.
+ * Rendered code is kept for processRecordCb() when it needs to execute.
+ */
+static bool reuseResult(pycalcRecord* rec)
+{
+    auto ctx = rec->ctx;
+    if (!prepareFields(rec, true)) {
+        return false;
+    }
+    auto hash = std::hash<std::string>()(ctx->code.render());
+
+    if (ctx->resultValid && hash == ctx->inputsHash) {
+        if (rec->tpro == 1) {
+            printf("Inputs unchanged, reusing result: %s\n", rec->calc);
+        }
+        ctx->processCbStatus = 0;
+        ctx->stats.skipped();
+        return true;
+    }
+    ctx->inputsHash = hash;
+    ctx->resultValid = false;
+    return false;
+}
+
 static long processRecord(dbCommon *common)
 {
     auto rec = reinterpret_cast<struct pycalcRecord *>(common);
@@ -270,30 +609,59 @@ static long processRecord(dbCommon *common)
         rec->pact = 1;
         if (fetchValues(rec) != 0) {
             recGblSetSevr(rec, epicsAlarmCalc, epicsSevInvalid);
+            rec->ctx->stats.completed(false);
             rec->pact = 0;
             return S_dev_badInpType;
         }
 
-        auto scheduled = AsyncExec::schedule([rec]() {
-            processRecordCb(rec);
-        });
-        return (scheduled ? 0 : -1);
+        rec->ctx->stats.scheduled();
+        rec->ctx->prepared = false;
+        // Inputs within deadband, simple arithmetic and unchanged inputs of pure code complete right away, without GIL
+        if (inputsChanged(rec) && !evalNative(rec) && !(rec->pure == menuYesNoYES && reuseResult(rec))) {
+            rec->ctx->trace.mark(Latency::SCHEDULED);
+            auto scheduled = AsyncExec::schedule([rec]() {
+                processRecordCb(rec);
+            }, rec->name);
+            return (scheduled ? 0 : -1);
+        }
     }
 
+    rec->ctx->trace.complete();
+    rec->ctx->stats.completed(rec->ctx->processCbStatus != -1);
     if (rec->ctx->processCbStatus == -1) {
         recGblSetSevr(rec, epicsAlarmCalc, epicsSevInvalid);
     }
 
     recGblGetTimeStamp(rec);
-    dbPutLink(&rec->out, rec->ftvl, rec->val, rec->nevl);
+    if (rec->nout == 0) {
+        dbPutLink(&rec->out, rec->ftvl, rec->val, rec->nevl);
+    }
+    for (int i = 0; i < rec->nout; i++) {
+        if (rec->ctx->outputsStored & (1u << i)) {
+            dbPutLink(&rec->outa + i, *(&rec->ftva + i), *(&rec->vala + i), *(&rec->neva + i));
+        }
+    }
 
-    auto monitor_mask = recGblResetAlarms(rec);
+    auto alarm_mask = recGblResetAlarms(rec);
     if (rec->ctx->processCbStatus == -1) {
-        monitor_mask |= DBE_ALARM;
-    } else {
+        alarm_mask |= DBE_ALARM;
+    }
+    auto monitor_mask = alarm_mask;
+    if (rec->ctx->processCbStatus != -1) {
         monitor_mask |= DBE_VALUE | DBE_LOG;
     }
-    db_post_events(rec, rec->val, monitor_mask);
+    // VAL is not written in multi-output mode, outputs not stored only post alarms
+    if (rec->nout == 0) {
+        db_post_events(rec, rec->val, monitor_mask);
+    } else if (alarm_mask != 0) {
+        db_post_events(rec, rec->val, alarm_mask);
+    }
+    for (int i = 0; i < rec->nout; i++) {
+        auto mask = ((rec->ctx->outputsStored & (1u << i)) ? (alarm_mask | DBE_VALUE | DBE_LOG) : alarm_mask);
+        if (mask != 0) {
+            db_post_events(rec, *(&rec->vala + i), mask);
+        }
+    }
 
     recGblFwdLink(rec);
     rec->pact = 0;
@@ -301,6 +669,51 @@ static long processRecord(dbCommon *common)
     return 0;
 }
 
+#ifdef HAVE_LINK_UPDATES
+/**
+ * Check whether link has a new value since it was last fetched.
+ *
+ * CA links count monitor updates. DB links always fetch, neither processing
+ * nor timestamp of the source record tell whether its value changed, nor do
+ * other links. Inputs written directly fetch as well. Alarm severity is
+ * still inherited from links that don't need fetching.
+ */
+static bool linkChanged(pycalcRecord* rec, int arg)
+{
+    auto inp = &rec->inpa + arg;
+    auto& input = rec->ctx->inputs[arg];
+    if (inp->type != CA_LINK) {
+        input.fetched = false;
+        return true;
+    }
+
+    unsigned long updates = 0;
+    bool valid = (dbCaGetUpdateCount(inp, &updates) == 0);
+    bool changed = (!valid || !input.fetched || updates != input.updates);
+    input.updates = updates;
+    input.fetched = valid;
+
+    if (!changed && !inputMatches(rec, arg, false)) {
+        changed = true;
+    }
+    if (!changed) {
+        epicsEnum16 stat, sevr;
+        if (dbGetAlarm(inp, &stat, &sevr) == 0) {
+            recGblInheritSevr(inp->value.pv_link.pvlMask & pvlOptMsMode, rec, stat, sevr);
+        }
+    }
+    return changed;
+}
+#else
+static bool linkChanged(pycalcRecord*, int)
+{
+    return true;
+}
+#endif
+
+/**
+ * Fetch inputs from links, only those that changed since the last time.
+ */
 static long fetchValues(pycalcRecord *rec)
 {
     for (auto i = 0; i < PYCALCREC_NARGS; i++) {
@@ -310,7 +723,7 @@ static long fetchValues(pycalcRecord *rec)
         auto me  = &rec->mea  + i;
         auto ne  = &rec->nea  + i;
 
-        if (!dbLinkIsConstant(inp) && dbIsLinkConnected(inp)) {
+        if (!dbLinkIsConstant(inp) && dbIsLinkConnected(inp) && linkChanged(rec, i)) {
             long nElements;
             auto ret = dbGetNelements(inp, &nElements);
             if (ret == 0 && nElements > 0) {
@@ -320,11 +733,19 @@ static long fetchValues(pycalcRecord *rec)
                 dbGetLink(inp, *ft, *val, 0, &nElements);
                 *ne = nElements;
             }
+            // Same value keeps the converted text
+            if (!inputMatches(rec, i, true)) {
+                rec->ctx->inputs[i].converted = false;
+            }
         }
     }
     return 0;
 }
 
+/**
+ * Number of elements is the capacity of the field, as with array records,
+ * current number of elements is reported by getArrayInfo().
+ */
 static long convertDbAddr(DBADDR *paddr)
 {
     auto rec = reinterpret_cast<pycalcRecord *>(paddr->precord);
@@ -333,12 +754,17 @@ static long convertDbAddr(DBADDR *paddr)
     if (field >= pycalcRecordA && field < (pycalcRecordA + PYCALCREC_NARGS)) {
         int off = field - pycalcRecordA;
         paddr->pfield      = *(&rec->a   + off);
-        paddr->no_elements = *(&rec->nea + off);
+        paddr->no_elements = *(&rec->mea + off);
         paddr->field_type  = *(&rec->fta + off);
     } else if (field == pycalcRecordVAL) {
         paddr->pfield      = rec->val;
-        paddr->no_elements = rec->nevl;
+        paddr->no_elements = rec->mevl;
         paddr->field_type  = rec->ftvl;
+    } else if (field >= pycalcRecordVALA && field < (pycalcRecordVALA + PYCALCREC_NOUTS)) {
+        int off = field - pycalcRecordVALA;
+        paddr->pfield      = *(&rec->vala + off);
+        paddr->no_elements = *(&rec->meva + off);
+        paddr->field_type  = *(&rec->ftva + off);
     } else {
         errlogPrintf("pycalcRecord::convertDbAddr called for %s.%s\n", rec->name, paddr->pfldDes->name);
         return 0;
@@ -358,6 +784,8 @@ static long getArrayInfo(DBADDR *paddr, long *no_elements, long *offset)
         *no_elements = *(&rec->nea + off);
     } else if (field == pycalcRecordVAL) {
         *no_elements = rec->nevl;
+    } else if (field >= pycalcRecordVALA && field < (pycalcRecordVALA + PYCALCREC_NOUTS)) {
+        *no_elements = *(&rec->neva + (field - pycalcRecordVALA));
     } else {
         errlogPrintf("pycalcRecord::getArrayInfo called for %s.%s\n", rec->name, paddr->pfldDes->name);
     }
@@ -365,3 +793,24 @@ static long getArrayInfo(DBADDR *paddr, long *no_elements, long *offset)
 
     return 0;
 }
+
+/**
+ * Number of elements written by a put to A-J, VAL or VALA-VALJ.
+ */
+static long putArrayInfo(DBADDR *paddr, long nNew)
+{
+    auto rec = reinterpret_cast<pycalcRecord *>(paddr->precord);
+    int field = dbGetFieldIndex(paddr);
+
+    if (field >= pycalcRecordA && field < (pycalcRecordA + PYCALCREC_NARGS)) {
+        *(&rec->nea + (field - pycalcRecordA)) = nNew;
+    } else if (field == pycalcRecordVAL) {
+        rec->nevl = nNew;
+    } else if (field >= pycalcRecordVALA && field < (pycalcRecordVALA + PYCALCREC_NOUTS)) {
+        *(&rec->neva + (field - pycalcRecordVALA)) = nNew;
+    } else {
+        errlogPrintf("pycalcRecord::putArrayInfo called for %s.%s\n", rec->name, paddr->pfldDes->name);
+    }
+
+    return 0;
+}
@@ -5,146 +5,51 @@
 
 #include <aaoRecord.h>
 
-#include <alarm.h>
-#include <callback.h>
-#include <cantProceed.h>
-#include <dbScan.h>
-#include <devSup.h>
-#include <epicsExport.h>
-#include <recGbl.h>
-
-#include <map>
-#include <string.h>
-
-#include "asyncexec.h"
-#include "pywrapper.h"
-#include "util.h"
+#include "devsupport.h"
 #include "util_array.h"
-#include <iostream>
-
-struct PyDevContext {
-    CALLBACK callback;
-    IOSCANPVT scan;
-    int processCbStatus;
-};
-
-static std::map<std::string, IOSCANPVT> ioScanPvts;
-
-static void scanCallback(IOSCANPVT scan)
-{
-#ifdef VERSION_INT
-#  if EPICS_VERSION_INT < VERSION_INT(3,16,0,0)
-    scanIoRequest(scan);
-#  else
-    scanIoImmediate(scan, priorityHigh);
-    scanIoImmediate(scan, priorityMedium);
-    scanIoImmediate(scan, priorityLow);
-#  endif
-#else
-    scanIoRequest(scan);
-#endif
-}
-
-static long initRecord(aaoRecord* rec)
-{
-
-    std::string addr = rec->out.value.instio.string;
-    void *buffer = callocMustSucceed(1, sizeof(PyDevContext), "PyDev::initRecord");
-    PyDevContext* ctx = new (buffer) PyDevContext;
-    rec->dpvt = ctx;
 
-    // This could be better checked with regex
-    if (addr.find("pydev.iointr('") == 0 && addr.substr(addr.size()-2) == "')") {
-        std::string param = addr.substr(14, addr.size()-16);
-        auto it = ioScanPvts.find(param);
-        if (it == ioScanPvts.end()) {
-            scanIoInit( &ioScanPvts[param] );
-            PyWrapper::Callback cb = std::bind(scanCallback, ioScanPvts[param]);
-            PyWrapper::registerIoIntr(param, cb);
-            it = ioScanPvts.find(param);
-        }
-        ctx->scan = it->second;
-    } else {
-        ctx->scan = nullptr;
-    }
-
-    return 0;
-}
+#include <epicsExport.h>
 
-static long getIointInfo(int /*direction*/, aaoRecord *rec, IOSCANPVT* io)
+static std::string valToString(const DBADDR& addr)
 {
-    auto ctx = reinterpret_cast<PyDevContext*>(rec->dpvt);
-    if (ctx != nullptr && ctx->scan != nullptr) {
-        *io = ctx->scan;
-    }
-    return 0;
+    return rec_bptr_to_strings(reinterpret_cast<aaoRecord*>(addr.precord));
 }
 
+struct AaoTraits : public DevTraits {
+    using Record = aaoRecord;
 
+    static const char* type() { return "aao"; }
+    static DBLINK& link(aaoRecord* rec) { return rec->out; }
 
-static void processRecordCb(aaoRecord* rec)
-{
-    auto ctx = reinterpret_cast<PyDevContext*>(rec->dpvt);
-
-    auto fields = Util::getFields(rec->out.value.instio.string);
-    for (auto& keyval: fields) {
-        if      (keyval.first == "VAL")  keyval.second = rec_bptr_to_strings(rec);
-	else if (keyval.first == "NAME") keyval.second = rec->name;
-        else if (keyval.first == "EGU")  keyval.second = rec->egu;
-        else if (keyval.first == "HOPR") keyval.second = Util::to_string(rec->hopr);
-        else if (keyval.first == "LOPR") keyval.second = Util::to_string(rec->lopr);
-        else if (keyval.first == "PREC") keyval.second = Util::to_string(rec->prec);
-        else if (keyval.first == "TPRO") keyval.second = Util::to_string(rec->tpro);
+    static const RecordFields::Overrides& overrides()
+    {
+        static const RecordFields::Overrides overrides = {
+            { "VAL", valToString },
+        };
+        return overrides;
     }
-    std::string code = Util::replaceFields(rec->out.value.instio.string, fields);
 
-    try {
-        epicsFloat64 val;
-	auto r = PyWrapper::exec(code, (rec->tpro == 1));
+    static bool exec(aaoRecord* rec, const std::string& code)
+    {
+        auto r = PyWrapper::exec(code, (rec->tpro == 1));
         if (r.type == PyWrapper::MultiTypeValue::Type::NONE) {
             rec->udf = 0;
         }
-        ctx->processCbStatus = 0;
-    } catch (...) {
-        recGblSetSevr(rec, epicsAlarmCalc, epicsSevInvalid);
-        ctx->processCbStatus = -1;
-    }
-    callbackRequestProcessCallback(&ctx->callback, rec->prio, rec);
-
-}
-
-static long processRecord(aaoRecord* rec)
-{
-    auto ctx = reinterpret_cast<PyDevContext*>(rec->dpvt);
-    if (ctx == nullptr) {
-        // Keep PACT=1 to prevent further processing
-        rec->pact = 1;
-        recGblSetSevr(rec, epicsAlarmUDF, epicsSevInvalid);
-        return -1;
-    }
-
-    if (rec->pact == 1) {
-        rec->pact = 0;
-        return ctx->processCbStatus;
+        return true;
     }
-    rec->pact = 1;
-
-    auto scheduled = AsyncExec::schedule([rec]() {
-        processRecordCb(rec);
-    });
-    return (scheduled ? 0 : -1);
-}
+};
+using PyDevAao = DevSupport<AaoTraits>;
 
 extern "C"
 {
     struct
     {
         long number{6};
-        DEVSUPFUN report{nullptr};
+        DEVSUPFUN report{(DEVSUPFUN)PyDevAao::report};
         DEVSUPFUN init{nullptr};
-        DEVSUPFUN init_record{(DEVSUPFUN)initRecord};
-        DEVSUPFUN get_ioint_info{(DEVSUPFUN)getIointInfo};
-        DEVSUPFUN write{(DEVSUPFUN)processRecord};
+        DEVSUPFUN init_record{(DEVSUPFUN)PyDevAao::initRecord};
+        DEVSUPFUN get_ioint_info{(DEVSUPFUN)PyDevAao::getIointInfo};
+        DEVSUPFUN write{(DEVSUPFUN)PyDevAao::processRecord};
         DEVSUPFUN special_linconv{nullptr};
     } devPyDevAao;
     epicsExportAddress(dset, devPyDevAao);
@@ -5,159 +5,56 @@
 
 #include <aiRecord.h>
 
-#include <alarm.h>
-#include <callback.h>
-#include <cantProceed.h>
-#include <dbScan.h>
-#include <devSup.h>
-#include <epicsExport.h>
-#include <recGbl.h>
-
-#include <map>
-#include <string.h>
-
-#include "asyncexec.h"
-#include "pywrapper.h"
-#include "util.h"
-
-struct PyDevContext {
-    CALLBACK callback;
-    IOSCANPVT scan;
-    int processCbStatus;
-};
-
-static std::map<std::string, IOSCANPVT> ioScanPvts;
-
-static void scanCallback(IOSCANPVT scan)
-{
-#ifdef VERSION_INT
-#  if EPICS_VERSION_INT < VERSION_INT(3,16,0,0)
-    scanIoRequest(scan);
-#  else
-    scanIoImmediate(scan, priorityHigh);
-    scanIoImmediate(scan, priorityMedium);
-    scanIoImmediate(scan, priorityLow);
-#  endif
-#else
-    scanIoRequest(scan);
-#endif
-}
-
-static long initRecord(aiRecord* rec)
-{
-    std::string addr = rec->inp.value.instio.string;
-    void *buffer = callocMustSucceed(1, sizeof(PyDevContext), "PyDev::initRecord");
-    PyDevContext* ctx = new (buffer) PyDevContext;
-    rec->dpvt = ctx;
-
-    // This could be better checked with regex
-    if (addr.find("pydev.iointr('") == 0 && addr.substr(addr.size()-2) == "')") {
-        std::string param = addr.substr(14, addr.size()-16);
-        auto it = ioScanPvts.find(param);
-        if (it == ioScanPvts.end()) {
-            scanIoInit( &ioScanPvts[param] );
-            PyWrapper::Callback cb = std::bind(scanCallback, ioScanPvts[param]);
-            PyWrapper::registerIoIntr(param, cb);
-            it = ioScanPvts.find(param);
-        }
-        ctx->scan = it->second;
-    } else {
-        ctx->scan = nullptr;
-    }
-
-    return 0;
-}
+#include "devsupport.h"
 
-static long getIointInfo(int /*direction*/, aiRecord *rec, IOSCANPVT* io)
-{
-    auto ctx = reinterpret_cast<PyDevContext*>(rec->dpvt);
-    if (ctx != nullptr && ctx->scan != nullptr) {
-        *io = ctx->scan;
-    }
-    return 0;
-}
+#include <epicsExport.h>
 
-static void processRecordCb(aiRecord* rec)
-{
-    auto ctx = reinterpret_cast<PyDevContext*>(rec->dpvt);
+struct AiTraits : public DevTraits {
+    using Record = aiRecord;
+    static const long successStatus = 2; // Conversion already done
+    static const bool groups = true;
 
-    rec->val -= rec->aoff;
-    if (rec->aslo != 0.0) rec->val /= rec->aslo;
+    static const char* type() { return "ai"; }
+    static DBLINK& link(aiRecord* rec) { return rec->inp; }
 
-    auto fields = Util::getFields(rec->inp.value.instio.string);
-    for (auto& keyval: fields) {
-        if      (keyval.first == "VAL")  keyval.second = Util::to_string(rec->val);
-        else if (keyval.first == "RVAL") keyval.second = Util::to_string(rec->rval);
-        else if (keyval.first == "ORAW") keyval.second = Util::to_string(rec->oraw);
-        else if (keyval.first == "NAME") keyval.second = rec->name;
-        else if (keyval.first == "EGU")  keyval.second = rec->egu;
-        else if (keyval.first == "HOPR") keyval.second = Util::to_string(rec->hopr);
-        else if (keyval.first == "LOPR") keyval.second = Util::to_string(rec->lopr);
-        else if (keyval.first == "PREC") keyval.second = Util::to_string(rec->prec);
-        else if (keyval.first == "TPRO") keyval.second = Util::to_string(rec->tpro);
+    static void prepare(aiRecord* rec)
+    {
+        rec->val -= rec->aoff;
+        if (rec->aslo != 0.0) rec->val /= rec->aslo;
     }
-    std::string code = Util::replaceFields(rec->inp.value.instio.string, fields);
 
-    try {
+    static bool store(aiRecord* rec, const PyWrapper::MultiTypeValue& value)
+    {
         epicsFloat64 val;
-        if (PyWrapper::exec(code, (rec->tpro == 1), &val) == true) {
-            val = (val * rec->aslo) + rec->aoff;
-            if (rec->smoo == 0.0 || rec->udf)
-                rec->val = val;
-            else
-                rec->val = (rec->val * rec->smoo) + (val * (1.0 - rec->smoo));
-            rec->udf = 0;
-            ctx->processCbStatus = 0;
-        } else {
-            if (rec->tpro == 1) {
-                printf("ERROR: Can't convert returned Python type to double type\n");
-            }
-            recGblSetSevr(rec, epicsAlarmCalc, epicsSevInvalid);
-            ctx->processCbStatus = -1;
+        if (PyWrapper::convert(value, &val) == false) {
+            return false;
         }
-    } catch (...) {
-        recGblSetSevr(rec, epicsAlarmCalc, epicsSevInvalid);
-        ctx->processCbStatus = -1;
-    }
-
-    if (ctx->processCbStatus == 0)
-        ctx->processCbStatus = 2; // Conversion already done
-
-    callbackRequestProcessCallback(&ctx->callback, rec->prio, rec);
-}
-
-static long processRecord(aiRecord* rec)
-{
-    auto ctx = reinterpret_cast<PyDevContext*>(rec->dpvt);
-    if (ctx == nullptr) {
-        // Keep PACT=1 to prevent further processing
-        rec->pact = 1;
-        recGblSetSevr(rec, epicsAlarmUDF, epicsSevInvalid);
-        return -1;
+        val = (val * rec->aslo) + rec->aoff;
+        if (rec->smoo == 0.0 || rec->udf)
+            rec->val = val;
+        else
+            rec->val = (rec->val * rec->smoo) + (val * (1.0 - rec->smoo));
+        rec->udf = 0;
+        return true;
     }
 
-    if (rec->pact == 1) {
-        rec->pact = 0;
-        return ctx->processCbStatus;
+    static bool exec(aiRecord* rec, const std::string& code)
+    {
+        return store(rec, PyWrapper::exec(code, (rec->tpro == 1)));
     }
-    rec->pact = 1;
-
-    auto scheduled = AsyncExec::schedule([rec]() {
-        processRecordCb(rec);
-    });
-    return (scheduled ? 0 : -1);
-}
+};
+using PyDevAi = DevSupport<AiTraits>;
 
 extern "C"
 {
     struct
     {
         long number{6};
-        DEVSUPFUN report{nullptr};
+        DEVSUPFUN report{(DEVSUPFUN)PyDevAi::report};
         DEVSUPFUN init{nullptr};
-        DEVSUPFUN init_record{(DEVSUPFUN)initRecord};
-        DEVSUPFUN get_ioint_info{(DEVSUPFUN)getIointInfo};
-        DEVSUPFUN write{(DEVSUPFUN)processRecord};
+        DEVSUPFUN init_record{(DEVSUPFUN)PyDevAi::initRecord};
+        DEVSUPFUN get_ioint_info{(DEVSUPFUN)PyDevAi::getIointInfo};
+        DEVSUPFUN write{(DEVSUPFUN)PyDevAi::processRecord};
         DEVSUPFUN special_linconv{nullptr};
     } devPyDevAi;
     epicsExportAddress(dset, devPyDevAi);
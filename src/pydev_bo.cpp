@@ -5,135 +5,35 @@
 
 #include <boRecord.h>
 
-#include <alarm.h>
-#include <callback.h>
-#include <cantProceed.h>
-#include <dbScan.h>
-#include <devSup.h>
-#include <epicsExport.h>
-#include <recGbl.h>
-
-#include <map>
-#include <string.h>
-
-#include "asyncexec.h"
-#include "pywrapper.h"
-#include "util.h"
-
-struct PyDevContext {
-    CALLBACK callback;
-    IOSCANPVT scan;
-    int processCbStatus;
-};
-
-static std::map<std::string, IOSCANPVT> ioScanPvts;
-
-static void scanCallback(IOSCANPVT scan)
-{
-#ifdef VERSION_INT
-#  if EPICS_VERSION_INT < VERSION_INT(3,16,0,0)
-    scanIoRequest(scan);
-#  else
-    scanIoImmediate(scan, priorityHigh);
-    scanIoImmediate(scan, priorityMedium);
-    scanIoImmediate(scan, priorityLow);
-#  endif
-#else
-    scanIoRequest(scan);
-#endif
-}
-
-static long initRecord(boRecord* rec)
-{
-    std::string addr = rec->out.value.instio.string;
-    void *buffer = callocMustSucceed(1, sizeof(PyDevContext), "PyDev::initRecord");
-    PyDevContext* ctx = new (buffer) PyDevContext;
-    rec->dpvt = ctx;
-
-    // This could be better checked with regex
-    if (addr.find("pydev.iointr('") == 0 && addr.substr(addr.size()-2) == "')") {
-        std::string param = addr.substr(14, addr.size()-16);
-        auto it = ioScanPvts.find(param);
-        if (it == ioScanPvts.end()) {
-            scanIoInit( &ioScanPvts[param] );
-            PyWrapper::Callback cb = std::bind(scanCallback, ioScanPvts[param]);
-            PyWrapper::registerIoIntr(param, cb);
-            it = ioScanPvts.find(param);
-        }
-        ctx->scan = it->second;
-    } else {
-        ctx->scan = nullptr;
-    }
-
-    return 2;
-}
+#include "devsupport.h"
 
-static long getIointInfo(int /*direction*/, boRecord *rec, IOSCANPVT* io)
-{
-    auto ctx = reinterpret_cast<PyDevContext*>(rec->dpvt);
-    if (ctx != nullptr && ctx->scan != nullptr) {
-        *io = ctx->scan;
-    }
-    return 0;
-}
+#include <epicsExport.h>
 
-static void processRecordCb(boRecord* rec)
-{
-    auto ctx = reinterpret_cast<PyDevContext*>(rec->dpvt);
+struct BoTraits : public DevTraits {
+    using Record = boRecord;
+    static const long initStatus = 2; // Don't convert
 
-    auto fields = Util::getFields(rec->out.value.instio.string);
-    for (auto& keyval: fields) {
-        if      (keyval.first == "VAL")  keyval.second = Util::to_string(rec->val);
-        else if (keyval.first == "RVAL") keyval.second = Util::to_string(rec->rval);
-        else if (keyval.first == "NAME") keyval.second = rec->name;
-        else if (keyval.first == "ZNAM") keyval.second = rec->znam;
-        else if (keyval.first == "ONAM") keyval.second = rec->onam;
-        else if (keyval.first == "TPRO") keyval.second = Util::to_string(rec->tpro);
-    }
-    std::string code = Util::replaceFields(rec->out.value.instio.string, fields);
+    static const char* type() { return "bo"; }
+    static DBLINK& link(boRecord* rec) { return rec->out; }
 
-    try {
+    static bool exec(boRecord* rec, const std::string& code)
+    {
         PyWrapper::exec(code, (rec->tpro == 1), &rec->rval);
-        ctx->processCbStatus = 0;
-    } catch (...) {
-        recGblSetSevr(rec, epicsAlarmCalc, epicsSevInvalid);
-        ctx->processCbStatus = -1;
+        return true;
     }
-    callbackRequestProcessCallback(&ctx->callback, rec->prio, rec);
-}
-
-static long processRecord(boRecord* rec)
-{
-    auto ctx = reinterpret_cast<PyDevContext*>(rec->dpvt);
-    if (ctx == nullptr) {
-        // Keep PACT=1 to prevent further processing
-        rec->pact = 1;
-        recGblSetSevr(rec, epicsAlarmUDF, epicsSevInvalid);
-        return -1;
-    }
-
-    if (rec->pact == 1) {
-        rec->pact = 0;
-        return ctx->processCbStatus;
-    }
-    rec->pact = 1;
-
-    auto scheduled = AsyncExec::schedule([rec]() {
-        processRecordCb(rec);
-    });
-    return (scheduled ? 0 : -1);
-}
+};
+using PyDevBo = DevSupport<BoTraits>;
 
 extern "C"
 {
     struct
     {
         long number{5};
-        DEVSUPFUN report{nullptr};
+        DEVSUPFUN report{(DEVSUPFUN)PyDevBo::report};
         DEVSUPFUN init{nullptr};
-        DEVSUPFUN init_record{(DEVSUPFUN)initRecord};
-        DEVSUPFUN get_ioint_info{(DEVSUPFUN)getIointInfo};
-        DEVSUPFUN write{(DEVSUPFUN)processRecord};
+        DEVSUPFUN init_record{(DEVSUPFUN)PyDevBo::initRecord};
+        DEVSUPFUN get_ioint_info{(DEVSUPFUN)PyDevBo::getIointInfo};
+        DEVSUPFUN write{(DEVSUPFUN)PyDevBo::processRecord};
     } devPyDevBo;
     epicsExportAddress(dset, devPyDevBo);
 
@@ -5,29 +5,14 @@
 
 #include <waveformRecord.h>
 
-#include <alarm.h>
-#include <callback.h>
-#include <cantProceed.h>
-#include <dbScan.h>
-#include <devSup.h>
-#include <epicsExport.h>
 #include <menuFtype.h>
-#include <recGbl.h>
 
-#include <map>
-#include <string.h>
 #include <sstream>
-#include "asyncexec.h"
-#include "pywrapper.h"
-#include "util.h"
+#include <string.h>
 
-struct PyDevContext {
-    CALLBACK callback;
-    IOSCANPVT scan;
-    int processCbStatus;
-};
+#include "devsupport.h"
 
-static std::map<std::string, IOSCANPVT> ioScanPvts;
+#include <epicsExport.h>
 
 template <typename T>
 static bool toRecArrayVal(waveformRecord* rec, const std::vector<T>& arr)
@@ -113,163 +98,78 @@ bool toRecArrayVal<std::string>(waveformRecord* rec, const std::vector<std::stri
     return true;
 }
 
-static void scanCallback(IOSCANPVT scan)
+static std::string valToString(const DBADDR& addr)
 {
-#ifdef VERSION_INT
-#  if EPICS_VERSION_INT < VERSION_INT(3,16,0,0)
-    scanIoRequest(scan);
-#  else
-    scanIoImmediate(scan, priorityHigh);
-    scanIoImmediate(scan, priorityMedium);
-    scanIoImmediate(scan, priorityLow);
-#  endif
-#else
-    scanIoRequest(scan);
-#endif
-}
-
-static long initRecord(waveformRecord* rec)
-{
-    std::string addr = rec->inp.value.instio.string;
-    void *buffer = callocMustSucceed(1, sizeof(PyDevContext), "PyDev::initRecord");
-    PyDevContext* ctx = new (buffer) PyDevContext;
-    rec->dpvt = ctx;
-
-    // This could be better checked with regex
-    if (addr.find("pydev.iointr('") == 0 && addr.substr(addr.size()-2) == "')") {
-        std::string param = addr.substr(14, addr.size()-16);
-        auto it = ioScanPvts.find(param);
-        if (it == ioScanPvts.end()) {
-            scanIoInit( &ioScanPvts[param] );
-            PyWrapper::Callback cb = std::bind(scanCallback, ioScanPvts[param]);
-            PyWrapper::registerIoIntr(param, cb);
-            it = ioScanPvts.find(param);
+    auto rec = reinterpret_cast<waveformRecord*>(addr.precord);
+    switch (rec->ftvl) {
+    case menuFtypeCHAR:   return Util::to_pylist_string( reinterpret_cast<   epicsInt8*>(rec->bptr), rec->nelm );
+    case menuFtypeUCHAR:  return Util::to_pylist_string( reinterpret_cast<  epicsUInt8*>(rec->bptr), rec->nelm );
+    case menuFtypeSHORT:  return Util::to_pylist_string( reinterpret_cast<  epicsInt16*>(rec->bptr), rec->nelm );
+    case menuFtypeUSHORT: return Util::to_pylist_string( reinterpret_cast< epicsUInt16*>(rec->bptr), rec->nelm );
+    case menuFtypeLONG:   return Util::to_pylist_string( reinterpret_cast<  epicsInt32*>(rec->bptr), rec->nelm );
+    case menuFtypeULONG:  return Util::to_pylist_string( reinterpret_cast< epicsUInt32*>(rec->bptr), rec->nelm );
+    case menuFtypeFLOAT:  return Util::to_pylist_string( reinterpret_cast<epicsFloat32*>(rec->bptr), rec->nelm );
+    case menuFtypeDOUBLE: return Util::to_pylist_string( reinterpret_cast<epicsFloat64*>(rec->bptr), rec->nelm );
+    case menuFtypeSTRING: {
+        std::vector<std::string> arr;
+        auto val = reinterpret_cast<const char*>(rec->bptr);
+        for (size_t i = 0; i < rec->nord; ++i) {
+            const char *cptr = &val[i * MAX_STRING_SIZE];
+            arr.push_back("'" + Util::escape(std::string(cptr, strnlen(cptr, MAX_STRING_SIZE))) + "'");
         }
-        ctx->scan = it->second;
-    } else {
-        ctx->scan = nullptr;
-    }
-
-    return 0;
-}
-
-static long getIointInfo(int /*direction*/, waveformRecord *rec, IOSCANPVT* io)
-{
-    auto ctx = reinterpret_cast<PyDevContext*>(rec->dpvt);
-    if (ctx != nullptr && ctx->scan != nullptr) {
-        *io = ctx->scan;
-    }
-    return 0;
-}
-
-
-std::string arrayOfStrToStr(const std::vector<std::string>& val)
-{
-    std::string value = "[";
-    for (const auto& v: val) {
-        value += "b\"" +  Util::escape(v) + "\",";
+        return Util::to_pylist_string(arr);
     }
-    if (value.back() == ',') {
-        value.back() = ']';
-    } else {
-        value += "]";
+    default:
+        return "VAL";
     }
-    return value;
 }
 
-static void processRecordCb(waveformRecord* rec)
-{
-    auto ctx = reinterpret_cast<PyDevContext*>(rec->dpvt);
+struct WaveformTraits : public DevTraits {
+    using Record = waveformRecord;
+    static const bool groups = true;
 
-    auto fields = Util::getFields(rec->inp.value.instio.string);
-    for (auto& keyval: fields) {
-        if (keyval.first == "VAL") {
+    static const char* type() { return "waveform"; }
+    static DBLINK& link(waveformRecord* rec) { return rec->inp; }
 
-            if      (rec->ftvl == menuFtypeCHAR)   keyval.second = Util::to_pylist_string( reinterpret_cast<   epicsInt8*>(rec->bptr), rec->nelm );
-            else if (rec->ftvl == menuFtypeUCHAR)  keyval.second = Util::to_pylist_string( reinterpret_cast<  epicsUInt8*>(rec->bptr), rec->nelm );
-            else if (rec->ftvl == menuFtypeSHORT)  keyval.second = Util::to_pylist_string( reinterpret_cast<  epicsInt16*>(rec->bptr), rec->nelm );
-            else if (rec->ftvl == menuFtypeUSHORT) keyval.second = Util::to_pylist_string( reinterpret_cast< epicsUInt16*>(rec->bptr), rec->nelm );
-            else if (rec->ftvl == menuFtypeLONG)   keyval.second = Util::to_pylist_string( reinterpret_cast<  epicsInt32*>(rec->bptr), rec->nelm );
-            else if (rec->ftvl == menuFtypeULONG)  keyval.second = Util::to_pylist_string( reinterpret_cast< epicsUInt32*>(rec->bptr), rec->nelm );
-            else if (rec->ftvl == menuFtypeFLOAT)  keyval.second = Util::to_pylist_string( reinterpret_cast<epicsFloat32*>(rec->bptr), rec->nelm );
-            else if (rec->ftvl == menuFtypeDOUBLE) keyval.second = Util::to_pylist_string( reinterpret_cast<epicsFloat64*>(rec->bptr), rec->nelm );
-            else if (rec->ftvl == menuFtypeSTRING) keyval.second = Util::to_pylist_string( reinterpret_cast<epicsFloat64*>(rec->bptr), rec->nelm );
-            else if (rec->ftvl == menuFtypeSTRING) {
-                std::vector<std::string> arr;
-                arr.resize(rec->nord);
-                auto val = reinterpret_cast<char*>(rec->bptr);
-                for(size_t i=0; i<rec->nord; ++i){
-                    const char *cptr = &val[i * MAX_STRING_SIZE];
-                    arr[i] = std::string(cptr, 0, MAX_STRING_SIZE);
-                }
-                keyval.second = Util::to_pylist_string(arr);
-            }
-        }
-        else if (keyval.first == "TPRO") keyval.second = Util::to_string(rec->tpro);
+    static const RecordFields::Overrides& overrides()
+    {
+        static const RecordFields::Overrides overrides = {
+            { "VAL", valToString },
+        };
+        return overrides;
     }
-    std::string code = Util::replaceFields(rec->inp.value.instio.string, fields);
 
-    try {
-        bool ret;
+    static bool store(waveformRecord* rec, const PyWrapper::MultiTypeValue& value)
+    {
         if (rec->ftvl == menuFtypeFLOAT || rec->ftvl == menuFtypeDOUBLE) {
             std::vector<double> arr;
-            ret = (PyWrapper::exec(code, (rec->tpro == 1), arr) && toRecArrayVal(rec, arr));
+            return (PyWrapper::convert(value, arr) && toRecArrayVal(rec, arr));
         } else if (rec->ftvl == menuFtypeSTRING) {
             std::vector<std::string> arr;
-            ret = (PyWrapper::exec(code, (rec->tpro == 1), arr) && toRecArrayVal(rec, arr));
+            return (PyWrapper::convert(value, arr) && toRecArrayVal(rec, arr));
         } else {
             std::vector<long> arr;
-            ret = (PyWrapper::exec(code, (rec->tpro == 1), arr) && toRecArrayVal(rec, arr));
-        }
-
-        if (ret == true) {
-            ctx->processCbStatus = 0;
-        } else {
-            if (rec->tpro == 1) {
-                printf("ERROR: Can't convert returned Python type to record type\n");
-            }
-            recGblSetSevr(rec, epicsAlarmCalc, epicsSevInvalid);
-            ctx->processCbStatus = -1;
+            return (PyWrapper::convert(value, arr) && toRecArrayVal(rec, arr));
         }
-    } catch (...) {
-        recGblSetSevr(rec, epicsAlarmCalc, epicsSevInvalid);
-        ctx->processCbStatus = -1;
-    }
-    callbackRequestProcessCallback(&ctx->callback, rec->prio, rec);
-}
-
-static long processRecord(waveformRecord* rec)
-{
-    auto ctx = reinterpret_cast<PyDevContext*>(rec->dpvt);
-    if (ctx == nullptr) {
-        // Keep PACT=1 to prevent further processing
-        rec->pact = 1;
-        recGblSetSevr(rec, epicsAlarmUDF, epicsSevInvalid);
-        return -1;
     }
 
-    if (rec->pact == 1) {
-        rec->pact = 0;
-        return ctx->processCbStatus;
+    static bool exec(waveformRecord* rec, const std::string& code)
+    {
+        return store(rec, PyWrapper::exec(code, (rec->tpro == 1)));
     }
-    rec->pact = 1;
-
-    auto scheduled = AsyncExec::schedule([rec]() {
-        processRecordCb(rec);
-    });
-    return (scheduled ? 0 : -1);
-}
+};
+using PyDevWaveform = DevSupport<WaveformTraits>;
 
 extern "C"
 {
     struct
     {
         long number{5};
-        DEVSUPFUN report{nullptr};
+        DEVSUPFUN report{(DEVSUPFUN)PyDevWaveform::report};
         DEVSUPFUN init{nullptr};
-        DEVSUPFUN init_record{(DEVSUPFUN)initRecord};
-        DEVSUPFUN get_ioint_info{(DEVSUPFUN)getIointInfo};
-        DEVSUPFUN write{(DEVSUPFUN)processRecord};
+        DEVSUPFUN init_record{(DEVSUPFUN)PyDevWaveform::initRecord};
+        DEVSUPFUN get_ioint_info{(DEVSUPFUN)PyDevWaveform::getIointInfo};
+        DEVSUPFUN write{(DEVSUPFUN)PyDevWaveform::processRecord};
     } devPyDevWaveform;
     epicsExportAddress(dset, devPyDevWaveform);
 
@@ -3,19 +3,67 @@
 * in file LICENSE that is included with this distribution.
 \*************************************************************************/
 
+#include "asyncexec.h"
+#include "gilstats.h"
+#include "latency.h"
 #include "pywrapper.h"
+#include "memstats.h"
+#include "profiler.h"
+#include "slowexec.h"
+#include "subscriptions.h"
+#include "tracer.h"
 #include "util.h"
 
 #include <Python.h>
+#include <marshal.h>
 
+#include <dbAccess.h>
+#include <epicsVersion.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <map>
 #include <stdexcept>
+#include <unordered_map>
 #include <iostream>
+#include <vector>
+
+#ifdef VERSION_INT
+#  if EPICS_VERSION_INT >= VERSION_INT(3,16,0,2)
+#    define HAVE_EPICS_INT64
+#  endif
+#endif
+
+#if PY_MAJOR_VERSION < 3
+#  define PYCODE_CAST(code) reinterpret_cast<PyCodeObject*>(code)
+#else
+#  define PYCODE_CAST(code) (code)
+#endif
 
 static PyObject* globDict = nullptr;
 static PyObject* locDict = nullptr;
+static PyObject* handleCache = nullptr;
 static PyThreadState* mainThread = nullptr;
-static std::map<std::string, std::pair<PyWrapper::Callback, PyObject*>> params;
+struct IoIntrParam {
+    PyWrapper::Callback callback;
+    PyObject* value{nullptr};
+    std::atomic<unsigned long long> notifications{0};
+};
+static std::map<std::string, IoIntrParam> params;
+static std::atomic<unsigned long long> handleCacheHits{0};
+static std::atomic<unsigned long long> handleCacheMisses{0};
+/**
+ * Code compiled ahead of execution, only accessed with GIL held.
+ */
+struct CompiledCode {
+    PyObject* code;
+    bool expression;
+};
+static std::unordered_map<std::string, CompiledCode> codeCache;
+static std::atomic<unsigned long long> codeCacheHits{0};
+static std::atomic<unsigned long long> codeCacheSize{0};
 
 /**
  * Function for caching parameter value or notifying record of new value.
@@ -66,34 +114,664 @@ static PyObject* pydev_iointr(PyObject* self, PyObject* args)
     auto it = params.find(name);
     if (value) {
         if (it != params.end()) {
-            if (it->second.second) {
-                Py_DecRef(it->second.second);
+            if (it->second.value) {
+                Py_DecRef(it->second.value);
             }
             Py_IncRef(value);
-            it->second.second = value;
+            it->second.value = value;
 
-            it->second.first();
+            it->second.notifications.fetch_add(1, std::memory_order_relaxed);
+            // Processing locks records, which scan threads may hold while waiting for GIL
+            auto callback = it->second.callback;
+            Py_BEGIN_ALLOW_THREADS
+            callback();
+            Py_END_ALLOW_THREADS
         }
         Py_RETURN_TRUE;
     }
 
-    if (it != params.end() && it->second.second != nullptr) {
-        Py_IncRef(it->second.second);
-        return it->second.second;
+    if (it != params.end() && it->second.value != nullptr) {
+        Py_IncRef(it->second.value);
+        return it->second.value;
     }
     Py_RETURN_NONE;
 }
 
+/**
+ * Python object holding a resolved database address.
+ *
+ * Resolving PV name to DBADDR is relatively expensive, handles are therefore
+ * cached by name and reused by all subsequent pydev.get() and pydev.put()
+ * calls for the same PV.
+ */
+struct PyDevHandle {
+    PyObject_HEAD
+    PyObject* name;
+    DBADDR addr;
+};
+static PyTypeObject handleType = { PyVarObject_HEAD_INIT(NULL, 0) };
+
+static bool toStdString(PyObject* obj, std::string& str)
+{
+    if (PyUnicode_Check(obj)) {
+        PyObject* tmp = PyUnicode_AsASCIIString(obj);
+        if (tmp == nullptr) {
+            return false;
+        }
+        str = PyBytes_AsString(tmp);
+        Py_DecRef(tmp);
+        return true;
+    }
+    if (PyBytes_Check(obj)) {
+        str = PyBytes_AsString(obj);
+        return true;
+    }
+    PyErr_SetString(PyExc_TypeError, "Expecting string");
+    return false;
+}
+
+static PyObject* dbValueToPy(short type, const void* val)
+{
+    switch (type) {
+    case DBR_STRING: return PyUnicode_FromString(reinterpret_cast<const char*>(val));
+    case DBR_CHAR:   return PyLong_FromLong(*reinterpret_cast<const epicsInt8*>(val));
+    case DBR_UCHAR:  return PyLong_FromLong(*reinterpret_cast<const epicsUInt8*>(val));
+    case DBR_SHORT:  return PyLong_FromLong(*reinterpret_cast<const epicsInt16*>(val));
+    case DBR_USHORT: return PyLong_FromLong(*reinterpret_cast<const epicsUInt16*>(val));
+    case DBR_ENUM:   return PyLong_FromLong(*reinterpret_cast<const epicsEnum16*>(val));
+    case DBR_LONG:   return PyLong_FromLong(*reinterpret_cast<const epicsInt32*>(val));
+    case DBR_ULONG:  return PyLong_FromUnsignedLong(*reinterpret_cast<const epicsUInt32*>(val));
+#ifdef HAVE_EPICS_INT64
+    case DBR_INT64:  return PyLong_FromLongLong(*reinterpret_cast<const epicsInt64*>(val));
+    case DBR_UINT64: return PyLong_FromUnsignedLongLong(*reinterpret_cast<const epicsUInt64*>(val));
+#endif
+    case DBR_FLOAT:  return PyFloat_FromDouble(*reinterpret_cast<const epicsFloat32*>(val));
+    case DBR_DOUBLE: return PyFloat_FromDouble(*reinterpret_cast<const epicsFloat64*>(val));
+    default:
+        PyErr_Format(PyExc_TypeError, "Unsupported database type %d", type);
+        return nullptr;
+    }
+}
+
+/**
+ * Return struct module format character matching database type.
+ */
+static const char* dbTypeToFormat(short type)
+{
+    switch (type) {
+    case DBR_CHAR:   return "b";
+    case DBR_UCHAR:  return "B";
+    case DBR_SHORT:  return "h";
+    case DBR_USHORT: return "H";
+    case DBR_ENUM:   return "H";
+    case DBR_LONG:   return (sizeof(int) == 4 ? "i" : "l");
+    case DBR_ULONG:  return (sizeof(int) == 4 ? "I" : "L");
+#ifdef HAVE_EPICS_INT64
+    case DBR_INT64:  return "q";
+    case DBR_UINT64: return "Q";
+#endif
+    case DBR_FLOAT:  return "f";
+    case DBR_DOUBLE: return "d";
+    default:         return nullptr;
+    }
+}
+
+/**
+ * Return database type matching Py_buffer format, or -1 if not supported.
+ */
+static short formatToDbType(const char* format, Py_ssize_t itemsize)
+{
+    if (format == nullptr) {
+        return DBR_UCHAR;
+    }
+    // Only native byte order is supported
+    if (*format == '@' || *format == '=') {
+        format++;
+    }
+    if (strlen(format) != 1) {
+        return -1;
+    }
+
+    switch (*format) {
+    case 'b': case 'h': case 'i': case 'l': case 'q':
+        if (itemsize == 1) return DBR_CHAR;
+        if (itemsize == 2) return DBR_SHORT;
+        if (itemsize == 4) return DBR_LONG;
+#ifdef HAVE_EPICS_INT64
+        if (itemsize == 8) return DBR_INT64;
+#endif
+        return -1;
+    case '?': case 'B': case 'H': case 'I': case 'L': case 'Q':
+        if (itemsize == 1) return DBR_UCHAR;
+        if (itemsize == 2) return DBR_USHORT;
+        if (itemsize == 4) return DBR_ULONG;
+#ifdef HAVE_EPICS_INT64
+        if (itemsize == 8) return DBR_UINT64;
+#endif
+        return -1;
+    case 'f':
+        return DBR_FLOAT;
+    case 'd':
+        return DBR_DOUBLE;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * Turn array of database values into Python object.
+ *
+ * Numeric arrays are returned as typed memoryview objects which support
+ * buffer protocol and can be passed to numpy.frombuffer() and similar
+ * without further conversion. Arrays of strings are returned as lists.
+ */
+static PyObject* dbArrayToPy(short type, const char* buffer, long nElements)
+{
+    const char* format = dbTypeToFormat(type);
+#if PY_MAJOR_VERSION >= 3
+    if (format != nullptr) {
+        PyObject* bytes = PyBytes_FromStringAndSize(buffer, nElements * dbValueSize(type));
+        if (bytes == nullptr) {
+            return nullptr;
+        }
+        PyObject* view = PyMemoryView_FromObject(bytes);
+        Py_DecRef(bytes);
+        if (view == nullptr) {
+            return nullptr;
+        }
+        PyObject* arr = PyObject_CallMethod(view, const_cast<char*>("cast"), const_cast<char*>("s"), format);
+        Py_DecRef(view);
+        return arr;
+    }
+#endif
+
+    PyObject* list = PyList_New(nElements);
+    if (list == nullptr) {
+        return nullptr;
+    }
+    for (long i = 0; i < nElements; i++) {
+        PyObject* el = dbValueToPy(type, buffer + i*dbValueSize(type));
+        if (el == nullptr) {
+            Py_DecRef(list);
+            return nullptr;
+        }
+        PyList_SET_ITEM(list, i, el);
+    }
+    return list;
+}
+
+static PyDevHandle* getHandle(PyObject* name)
+{
+    PyObject* handle = PyDict_GetItem(handleCache, name);
+    if (handle != nullptr) {
+        handleCacheHits.fetch_add(1, std::memory_order_relaxed);
+        Py_IncRef(handle);
+        return reinterpret_cast<PyDevHandle*>(handle);
+    }
+    handleCacheMisses.fetch_add(1, std::memory_order_relaxed);
+
+    std::string pvname;
+    if (!toStdString(name, pvname)) {
+        return nullptr;
+    }
+
+    DBADDR addr;
+    if (dbNameToAddr(pvname.c_str(), &addr) != 0) {
+        PyErr_Format(PyExc_ValueError, "PV '%s' not found", pvname.c_str());
+        return nullptr;
+    }
+
+    auto h = PyObject_New(PyDevHandle, &handleType);
+    if (h == nullptr) {
+        return nullptr;
+    }
+    Py_IncRef(name);
+    h->name = name;
+    h->addr = addr;
+    if (PyDict_SetItem(handleCache, name, reinterpret_cast<PyObject*>(h)) != 0) {
+        Py_DecRef(reinterpret_cast<PyObject*>(h));
+        return nullptr;
+    }
+    return h;
+}
+
+static PyObject* handleGet(PyDevHandle* h)
+{
+    short type = h->addr.dbr_field_type;
+    if (dbTypeToFormat(type) == nullptr && type != DBR_STRING) {
+        PyErr_Format(PyExc_TypeError, "Unsupported database type %d", type);
+        return nullptr;
+    }
+
+    long nElements = h->addr.no_elements;
+    long options = 0;
+    std::vector<char> buffer(nElements * dbValueSize(type));
+    long status;
+
+    // Record may be locked by the scan thread, don't block Python meanwhile
+    Py_BEGIN_ALLOW_THREADS
+    status = dbGetField(&h->addr, type, buffer.data(), &options, &nElements, nullptr);
+    Py_END_ALLOW_THREADS
+
+    if (status != 0) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to get PV value");
+        return nullptr;
+    }
+    if (h->addr.no_elements == 1) {
+        return dbValueToPy(type, buffer.data());
+    }
+    return dbArrayToPy(type, buffer.data(), nElements);
+}
+
+/**
+ * Convert Python integer for a put to field of given type.
+ *
+ * Values within epicsInt32 range are put as DBR_LONG, larger ones only to
+ * fields that can hold them. OverflowError is raised rather than losing
+ * precision otherwise.
+ */
+static bool integerToDb(PyObject* value, short fieldType, std::vector<char>& buffer, short& type)
+{
+    int overflow = 0;
+    long long l = PyLong_AsLongLongAndOverflow(value, &overflow);
+    if (l == -1 && PyErr_Occurred()) {
+        return false;
+    }
+
+    if (overflow == 0 && l >= INT32_MIN && l <= INT32_MAX) {
+        epicsInt32 val = l;
+        buffer.assign(reinterpret_cast<char*>(&val), reinterpret_cast<char*>(&val) + sizeof(val));
+        type = DBR_LONG;
+        return true;
+    }
+
+    switch (fieldType) {
+    case DBF_FLOAT:
+    case DBF_DOUBLE: {
+        // Field is floating point, its precision applies anyway
+        epicsFloat64 val = PyLong_AsDouble(value);
+        if (val == -1.0 && PyErr_Occurred()) {
+            return false;
+        }
+        buffer.assign(reinterpret_cast<char*>(&val), reinterpret_cast<char*>(&val) + sizeof(val));
+        type = DBR_DOUBLE;
+        return true;
+    }
+    case DBF_ULONG:
+        if (overflow == 0 && l >= 0 && l <= UINT32_MAX) {
+            epicsUInt32 val = l;
+            buffer.assign(reinterpret_cast<char*>(&val), reinterpret_cast<char*>(&val) + sizeof(val));
+            type = DBR_ULONG;
+            return true;
+        }
+        break;
+#ifdef HAVE_EPICS_INT64
+    case DBF_STRING:
+    case DBF_INT64:
+        if (overflow == 0) {
+            epicsInt64 val = l;
+            buffer.assign(reinterpret_cast<char*>(&val), reinterpret_cast<char*>(&val) + sizeof(val));
+            type = DBR_INT64;
+            return true;
+        }
+        break;
+    case DBF_UINT64: {
+        unsigned long long u = PyLong_AsUnsignedLongLong(value);
+        if (u == static_cast<unsigned long long>(-1) && PyErr_Occurred()) {
+            return false;
+        }
+        epicsUInt64 val = u;
+        buffer.assign(reinterpret_cast<char*>(&val), reinterpret_cast<char*>(&val) + sizeof(val));
+        type = DBR_UINT64;
+        return true;
+    }
+#endif
+    default:
+        break;
+    }
+
+    PyErr_SetString(PyExc_OverflowError, "Integer out of range of PV type");
+    return false;
+}
+
+static PyObject* handlePut(PyDevHandle* h, PyObject* value)
+{
+    std::vector<char> buffer;
+    long nElements = 1;
+    short type;
+
+    if (PyUnicode_Check(value) || PyBytes_Check(value)) {
+        std::string str;
+        if (!toStdString(value, str)) {
+            return nullptr;
+        }
+        buffer.resize(MAX_STRING_SIZE, 0);
+        strncpy(buffer.data(), str.c_str(), MAX_STRING_SIZE - 1);
+        type = DBR_STRING;
+    } else if (PyFloat_Check(value)) {
+        epicsFloat64 val = PyFloat_AsDouble(value);
+        buffer.assign(reinterpret_cast<char*>(&val), reinterpret_cast<char*>(&val) + sizeof(val));
+        type = DBR_DOUBLE;
+    } else if (PyLong_Check(value) || PyBool_Check(value)
+#if PY_MAJOR_VERSION < 3
+               || PyInt_Check(value)
+#endif
+    ) {
+        if (!integerToDb(value, h->addr.field_type, buffer, type)) {
+            return nullptr;
+        }
+    } else if (PyObject_CheckBuffer(value)) {
+        Py_buffer view;
+        if (PyObject_GetBuffer(value, &view, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) != 0) {
+            return nullptr;
+        }
+        type = formatToDbType(view.format, view.itemsize);
+        if (type == -1) {
+            PyBuffer_Release(&view);
+            PyErr_SetString(PyExc_TypeError, "Unsupported buffer format");
+            return nullptr;
+        }
+        nElements = view.len / view.itemsize;
+
+        long status;
+        Py_BEGIN_ALLOW_THREADS
+        status = dbPutField(&h->addr, type, view.buf, nElements);
+        Py_END_ALLOW_THREADS
+        PyBuffer_Release(&view);
+
+        if (status != 0) {
+            PyErr_SetString(PyExc_RuntimeError, "Failed to put PV value");
+            return nullptr;
+        }
+        Py_RETURN_NONE;
+    } else if (PySequence_Check(value)) {
+        PyObject* seq = PySequence_Fast(value, "Expecting sequence");
+        if (seq == nullptr) {
+            return nullptr;
+        }
+        nElements = PySequence_Fast_GET_SIZE(seq);
+        bool strings = (nElements > 0);
+        for (long i = 0; i < nElements && strings; i++) {
+            PyObject* el = PySequence_Fast_GET_ITEM(seq, i);
+            strings = (PyUnicode_Check(el) || PyBytes_Check(el));
+        }
+
+        type = (strings ? DBR_STRING : DBR_DOUBLE);
+        buffer.resize(nElements * dbValueSize(type), 0);
+        for (long i = 0; i < nElements; i++) {
+            PyObject* el = PySequence_Fast_GET_ITEM(seq, i);
+            if (strings) {
+                std::string str;
+                if (!toStdString(el, str)) {
+                    Py_DecRef(seq);
+                    return nullptr;
+                }
+                strncpy(&buffer[i*MAX_STRING_SIZE], str.c_str(), MAX_STRING_SIZE - 1);
+            } else {
+                epicsFloat64 val = PyFloat_AsDouble(el);
+                if (val == -1.0 && PyErr_Occurred()) {
+                    Py_DecRef(seq);
+                    return nullptr;
+                }
+                memcpy(&buffer[i*sizeof(val)], &val, sizeof(val));
+            }
+        }
+        Py_DecRef(seq);
+    } else {
+        PyErr_SetString(PyExc_TypeError, "Unsupported value type");
+        return nullptr;
+    }
+
+    long status;
+    Py_BEGIN_ALLOW_THREADS
+    status = dbPutField(&h->addr, type, buffer.data(), nElements);
+    Py_END_ALLOW_THREADS
+
+    if (status != 0) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to put PV value");
+        return nullptr;
+    }
+    Py_RETURN_NONE;
+}
+
+static void handleDealloc(PyObject* self)
+{
+    auto h = reinterpret_cast<PyDevHandle*>(self);
+    Py_DecRef(h->name);
+    PyObject_Del(self);
+}
+
+static PyObject* handleRepr(PyObject* self)
+{
+    auto h = reinterpret_cast<PyDevHandle*>(self);
+    std::string name;
+    if (!toStdString(h->name, name)) {
+        return nullptr;
+    }
+    return PyUnicode_FromFormat("pydev.Handle('%s')", name.c_str());
+}
+
+static PyObject* handle_get(PyObject* self, PyObject* /*args*/)
+{
+    return handleGet(reinterpret_cast<PyDevHandle*>(self));
+}
+
+static PyObject* handle_put(PyObject* self, PyObject* value)
+{
+    return handlePut(reinterpret_cast<PyDevHandle*>(self), value);
+}
+
+static struct PyMethodDef handleMethods[] = {
+    { "get", handle_get, METH_NOARGS, "Get PV value" },
+    { "put", handle_put, METH_O, "Put value to PV" },
+    /* sentinel */
+    { NULL, NULL, 0, NULL }
+};
+
+/**
+ * Return cached handle for the given PV name.
+ */
+static PyObject* pydev_handle(PyObject* self, PyObject* name)
+{
+    return reinterpret_cast<PyObject*>(getHandle(name));
+}
+
+/**
+ * Read PV value from local database.
+ *
+ * Scalar values are returned as Python int, float or string, arrays
+ * of numbers as memoryview objects.
+ */
+static PyObject* pydev_get(PyObject* self, PyObject* name)
+{
+    auto h = getHandle(name);
+    if (h == nullptr) {
+        return nullptr;
+    }
+    PyObject* value = handleGet(h);
+    Py_DecRef(reinterpret_cast<PyObject*>(h));
+    return value;
+}
+
+/**
+ * Write value to PV in local database, processing record if needed.
+ *
+ * Any object supporting buffer protocol, ie. numpy array, is passed to
+ * the database without intermediate conversion.
+ */
+static PyObject* pydev_put(PyObject* self, PyObject* args)
+{
+    PyObject* name;
+    PyObject* value;
+    if (!PyArg_UnpackTuple(args, "pydev.put", 2, 2, &name, &value)) {
+        return nullptr;
+    }
+    auto h = getHandle(name);
+    if (h == nullptr) {
+        return nullptr;
+    }
+    PyObject* ret = handlePut(h, value);
+    Py_DecRef(reinterpret_cast<PyObject*>(h));
+    return ret;
+}
+
+/**
+ * Subscribe to value changes of a PV in local database.
+ *
+ * Callback is invoked with PV name and new value as arguments from
+ * a dedicated thread. When PV changes faster than callbacks can be
+ * processed, intermediate values are dropped and only the latest value
+ * is delivered. Returns subscription id to be used with unsubscribe.
+ */
+static PyObject* pydev_subscribe(PyObject* self, PyObject* args)
+{
+    PyObject* name;
+    PyObject* callback;
+    unsigned int mask = DBE_VALUE | DBE_ALARM;
+    if (!PyArg_ParseTuple(args, "OO|I", &name, &callback, &mask)) {
+        return nullptr;
+    }
+    if (!PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "Callback is not callable");
+        return nullptr;
+    }
+
+    std::string pvname;
+    if (!toStdString(name, pvname)) {
+        return nullptr;
+    }
+
+    // Released by the dispatcher once subscription is removed
+    PyObject* ctx = PyTuple_Pack(2, name, callback);
+    if (ctx == nullptr) {
+        return nullptr;
+    }
+
+    // Posting the current value locks the record, don't block Python meanwhile
+    long id;
+    Py_BEGIN_ALLOW_THREADS
+    id = Subscriptions::add(pvname, mask, ctx);
+    Py_END_ALLOW_THREADS
+    if (id < 0) {
+        Py_DecRef(ctx);
+        PyErr_Format(PyExc_ValueError, "Failed to subscribe to PV '%s'", pvname.c_str());
+        return nullptr;
+    }
+    return PyLong_FromLong(id);
+}
+
+static PyObject* pydev_unsubscribe(PyObject* self, PyObject* arg)
+{
+    long id = PyLong_AsLong(arg);
+    if (id == -1 && PyErr_Occurred()) {
+        return nullptr;
+    }
+    bool removed;
+    Py_BEGIN_ALLOW_THREADS
+    removed = Subscriptions::remove(id);
+    Py_END_ALLOW_THREADS
+    if (removed) {
+        Py_RETURN_TRUE;
+    }
+    Py_RETURN_FALSE;
+}
+
+/**
+ * Return GIL contention statistics as a dictionary.
+ *
+ * Per-thread times are in seconds, sampler counters tell how many
+ * probes found GIL held by PyDevice threads and by other threads.
+ */
+static PyObject* pydev_gil_stats(PyObject* self, PyObject* args)
+{
+    int reset = 0;
+    if (!PyArg_ParseTuple(args, "|i", &reset)) {
+        return nullptr;
+    }
+
+    auto report = GilStats::get(reset != 0);
+
+    PyObject* threads = PyDict_New();
+    if (threads == nullptr) {
+        return nullptr;
+    }
+    for (auto& t: report.threads) {
+        PyObject* stats = Py_BuildValue("{s:K,s:d,s:d,s:d}",
+                                        "acquisitions", (unsigned long long)t.acquisitions,
+                                        "wait", 1e-9 * t.waitNs,
+                                        "max_wait", 1e-9 * t.maxWaitNs,
+                                        "hold", 1e-9 * t.holdNs);
+        if (stats == nullptr || PyDict_SetItemString(threads, t.name.c_str(), stats) != 0) {
+            Py_XDECREF(stats);
+            Py_DecRef(threads);
+            return nullptr;
+        }
+        Py_DecRef(stats);
+    }
+
+    return Py_BuildValue("{s:N,s:K,s:K,s:K}",
+                         "threads", threads,
+                         "samples", (unsigned long long)report.samples,
+                         "held_by_pydev", (unsigned long long)report.heldByPydev,
+                         "held_by_others", (unsigned long long)report.heldByOthers);
+}
+
+/**
+ * Return number of slow executions of a record, or all records.
+ */
+static PyObject* pydev_slow_count(PyObject* self, PyObject* args)
+{
+    const char* record = "";
+    if (!PyArg_ParseTuple(args, "|s", &record)) {
+        return nullptr;
+    }
+    return PyLong_FromUnsignedLongLong(SlowExec::count(record));
+}
+
 static struct PyMethodDef methods[] = {
     { "iointr", pydev_iointr, METH_VARARGS, "PyDevice interface for parameters exchange"},
+    { "handle", pydev_handle, METH_O, "Get cached handle for PV"},
+    { "get", pydev_get, METH_O, "Get PV value from local database"},
+    { "put", pydev_put, METH_VARARGS, "Put value to PV in local database"},
+    { "subscribe", pydev_subscribe, METH_VARARGS, "Subscribe to PV value changes"},
+    { "unsubscribe", pydev_unsubscribe, METH_O, "Cancel PV subscription"},
+    { "gil_stats", pydev_gil_stats, METH_VARARGS, "Get GIL contention statistics"},
+    { "slow_count", pydev_slow_count, METH_VARARGS, "Get number of slow executions"},
     /* sentinel */
     { NULL, NULL, 0, NULL }
 };
 
+static void addConstants(PyObject* m)
+{
+    PyModule_AddIntConstant(m, "DBE_VALUE", DBE_VALUE);
+    PyModule_AddIntConstant(m, "DBE_LOG", DBE_LOG);
+    PyModule_AddIntConstant(m, "DBE_ALARM", DBE_ALARM);
+    PyModule_AddIntConstant(m, "DBE_PROPERTY", DBE_PROPERTY);
+}
+
+static bool initHandleType()
+{
+    handleType.tp_name = "pydev.Handle";
+    handleType.tp_basicsize = sizeof(PyDevHandle);
+    handleType.tp_flags = Py_TPFLAGS_DEFAULT;
+    handleType.tp_doc = "Resolved PV handle";
+    handleType.tp_dealloc = handleDealloc;
+    handleType.tp_repr = handleRepr;
+    handleType.tp_methods = handleMethods;
+    return (PyType_Ready(&handleType) == 0);
+}
+
 #if PY_MAJOR_VERSION < 3
 static void PyInit_pydev(void)
 {
-    Py_InitModule("pydev", methods);
+    PyObject* m = Py_InitModule("pydev", methods);
+    if (m != nullptr) {
+        addConstants(m);
+    }
+    if (m != nullptr && initHandleType()) {
+        Py_IncRef(reinterpret_cast<PyObject*>(&handleType));
+        PyModule_AddObject(m, "Handle", reinterpret_cast<PyObject*>(&handleType));
+    }
 }
 #else
 static struct PyModuleDef moddef = {
@@ -101,10 +779,74 @@ static struct PyModuleDef moddef = {
 };
 static PyObject* PyInit_pydev(void)
 {
-    return PyModule_Create(&moddef);
+    PyObject* m = PyModule_Create(&moddef);
+    if (m != nullptr) {
+        addConstants(m);
+    }
+    if (m != nullptr && initHandleType()) {
+        Py_IncRef(reinterpret_cast<PyObject*>(&handleType));
+        PyModule_AddObject(m, "Handle", reinterpret_cast<PyObject*>(&handleType));
+    }
+    return m;
 }
 #endif
 
+struct PyGIL {
+    PyGILState_STATE state;
+    uint64_t acquired;
+    PyGIL() {
+        auto requested = GilStats::now();
+        AsyncExec::setState(AsyncExec::State::WAITING_GIL);
+        Tracer::event(Tracer::GIL_WAIT_BEGIN);
+        state = PyGILState_Ensure();
+        Tracer::event(Tracer::GIL_WAIT_END);
+        Tracer::event(Tracer::GIL_HELD_BEGIN);
+        AsyncExec::setState(AsyncExec::State::EXECUTING);
+        acquired = GilStats::acquired(requested);
+    }
+    ~PyGIL() {
+        GilStats::released(acquired);
+        Tracer::event(Tracer::GIL_HELD_END);
+        PyGILState_Release(state);
+    }
+};
+
+/**
+ * Invoke Python callbacks for all pending subscription updates.
+ *
+ * The whole batch is processed with a single GIL acquisition.
+ */
+static void dispatchUpdates(std::vector<Subscriptions::Update>& updates, std::vector<void*>& released)
+{
+    PyGIL gil;
+
+    for (auto& update: updates) {
+        auto ctx = reinterpret_cast<PyObject*>(update.ctx);
+        PyObject* value;
+        if (update.array) {
+            value = dbArrayToPy(update.type, update.data.data(), update.nElements);
+        } else {
+            value = dbValueToPy(update.type, update.data.data());
+        }
+        if (value == nullptr) {
+            PyErr_Print();
+            continue;
+        }
+
+        PyObject* r = PyObject_CallFunctionObjArgs(PyTuple_GET_ITEM(ctx, 1), PyTuple_GET_ITEM(ctx, 0), value, NULL);
+        Py_DecRef(value);
+        if (r == nullptr) {
+            PyErr_Print();
+        } else {
+            Py_DecRef(r);
+        }
+    }
+
+    for (auto ctx: released) {
+        Py_DecRef(reinterpret_cast<PyObject*>(ctx));
+    }
+}
+
 bool PyWrapper::init()
 {
     // Initialize and register `pydev' Python module which serves as
@@ -130,8 +872,11 @@ bool PyWrapper::init()
     PyDict_SetItemString(globDict, "__builtins__", PyEval_GetBuiltins());
 #endif /* PY_MAJOR_VERSION < 3 */
 
+    handleCache = PyDict_New();
+
     assert(globDict);
     assert(locDict);
+    assert(handleCache);
 
     // Release GIL, save thread state
     mainThread = PyEval_SaveThread();
@@ -148,34 +893,53 @@ bool PyWrapper::init()
     exec("import pydev", true);
 #endif /* PY_MAJOR_VERSION  <  3 */
 
+    Subscriptions::init(dispatchUpdates);
+
     return true;
 }
 
 void PyWrapper::shutdown()
 {
+    // Dispatcher and sampler need GIL, must be stopped first
+    Subscriptions::shutdown();
+    GilStats::stopSampler();
+    SlowExec::shutdown();
+    MemStats::enable(false);
+
     PyEval_RestoreThread(mainThread);
     mainThread = nullptr;
 
+    for (auto& it: codeCache) {
+        Py_DecRef(it.second.code);
+    }
+    codeCache.clear();
+    codeCacheSize = 0;
+    Py_DecRef(handleCache);
     Py_DecRef(globDict);
     Py_DecRef(locDict);
     Py_Finalize();
 }
 
+PyWrapper::Stats PyWrapper::stats()
+{
+    Stats stats;
+    stats.handleCacheHits = handleCacheHits;
+    stats.handleCacheMisses = handleCacheMisses;
+    stats.codeCacheHits = codeCacheHits;
+    stats.codeCacheSize = codeCacheSize;
+    // Parameters are only registered during IOC initialization
+    for (auto& it: params) {
+        stats.ioIntrNotifications[it.first] = it.second.notifications;
+    }
+    return stats;
+}
+
 void PyWrapper::registerIoIntr(const std::string& name, const Callback& cb)
 {
-    params[name].first = cb;
-    params[name].second = nullptr;
+    params[name].callback = cb;
+    params[name].value = nullptr;
 }
 
-struct PyGIL {
-    PyGILState_STATE state;
-    PyGIL() {
-        state = PyGILState_Ensure();
-    }
-    ~PyGIL() {
-        PyGILState_Release(state);
-    }
-};
 
 bool PyWrapper::convert(void* in_, MultiTypeValue& out)
 {
@@ -318,54 +1082,52 @@ bool PyWrapper::convert(void* in_, MultiTypeValue& out)
 }
 
 template <typename T>
-bool PyWrapper::exec(const std::string& line, bool debug, T* val)
+bool PyWrapper::convert(const MultiTypeValue& in, T* val)
 {
-    auto out = exec(line, debug);
-    switch (out.type) {
+    switch (in.type) {
     case MultiTypeValue::Type::INTEGER:
-        *val = out.i;
+        *val = in.i;
         return true;
     case MultiTypeValue::Type::FLOAT:
-        *val = out.f;
+        *val = in.f;
         return true;
     case MultiTypeValue::Type::BOOL:
-        *val = out.b;
+        *val = in.b;
         return true;
     default:
         return false;
     }
 }
-template bool PyWrapper::exec(const std::string&, bool, char*);
-template bool PyWrapper::exec(const std::string&, bool, int8_t*);
-template bool PyWrapper::exec(const std::string&, bool, uint8_t*);
-template bool PyWrapper::exec(const std::string&, bool, int16_t*);
-template bool PyWrapper::exec(const std::string&, bool, uint16_t*);
-template bool PyWrapper::exec(const std::string&, bool, int32_t*);
-template bool PyWrapper::exec(const std::string&, bool, uint32_t*);
-template bool PyWrapper::exec(const std::string&, bool, int64_t*);
-template bool PyWrapper::exec(const std::string&, bool, uint64_t*);
-template bool PyWrapper::exec(const std::string&, bool, float*);
-template bool PyWrapper::exec(const std::string&, bool, double*);
+template bool PyWrapper::convert(const MultiTypeValue&, char*);
+template bool PyWrapper::convert(const MultiTypeValue&, int8_t*);
+template bool PyWrapper::convert(const MultiTypeValue&, uint8_t*);
+template bool PyWrapper::convert(const MultiTypeValue&, int16_t*);
+template bool PyWrapper::convert(const MultiTypeValue&, uint16_t*);
+template bool PyWrapper::convert(const MultiTypeValue&, int32_t*);
+template bool PyWrapper::convert(const MultiTypeValue&, uint32_t*);
+template bool PyWrapper::convert(const MultiTypeValue&, int64_t*);
+template bool PyWrapper::convert(const MultiTypeValue&, uint64_t*);
+template bool PyWrapper::convert(const MultiTypeValue&, float*);
+template bool PyWrapper::convert(const MultiTypeValue&, double*);
 // These are needed on 64-bit GNU system that defines int64_t as long instead of long long
 // Unfortunately this makes the code here not very portable.
-template bool PyWrapper::exec(const std::string&, bool, long long*);
-template bool PyWrapper::exec(const std::string&, bool, unsigned long long*);
+template bool PyWrapper::convert(const MultiTypeValue&, long long*);
+template bool PyWrapper::convert(const MultiTypeValue&, unsigned long long*);
 
-bool PyWrapper::exec(const std::string& line, bool debug, std::string& val)
+bool PyWrapper::convert(const MultiTypeValue& in, std::string& val)
 {
-    auto out = exec(line, debug);
-    switch (out.type) {
+    switch (in.type) {
     case MultiTypeValue::Type::STRING:
-        val = out.s;
+        val = in.s;
         return true;
     case MultiTypeValue::Type::INTEGER:
-        val = Util::to_string(out.i);
+        val = Util::to_string(in.i);
         return true;
     case MultiTypeValue::Type::FLOAT:
-        val = Util::to_string(out.f);
+        val = Util::to_string(in.f);
         return true;
     case MultiTypeValue::Type::BOOL:
-        val = Util::to_string(out.b);
+        val = Util::to_string(in.b);
         return true;
     default:
         return false;
@@ -373,39 +1135,84 @@ bool PyWrapper::exec(const std::string& line, bool debug, std::string& val)
 }
 
 template <>
-bool PyWrapper::exec(const std::string& line, bool debug, std::vector<double>& arr)
+bool PyWrapper::convert(const MultiTypeValue& in, std::vector<double>& arr)
 {
-    auto out = exec(line, debug);
-    if (out.type == MultiTypeValue::Type::VECTOR_FLOAT) {
-        arr = out.vf;
+    if (in.type == MultiTypeValue::Type::VECTOR_FLOAT) {
+        arr = in.vf;
         return true;
-    } else if (out.type == MultiTypeValue::Type::VECTOR_INTEGER) {
-        arr = std::vector<double>(out.vi.begin(), out.vi.end());
+    } else if (in.type == MultiTypeValue::Type::VECTOR_INTEGER) {
+        arr = std::vector<double>(in.vi.begin(), in.vi.end());
         return true;
     }
     return false;
 }
+
 template <>
-bool PyWrapper::exec(const std::string& line, bool debug, std::vector<long>& arr)
+bool PyWrapper::convert(const MultiTypeValue& in, std::vector<long>& arr)
 {
-    auto out = exec(line, debug);
-    if (out.type == MultiTypeValue::Type::VECTOR_INTEGER) {
-        arr = out.vi;
+    if (in.type == MultiTypeValue::Type::VECTOR_INTEGER) {
+        arr = in.vi;
         return true;
-    } else if (out.type == MultiTypeValue::Type::VECTOR_FLOAT) {
-        arr = std::vector<long>(out.vf.begin(), out.vf.end());
+    } else if (in.type == MultiTypeValue::Type::VECTOR_FLOAT) {
+        arr = std::vector<long>(in.vf.begin(), in.vf.end());
         return true;
     }
     return false;
 }
 
+template <>
+bool PyWrapper::convert(const MultiTypeValue& in, std::vector<std::string>& arr)
+{
+    if (in.type == MultiTypeValue::Type::VECTOR_STRING) {
+        arr = in.vs;
+        return true;
+    }
+    return false;
+}
+
+template <typename T>
+bool PyWrapper::exec(const std::string& line, bool debug, T* val)
+{
+    return convert(exec(line, debug), val);
+}
+template bool PyWrapper::exec(const std::string&, bool, char*);
+template bool PyWrapper::exec(const std::string&, bool, int8_t*);
+template bool PyWrapper::exec(const std::string&, bool, uint8_t*);
+template bool PyWrapper::exec(const std::string&, bool, int16_t*);
+template bool PyWrapper::exec(const std::string&, bool, uint16_t*);
+template bool PyWrapper::exec(const std::string&, bool, int32_t*);
+template bool PyWrapper::exec(const std::string&, bool, uint32_t*);
+template bool PyWrapper::exec(const std::string&, bool, int64_t*);
+template bool PyWrapper::exec(const std::string&, bool, uint64_t*);
+template bool PyWrapper::exec(const std::string&, bool, float*);
+template bool PyWrapper::exec(const std::string&, bool, double*);
+// These are needed on 64-bit GNU system that defines int64_t as long instead of long long
+// Unfortunately this makes the code here not very portable.
+template bool PyWrapper::exec(const std::string&, bool, long long*);
+template bool PyWrapper::exec(const std::string&, bool, unsigned long long*);
+
+bool PyWrapper::exec(const std::string& line, bool debug, std::string& val)
+{
+    return convert(exec(line, debug), val);
+}
+
+template <>
+bool PyWrapper::exec(const std::string& line, bool debug, std::vector<double>& arr)
+{
+    return convert(exec(line, debug), arr);
+}
+
+template <>
+bool PyWrapper::exec(const std::string& line, bool debug, std::vector<long>& arr)
+{
+    return convert(exec(line, debug), arr);
+}
 
 template <>
 bool PyWrapper::exec(const std::string& line, bool debug, std::vector<std::string>& arr)
 {
     auto out = exec(line, debug);
-    if (out.type == MultiTypeValue::Type::VECTOR_STRING) {
-        arr = out.vs;
+    if (convert(out, arr)) {
         return true;
     }
     if (debug) {
@@ -414,41 +1221,254 @@ bool PyWrapper::exec(const std::string& line, bool debug, std::vector<std::strin
     return false;
 }
 
-PyWrapper::MultiTypeValue PyWrapper::exec(const std::string& line, bool debug)
+/**
+ * Compile code, returns new reference to code object or nullptr on syntax error.
+ *
+ * Evaluating Python expression produces a return value, when code
+ * is not an expression, let's try executing it instead.
+ */
+static PyObject* compileCode(const std::string& line, bool& expression)
 {
-    MultiTypeValue val;
-    PyGIL gil;
+    expression = true;
+    PyObject* code = Py_CompileString(line.c_str(), "<string>", Py_eval_input);
+    if (code == nullptr) {
+        PyErr_Clear();
+        expression = false;
+        code = Py_CompileString(line.c_str(), "<string>", Py_single_input);
+    }
+    return code;
+}
 
+/**
+ * Compile and evaluate code, returns new reference to the result.
+ *
+ * Code that is not an expression is executed instead, result is then None.
+ * Throws when code fails to compile or execute.
+ */
+static PyObject* evalCode(const std::string& line, bool debug, bool& expression, SlowExec::Scope& slow)
+{
     if (debug) {
         printf("Executing Python code: %s\n", line.c_str());
     }
 
-    // Evaluating Python produces a return value
-    PyObject* r = PyRun_String(line.c_str(), Py_eval_input, globDict, locDict);
-    if (r != nullptr) {
-        bool converted = convert(r, val);
-        Py_DecRef(r);
+    PyObject* code;
+    auto cached = codeCache.find(line);
+    if (cached != codeCache.end()) {
+        codeCacheHits.fetch_add(1, std::memory_order_relaxed);
+        code = cached->second.code;
+        expression = cached->second.expression;
+        Py_IncRef(code);
+    } else {
+        code = compileCode(line, expression);
+    }
+    Latency::mark(Latency::COMPILED);
+    slow.mark(SlowExec::COMPILE);
+
+    PyObject* r = nullptr;
+    if (code != nullptr) {
+        r = PyEval_EvalCode(PYCODE_CAST(code), globDict, locDict);
+        Py_DecRef(code);
+    }
+    Latency::mark(Latency::EXECUTED);
+    slow.mark(SlowExec::EXEC);
+
+    if (r == nullptr) {
+        if (debug && PyErr_Occurred()) {
+            PyErr_Print();
+        }
+        PyErr_Clear();
+        throw std::runtime_error("Failed to execute Python code");
+    }
+    return r;
+}
 
+PyWrapper::MultiTypeValue PyWrapper::exec(const std::string& line, bool debug)
+{
+    MultiTypeValue val;
+    Latency::mark(Latency::EXEC_BEGIN);
+    Tracer::Span span(Tracer::EXEC_BEGIN);
+    SlowExec::Scope slow;
+    PyGIL gil;
+    Latency::mark(Latency::GIL_ACQUIRED);
+    slow.mark(SlowExec::GIL);
+    Profiler::Scope profile;
+    MemStats::Scope memory;
+
+    bool expression;
+    PyObject* r = evalCode(line, debug, expression, slow);
+
+    if (expression) {
+        bool converted = convert(r, val);
         if (!converted) {
             if (debug) {
                 PyErr_Print();
             }
             PyErr_Clear();
         }
-        return val;
+    } else {
+        val.type = MultiTypeValue::Type::NONE;
+    }
+    Py_DecRef(r);
+    return val;
+}
+
+/**
+ * Get item of dict or sequence by key, returns new reference or nullptr.
+ *
+ * Dict keys are tried as strings first and then as integers.
+ */
+static PyObject* getItem(PyObject* container, const std::string& key)
+{
+    char* end;
+    long index = strtol(key.c_str(), &end, 10);
+    bool numeric = (!key.empty() && *end == 0);
+
+    PyObject* item = nullptr;
+    if (PyDict_Check(container)) {
+        item = PyDict_GetItemString(container, key.c_str());
+        if (item == nullptr && numeric) {
+            PyObject* k = PyLong_FromLong(index);
+            item = PyDict_GetItem(container, k);
+            Py_DecRef(k);
+        }
+        Py_XINCREF(item);
+    } else if (numeric && (PyTuple_Check(container) || PyList_Check(container))) {
+        item = PySequence_GetItem(container, index);
     }
     PyErr_Clear();
+    return item;
+}
 
-    // Still here, let's try executing code instead, no return value
-    r = PyRun_String(line.c_str(), Py_single_input, globDict, locDict);
-    if (r == nullptr) {
-        if (debug && PyErr_Occurred()) {
-            PyErr_Print();
+std::vector<PyWrapper::MultiTypeValue> PyWrapper::execItems(const std::string& line, bool debug, const std::vector<std::string>& keys, bool positional)
+{
+    std::vector<MultiTypeValue> values(keys.size());
+    Latency::mark(Latency::EXEC_BEGIN);
+    Tracer::Span span(Tracer::EXEC_BEGIN);
+    SlowExec::Scope slow;
+    PyGIL gil;
+    Latency::mark(Latency::GIL_ACQUIRED);
+    slow.mark(SlowExec::GIL);
+    Profiler::Scope profile;
+    MemStats::Scope memory;
+
+    bool expression;
+    PyObject* r = evalCode(line, debug, expression, slow);
+
+    bool sequence = (expression && positional && (PyTuple_Check(r) || PyList_Check(r)));
+    for (size_t i = 0; i < keys.size(); i++) {
+        PyObject* item = (expression ? getItem(r, sequence ? std::to_string(i) : keys[i]) : nullptr);
+        if (item == nullptr) {
+            if (debug) {
+                printf("No value for '%s' in result of: %s\n", keys[i].c_str(), line.c_str());
+            }
+            continue;
         }
-        PyErr_Clear();
-        throw std::runtime_error("Failed to execute Python code");
+        if (!convert(item, values[i])) {
+            values[i].type = MultiTypeValue::Type::NONE;
+            PyErr_Clear();
+        }
+        Py_DecRef(item);
     }
     Py_DecRef(r);
-    val.type = MultiTypeValue::Type::NONE;
-    return val;
+    return values;
+}
+
+std::vector<std::string> PyWrapper::compile(const std::vector<std::string>& lines, bool cache)
+{
+    std::vector<std::string> errors(lines.size());
+    PyGIL gil;
+
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (cache && codeCache.find(lines[i]) != codeCache.end()) {
+            continue;
+        }
+
+        // Only parsing is enough to check the syntax, any expression is also a statement
+        bool expression;
+        PyObject* code;
+        if (cache) {
+            code = compileCode(lines[i], expression);
+        } else {
+            PyCompilerFlags flags = {};
+            flags.cf_flags = PyCF_ONLY_AST;
+            code = Py_CompileStringFlags(lines[i].c_str(), "<string>", Py_single_input, &flags);
+        }
+        if (code == nullptr) {
+            PyObject *type, *value, *traceback;
+            PyErr_Fetch(&type, &value, &traceback);
+            PyErr_NormalizeException(&type, &value, &traceback);
+            PyObject* str = (value != nullptr ? PyObject_Str(value) : nullptr);
+            MultiTypeValue msg;
+            errors[i] = (str != nullptr && convert(str, msg) ? msg.s : "invalid syntax");
+            Py_XDECREF(str);
+            Py_XDECREF(type);
+            Py_XDECREF(value);
+            Py_XDECREF(traceback);
+            PyErr_Clear();
+        } else if (cache) {
+            codeCache[lines[i]] = CompiledCode{code, expression};
+            codeCacheSize++;
+        } else {
+            Py_DecRef(code);
+        }
+    }
+    return errors;
+}
+
+/*
+ * First byte of marshalled data tells whether code is an expression, rest
+ * is marshalled code object.
+ */
+size_t PyWrapper::loadCompiled(const std::vector<std::string>& lines, const std::vector<std::string>& data)
+{
+    size_t loaded = 0;
+    PyGIL gil;
+
+    for (size_t i = 0; i < lines.size() && i < data.size(); i++) {
+        if (data[i].size() < 2 || codeCache.find(lines[i]) != codeCache.end()) {
+            continue;
+        }
+        PyObject* code = PyMarshal_ReadObjectFromString(const_cast<char*>(data[i].data()) + 1, data[i].size() - 1);
+        if (code == nullptr || !PyCode_Check(code)) {
+            Py_XDECREF(code);
+            PyErr_Clear();
+            continue;
+        }
+        codeCache[lines[i]] = CompiledCode{code, (data[i][0] == 'e')};
+        codeCacheSize++;
+        loaded++;
+    }
+    return loaded;
+}
+
+std::vector<std::string> PyWrapper::dumpCompiled(const std::vector<std::string>& lines)
+{
+    std::vector<std::string> data(lines.size());
+    PyGIL gil;
+
+    for (size_t i = 0; i < lines.size(); i++) {
+        auto cached = codeCache.find(lines[i]);
+        if (cached == codeCache.end()) {
+            continue;
+        }
+        PyObject* bytes = PyMarshal_WriteObjectToString(cached->second.code, Py_MARSHAL_VERSION);
+        if (bytes == nullptr) {
+            PyErr_Clear();
+            continue;
+        }
+#if PY_MAJOR_VERSION < 3
+        data[i].assign(PyString_AsString(bytes), PyString_Size(bytes));
+#else
+        data[i].assign(PyBytes_AsString(bytes), PyBytes_Size(bytes));
+#endif
+        data[i].insert(data[i].begin(), (cached->second.expression ? 'e' : 's'));
+        Py_DecRef(bytes);
+    }
+    return data;
+}
+
+long PyWrapper::magic()
+{
+    PyGIL gil;
+    return PyImport_GetMagicNumber();
 }
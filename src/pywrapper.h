@@ -7,6 +7,7 @@
 #define PYWRAPPER_H
 
 #include <functional>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -32,16 +33,64 @@ class PyWrapper {
             } type{Type::NONE};
         };
         using Callback = std::function<void()>;
+        struct Stats {
+            unsigned long long handleCacheHits;
+            unsigned long long handleCacheMisses;
+            unsigned long long codeCacheHits;
+            unsigned long long codeCacheSize;
+            std::map<std::string, unsigned long long> ioIntrNotifications;
+        };
     private:
         static bool convert(void* in, MultiTypeValue& out);
     public:
         static bool init();
         static void shutdown();
         static void registerIoIntr(const std::string& name, const Callback& cb);
+        static Stats stats();
         static MultiTypeValue exec(const std::string& line, bool debug);
         static bool exec(const std::string& line, bool debug, std::string& val);
         template <typename T> static bool exec(const std::string& line, bool debug, T* val);
         template <typename T> static bool exec(const std::string& line, bool debug, std::vector<T>& val);
+        /**
+         * Execute code once and pick values from the returned dict or sequence.
+         *
+         * Keys are dict keys, string or integer, or sequence indexes. With
+         * positional, sequence items are picked by the position of the key
+         * instead. Values that are missing or can't be converted are
+         * returned as NONE.
+         */
+        static std::vector<MultiTypeValue> execItems(const std::string& line, bool debug, const std::vector<std::string>& keys, bool positional = false);
+
+        /**
+         * Compile code ahead of execution, all under single GIL acquisition.
+         *
+         * Returns error message for each line that doesn't compile, empty
+         * string otherwise. With cache, compiled code is kept and exec() of
+         * the very same code later skips compilation, otherwise code is
+         * only parsed to check the syntax.
+         */
+        static std::vector<std::string> compile(const std::vector<std::string>& lines, bool cache);
+        /**
+         * Add code compiled earlier, data as returned by dumpCompiled().
+         *
+         * Returns number of lines added, invalid or empty data is skipped.
+         */
+        static size_t loadCompiled(const std::vector<std::string>& lines, const std::vector<std::string>& data);
+        /**
+         * Marshal code compiled by compile() for storing, empty if not compiled.
+         */
+        static std::vector<std::string> dumpCompiled(const std::vector<std::string>& lines);
+        /**
+         * Magic number of Python bytecode, compiled code is only valid with the same.
+         */
+        static long magic();
+
+        /**
+         * Convert value returned by exec(), same rules as typed exec() functions.
+         */
+        static bool convert(const MultiTypeValue& in, std::string& val);
+        template <typename T> static bool convert(const MultiTypeValue& in, T* val);
+        template <typename T> static bool convert(const MultiTypeValue& in, std::vector<T>& val);
 };
 
 #endif // PYWRAPPER_H
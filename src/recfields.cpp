@@ -0,0 +1,266 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include "recfields.h"
+
+#include <dbAccess.h>
+#include <dbCommon.h>
+#include <dbLock.h>
+#include <epicsVersion.h>
+
+#include <cstring>
+
+#ifdef VERSION_INT
+#  if EPICS_VERSION_INT >= VERSION_INT(3,16,0,2)
+#    define HAVE_EPICS_INT64
+#  endif
+#endif
+
+/**
+ * Fields of other records are read under their lock, record itself is not
+ * locked by the device support either when code is executed.
+ */
+template <bool Foreign>
+class FieldLock {
+    public:
+        explicit FieldLock(const DBADDR& addr)
+        : m_rec(addr.precord)
+        {
+            if (Foreign) dbScanLock(m_rec);
+        }
+        ~FieldLock()
+        {
+            if (Foreign) dbScanUnlock(m_rec);
+        }
+    private:
+        dbCommon* m_rec;
+};
+
+template <typename T, bool Foreign>
+static std::string getScalar(const DBADDR& addr)
+{
+    FieldLock<Foreign> lock(addr);
+    return Util::to_string(*reinterpret_cast<const T*>(addr.pfield));
+}
+
+template <bool Foreign>
+static std::string getString(const DBADDR& addr)
+{
+    FieldLock<Foreign> lock(addr);
+    auto str = reinterpret_cast<const char*>(addr.pfield);
+    return Util::escape(std::string(str, strnlen(str, addr.field_size)));
+}
+
+/**
+ * Fields that don't store value directly, ie. links, converted by database.
+ */
+template <bool Foreign>
+static std::string getConverted(const DBADDR& addr)
+{
+    char str[MAX_STRING_SIZE] = {0};
+    long nElements = 1;
+    FieldLock<Foreign> lock(addr);
+    if (dbGet(const_cast<DBADDR*>(&addr), DBR_STRING, str, nullptr, &nElements, nullptr) != 0) {
+        return "";
+    }
+    str[MAX_STRING_SIZE - 1] = 0;
+    return Util::escape(str);
+}
+
+template <typename T, bool Foreign>
+static std::string getArray(const DBADDR& addr)
+{
+    std::vector<T> values(addr.no_elements);
+    long nElements = addr.no_elements;
+    FieldLock<Foreign> lock(addr);
+    if (dbGet(const_cast<DBADDR*>(&addr), addr.dbr_field_type, values.data(), nullptr, &nElements, nullptr) != 0) {
+        nElements = 0;
+    }
+    return Util::to_pylist_string(values.data(), nElements);
+}
+
+template <bool Foreign>
+static std::string getStrings(const DBADDR& addr)
+{
+    std::vector<char> buffer(addr.no_elements * MAX_STRING_SIZE);
+    long nElements = addr.no_elements;
+    FieldLock<Foreign> lock(addr);
+    if (dbGet(const_cast<DBADDR*>(&addr), DBR_STRING, buffer.data(), nullptr, &nElements, nullptr) != 0) {
+        nElements = 0;
+    }
+    std::vector<std::string> values;
+    for (long i = 0; i < nElements; i++) {
+        const char* str = &buffer[i * MAX_STRING_SIZE];
+        values.push_back("'" + Util::escape(std::string(str, strnlen(str, MAX_STRING_SIZE))) + "'");
+    }
+    return Util::to_pylist_string(values);
+}
+
+/**
+ * Getter is selected once, number of elements must be the capacity of the
+ * field rather than the current number of elements.
+ */
+template <bool Foreign>
+static RecordFields::Getter getterFor(const DBADDR& addr)
+{
+    if (addr.no_elements > 1) {
+        switch (addr.dbr_field_type) {
+        case DBR_STRING: return getStrings<Foreign>;
+        case DBR_CHAR:   return getArray<epicsInt8, Foreign>;
+        case DBR_UCHAR:  return getArray<epicsUInt8, Foreign>;
+        case DBR_SHORT:  return getArray<epicsInt16, Foreign>;
+        case DBR_USHORT: return getArray<epicsUInt16, Foreign>;
+        case DBR_LONG:   return getArray<epicsInt32, Foreign>;
+        case DBR_ULONG:  return getArray<epicsUInt32, Foreign>;
+#ifdef HAVE_EPICS_INT64
+        case DBR_INT64:  return getArray<epicsInt64, Foreign>;
+        case DBR_UINT64: return getArray<epicsUInt64, Foreign>;
+#endif
+        case DBR_FLOAT:  return getArray<epicsFloat32, Foreign>;
+        case DBR_DOUBLE: return getArray<epicsFloat64, Foreign>;
+        case DBR_ENUM:   return getArray<epicsEnum16, Foreign>;
+        default:         return nullptr;
+        }
+    }
+
+    switch (addr.field_type) {
+    case DBF_STRING:  return getString<Foreign>;
+    case DBF_CHAR:    return getScalar<epicsInt8, Foreign>;
+    case DBF_UCHAR:   return getScalar<epicsUInt8, Foreign>;
+    case DBF_SHORT:   return getScalar<epicsInt16, Foreign>;
+    case DBF_USHORT:  return getScalar<epicsUInt16, Foreign>;
+    case DBF_LONG:    return getScalar<epicsInt32, Foreign>;
+    case DBF_ULONG:   return getScalar<epicsUInt32, Foreign>;
+#ifdef HAVE_EPICS_INT64
+    case DBF_INT64:   return getScalar<epicsInt64, Foreign>;
+    case DBF_UINT64:  return getScalar<epicsUInt64, Foreign>;
+#endif
+    case DBF_FLOAT:   return getScalar<epicsFloat32, Foreign>;
+    case DBF_DOUBLE:  return getScalar<epicsFloat64, Foreign>;
+    case DBF_ENUM:
+    case DBF_MENU:
+    case DBF_DEVICE:  return getScalar<epicsEnum16, Foreign>;
+    case DBF_INLINK:
+    case DBF_OUTLINK:
+    case DBF_FWDLINK: return getConverted<Foreign>;
+    default:          return nullptr;
+    }
+}
+
+/**
+ * FNV-1a hash of raw bytes, continuing from previous hash.
+ */
+static size_t checksum(const void* data, size_t size, size_t hash)
+{
+    auto bytes = reinterpret_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+template <bool Foreign>
+static RecordFields::Sample sampleNumber(const DBADDR& addr, std::vector<char>& /*buffer*/)
+{
+    RecordFields::Sample sample{true, 0.0, 0};
+    long nElements = 1;
+    FieldLock<Foreign> lock(addr);
+    if (dbGet(const_cast<DBADDR*>(&addr), DBR_DOUBLE, &sample.value, nullptr, &nElements, nullptr) != 0 || nElements != 1) {
+        sample.numeric = false;
+    }
+    return sample;
+}
+
+/**
+ * Strings, arrays and links, read up to capacity of the field into buffer.
+ */
+template <bool Foreign>
+static RecordFields::Sample sampleRaw(const DBADDR& addr, std::vector<char>& buffer)
+{
+    short type = (addr.field_type >= DBF_INLINK ? DBR_STRING : addr.dbr_field_type);
+    size_t size = dbValueSize(type);
+    long nElements = addr.no_elements;
+    buffer.resize(nElements * size);
+    {
+        FieldLock<Foreign> lock(addr);
+        if (dbGet(const_cast<DBADDR*>(&addr), type, buffer.data(), nullptr, &nElements, nullptr) != 0) {
+            nElements = 0;
+        }
+    }
+
+    size_t hash = checksum(&nElements, sizeof(nElements), 14695981039346656037ULL);
+    if (type == DBR_STRING) {
+        // Bytes past the terminator are not part of the value
+        for (long i = 0; i < nElements; i++) {
+            const char* str = &buffer[i * size];
+            hash = checksum(str, strnlen(str, size) + 1, hash);
+        }
+    } else {
+        hash = checksum(buffer.data(), nElements * size, hash);
+    }
+    return RecordFields::Sample{false, 0.0, hash};
+}
+
+template <bool Foreign>
+static RecordFields::Sampler samplerFor(const DBADDR& addr)
+{
+    if (addr.no_elements > 1 || addr.field_type == DBF_STRING) {
+        return sampleRaw<Foreign>;
+    } else if (addr.field_type <= DBF_DEVICE) {
+        return sampleNumber<Foreign>;
+    } else if (addr.field_type <= DBF_FWDLINK) {
+        return sampleRaw<Foreign>;
+    }
+    return nullptr;
+}
+
+void RecordFields::bind(dbCommon* rec, const Util::Template& code, const Overrides& overrides)
+{
+    if (code.generation() == m_generation) {
+        return;
+    }
+    m_generation = code.generation();
+    m_accessors.clear();
+    m_foreign = false;
+
+    auto& fields = code.fields();
+    for (size_t i = 0; i < fields.size(); i++) {
+        auto& name = fields[i].first;
+        bool reference = (name.find_first_of(":.") != std::string::npos);
+        std::string pvname = (reference ? name : std::string(rec->name) + "." + name);
+
+        Accessor accessor{i, DBADDR(), nullptr, nullptr};
+        if (dbNameToAddr(pvname.c_str(), &accessor.addr) != 0) {
+            continue;
+        }
+        if (accessor.addr.precord == rec) {
+            auto it = overrides.find(name);
+            accessor.get = (it != overrides.end() ? it->second : getterFor<false>(accessor.addr));
+            accessor.sample = samplerFor<false>(accessor.addr);
+        } else {
+            accessor.get = getterFor<true>(accessor.addr);
+            accessor.sample = samplerFor<true>(accessor.addr);
+            m_foreign = true;
+        }
+        if (accessor.get != nullptr && accessor.sample != nullptr) {
+            m_accessors.push_back(accessor);
+        }
+    }
+}
+
+void RecordFields::get(Util::Template::Fields& fields) const
+{
+    for (auto& accessor: m_accessors) {
+        fields[accessor.field].second = accessor.get(accessor.addr);
+    }
+}
+
+void RecordFields::sample(std::vector<Sample>& samples)
+{
+    samples.resize(m_accessors.size());
+    for (size_t i = 0; i < m_accessors.size(); i++) {
+        samples[i] = m_accessors[i].sample(m_accessors[i].addr, m_buffer);
+    }
+}
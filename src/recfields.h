@@ -0,0 +1,82 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef RECFIELDS_H
+#define RECFIELDS_H
+
+#include "util.h"
+
+#include <dbAddr.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+struct dbCommon;
+
+/**
+ * Fields referenced from record code, bound to database addresses once.
+ *
+ * Field names found in code template are resolved with dbNameToAddr(),
+ * plain names like HOPR to fields of the record itself and references
+ * like %OTHER:PV.FIELD% to any field in the database. Each resolved field
+ * gets a getter selected by its type, so that processing only walks
+ * a flat array of accessors. Names that don't resolve keep their text.
+ */
+class RecordFields {
+    public:
+        using Getter = std::string (*)(const DBADDR& addr);
+        /**
+         * Record specific formatting of fields, ie. VAL of array records.
+         */
+        using Overrides = std::map<std::string, Getter>;
+
+        /**
+         * Raw value of a field for change detection, read without formatting.
+         *
+         * Scalar numeric fields are converted to double, strings, arrays
+         * and links are reduced to a checksum of their raw values.
+         */
+        struct Sample {
+            bool numeric;
+            double value;
+            size_t checksum;
+        };
+        using Sampler = Sample (*)(const DBADDR& addr, std::vector<char>& buffer);
+
+        /**
+         * Bind template fields, only does the work when template was parsed since last call.
+         */
+        void bind(dbCommon* rec, const Util::Template& code, const Overrides& overrides=Overrides());
+
+        /**
+         * Set values of bound fields.
+         */
+        void get(Util::Template::Fields& fields) const;
+
+        /**
+         * Sample raw values of bound fields, in the order they were bound.
+         */
+        void sample(std::vector<Sample>& samples);
+
+        /**
+         * True when any bound field belongs to another record.
+         */
+        bool foreign() const { return m_foreign; }
+
+    private:
+        struct Accessor {
+            size_t field;   // index into template fields
+            DBADDR addr;
+            Getter get;
+            Sampler sample;
+        };
+        std::vector<Accessor> m_accessors;
+        std::vector<char> m_buffer;
+        unsigned m_generation{0};
+        bool m_foreign{false};
+};
+
+#endif // RECFIELDS_H
@@ -0,0 +1,387 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include "slowexec.h"
+#include "asyncexec.h"
+
+#include <Python.h>
+
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Don't let log messages pile up when monitor thread can't keep up
+static const size_t MAX_PENDING = 100;
+
+struct SlowEvent {
+    std::string record;
+    uint64_t elapsed;
+    uint64_t threshold;
+    uint64_t stages[SlowExec::NUM_STAGES];
+    std::string stack;
+};
+
+/**
+ * Execution in progress of a thread, for the monitor to capture stack.
+ */
+struct ExecSlot {
+    unsigned long ident;
+    std::atomic<uint64_t> start{0};
+    std::atomic<uint64_t> seq{0};
+    std::atomic<const char*> record{nullptr};
+    // Protected by g_mutex
+    std::string stack;
+    uint64_t stackSeq{0};
+};
+
+std::atomic<uint64_t> SlowExec::s_minThreshold{0};
+static epicsMutex g_mutex;
+static epicsEvent g_wakeup;
+static uint64_t g_threshold = 0;
+static std::map<std::string, uint64_t> g_thresholds;
+static std::map<std::string, uint64_t> g_counts;
+static std::atomic<uint64_t> g_total{0};
+static double g_rate = 1.0;
+static double g_tokens = 1.0;
+static uint64_t g_lastRefill = 0;
+static uint64_t g_suppressed = 0;
+static std::vector<SlowEvent> g_events;
+static std::atomic<bool> g_captureStack{false};
+static std::vector<std::unique_ptr<ExecSlot>> g_slots;
+static thread_local ExecSlot* g_slot = nullptr;
+
+static ExecSlot* getSlot()
+{
+    if (g_slot == nullptr) {
+        auto slot = new ExecSlot;
+        slot->ident = PyThread_get_thread_ident();
+        g_mutex.lock();
+        g_slots.emplace_back(slot);
+        g_mutex.unlock();
+        g_slot = slot;
+    }
+    return g_slot;
+}
+
+/**
+ * Threshold of record in ns, 0 when disabled. Must hold g_mutex.
+ */
+static uint64_t thresholdFor(const std::string& record)
+{
+    auto it = g_thresholds.find(record);
+    return (it != g_thresholds.end() ? it->second : g_threshold);
+}
+
+static std::string toString(PyObject* obj)
+{
+#if PY_MAJOR_VERSION < 3
+    const char* str = PyString_AsString(obj);
+#else
+    const char* str = PyUnicode_AsUTF8(obj);
+#endif
+    if (str == nullptr) {
+        PyErr_Clear();
+        return "";
+    }
+    return str;
+}
+
+/**
+ * Format current Python stack of given thread, must hold GIL.
+ */
+static std::string formatStack(PyObject* frames, unsigned long ident)
+{
+    std::string out;
+    PyObject* key = PyLong_FromUnsignedLong(ident);
+    PyObject* frame = (key != nullptr ? PyDict_GetItem(frames, key) : nullptr);
+    Py_DecRef(key);
+    if (frame == nullptr) {
+        // Not executing Python code, ie. still waiting for GIL
+        return out;
+    }
+
+    PyObject* traceback = PyImport_ImportModule("traceback");
+    PyObject* lines = nullptr;
+    if (traceback != nullptr) {
+        lines = PyObject_CallMethod(traceback, const_cast<char*>("format_stack"), const_cast<char*>("O"), frame);
+        Py_DecRef(traceback);
+    }
+    if (lines != nullptr && PyList_Check(lines)) {
+        for (Py_ssize_t i = 0; i < PyList_Size(lines); i++) {
+            out += toString(PyList_GetItem(lines, i));
+        }
+    }
+    Py_DecRef(lines);
+    PyErr_Clear();
+    return out;
+}
+
+/**
+ * Captures stacks of executions that crossed the threshold and prints
+ * log messages, so that neither is done by the slow thread itself.
+ */
+class MonitorThread : public epicsThreadRunable {
+    public:
+        epicsThread thread;
+        std::atomic<bool> running{true};
+
+        MonitorThread()
+        : thread(*this, "PyDeviceSlowExec", epicsThreadGetStackSize(epicsThreadStackSmall))
+        {
+            thread.start();
+        }
+
+        ~MonitorThread()
+        {
+            running = false;
+            g_wakeup.signal();
+            thread.exitWait();
+        }
+
+        void run() override
+        {
+            while (running) {
+                if (g_captureStack) {
+                    // Check often enough to catch executions close to crossing the threshold
+                    double period = 1e-9 * SlowExec::s_minThreshold / 4;
+                    g_wakeup.wait(std::min(std::max(period, 0.001), 0.1));
+                    captureStacks();
+                } else {
+                    g_wakeup.wait(1.0);
+                }
+                flush();
+            }
+        }
+
+    private:
+        void captureStacks()
+        {
+            struct Crossed {
+                ExecSlot* slot;
+                uint64_t seq;
+            };
+            std::vector<Crossed> crossed;
+            auto t = SlowExec::now();
+
+            g_mutex.lock();
+            for (auto& slot: g_slots) {
+                auto start = slot->start.load(std::memory_order_acquire);
+                auto seq = slot->seq.load(std::memory_order_relaxed);
+                if (start == 0 || slot->stackSeq == seq) {
+                    continue;
+                }
+                const char* record = slot->record;
+                auto threshold = thresholdFor(record != nullptr ? record : "");
+                if (threshold > 0 && t > start && t - start >= threshold) {
+                    crossed.push_back({slot.get(), seq});
+                }
+            }
+            g_mutex.unlock();
+            if (crossed.empty()) {
+                return;
+            }
+
+            PyGILState_STATE state = PyGILState_Ensure();
+            PyObject* sys = PyImport_ImportModule("sys");
+            PyObject* frames = nullptr;
+            if (sys != nullptr) {
+                frames = PyObject_CallMethod(sys, const_cast<char*>("_current_frames"), nullptr);
+                Py_DecRef(sys);
+            }
+            if (frames != nullptr && PyDict_Check(frames)) {
+                for (auto& c: crossed) {
+                    auto stack = formatStack(frames, c.slot->ident);
+                    g_mutex.lock();
+                    // Make sure the same execution is still running
+                    if (c.slot->seq == c.seq && c.slot->start != 0) {
+                        c.slot->stack = stack;
+                        c.slot->stackSeq = c.seq;
+                    }
+                    g_mutex.unlock();
+                }
+            }
+            Py_DecRef(frames);
+            PyErr_Clear();
+            PyGILState_Release(state);
+        }
+
+        void flush()
+        {
+            std::vector<SlowEvent> events;
+            g_mutex.lock();
+            events.swap(g_events);
+            auto suppressed = g_suppressed;
+            g_suppressed = 0;
+            g_mutex.unlock();
+
+            for (auto& e: events) {
+                printf("Slow execution of %s: %.3f ms, threshold %.3f ms (GIL %.3f ms, compile %.3f ms, exec %.3f ms, convert %.3f ms)\n",
+                       (e.record.empty() ? "<no record>" : e.record.c_str()), 1e-6 * e.elapsed, 1e-6 * e.threshold,
+                       1e-6 * e.stages[SlowExec::GIL], 1e-6 * e.stages[SlowExec::COMPILE],
+                       1e-6 * e.stages[SlowExec::EXEC], 1e-6 * e.stages[SlowExec::CONVERT]);
+                if (!e.stack.empty()) {
+                    printf("Python stack when threshold was crossed:\n%s", e.stack.c_str());
+                }
+            }
+            if (suppressed > 0) {
+                printf("%llu slow executions not logged due to rate limit\n", (unsigned long long)suppressed);
+            }
+        }
+};
+static std::unique_ptr<MonitorThread> g_monitor;
+
+void SlowExec::updateMinThreshold()
+{
+    uint64_t min = g_threshold;
+    for (auto& it: g_thresholds) {
+        if (it.second > 0 && (min == 0 || it.second < min)) {
+            min = it.second;
+        }
+    }
+    s_minThreshold = min;
+}
+
+void SlowExec::setThreshold(double seconds)
+{
+    g_mutex.lock();
+    g_threshold = (seconds > 0.0 ? seconds * 1e9 : 0);
+    updateMinThreshold();
+    g_mutex.unlock();
+
+    if (s_minThreshold > 0 && !g_monitor) {
+        g_monitor.reset(new MonitorThread);
+    }
+}
+
+void SlowExec::setThreshold(const std::string& record, double seconds)
+{
+    g_mutex.lock();
+    if (seconds < 0.0) {
+        g_thresholds.erase(record);
+    } else {
+        g_thresholds[record] = seconds * 1e9;
+    }
+    updateMinThreshold();
+    g_mutex.unlock();
+
+    if (s_minThreshold > 0 && !g_monitor) {
+        g_monitor.reset(new MonitorThread);
+    }
+}
+
+void SlowExec::setLogging(double rate, bool captureStack)
+{
+    g_mutex.lock();
+    g_rate = std::max(rate, 0.0);
+    g_tokens = std::min(g_tokens, std::max(g_rate, 1.0));
+    g_mutex.unlock();
+    g_captureStack = captureStack;
+    g_wakeup.signal();
+}
+
+uint64_t SlowExec::count(const std::string& record)
+{
+    if (record.empty()) {
+        return g_total;
+    }
+    g_mutex.lock();
+    auto it = g_counts.find(record);
+    uint64_t count = (it != g_counts.end() ? it->second : 0);
+    g_mutex.unlock();
+    return count;
+}
+
+void SlowExec::report(int level)
+{
+    g_mutex.lock();
+    auto threshold = g_threshold;
+    auto overrides = g_thresholds.size();
+    auto rate = g_rate;
+    std::vector<std::pair<std::string, uint64_t>> counts(g_counts.begin(), g_counts.end());
+    g_mutex.unlock();
+
+    printf("Slow executions: %llu, threshold %.3f ms, %zu per-record thresholds, logging %.1f/s%s\n",
+           (unsigned long long)g_total, 1e-6 * threshold, overrides, rate, (g_captureStack ? " with stack" : ""));
+    std::sort(counts.begin(), counts.end(), [](const std::pair<std::string, uint64_t>& a, const std::pair<std::string, uint64_t>& b) {
+        return a.second > b.second;
+    });
+    for (size_t i = 0; level > 0 && i < counts.size() && i < 10; i++) {
+        printf("  %-40s %llu\n", (counts[i].first.empty() ? "<no record>" : counts[i].first.c_str()), (unsigned long long)counts[i].second);
+    }
+}
+
+void SlowExec::shutdown()
+{
+    g_monitor.reset();
+}
+
+void SlowExec::Scope::begin()
+{
+    m_points[0] = now();
+    if (g_captureStack.load(std::memory_order_relaxed)) {
+        auto slot = getSlot();
+        m_seq = slot->seq.load(std::memory_order_relaxed) + 1;
+        slot->record = AsyncExec::current();
+        slot->seq.store(m_seq, std::memory_order_relaxed);
+        slot->start.store(m_points[0], std::memory_order_release);
+    }
+}
+
+void SlowExec::Scope::end()
+{
+    auto t = now();
+    if (m_seq != 0) {
+        g_slot->start.store(0, std::memory_order_relaxed);
+    }
+    auto elapsed = t - m_points[0];
+    if (elapsed < s_minThreshold.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    const char* record = AsyncExec::current();
+    SlowEvent event;
+    event.record = (record != nullptr ? record : "");
+    event.elapsed = elapsed;
+    // Stages not reached, ie. due to an error, have zero duration
+    uint64_t prev = m_points[0];
+    for (int i = 0; i < NUM_STAGES; i++) {
+        uint64_t point = (i == NUM_STAGES - 1 ? t : (m_points[i + 1] != 0 ? m_points[i + 1] : prev));
+        event.stages[i] = point - prev;
+        prev = point;
+    }
+
+    bool queued = false;
+    g_mutex.lock();
+    event.threshold = thresholdFor(event.record);
+    if (event.threshold > 0 && elapsed >= event.threshold) {
+        g_total++;
+        g_counts[event.record]++;
+
+        double burst = std::max(g_rate, 1.0);
+        g_tokens = std::min(burst, g_tokens + 1e-9 * (t - g_lastRefill) * g_rate);
+        g_lastRefill = t;
+        if (g_rate > 0.0 && g_tokens >= 1.0 && g_events.size() < MAX_PENDING) {
+            g_tokens -= 1.0;
+            if (m_seq != 0 && g_slot->stackSeq == m_seq) {
+                event.stack.swap(g_slot->stack);
+            }
+            g_events.push_back(std::move(event));
+            queued = true;
+        } else {
+            g_suppressed++;
+        }
+    }
+    g_mutex.unlock();
+
+    if (queued) {
+        g_wakeup.signal();
+    }
+}
@@ -0,0 +1,103 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef SLOWEXEC_H
+#define SLOWEXEC_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/**
+ * Detector of slow Python code executions.
+ *
+ * Any PyWrapper::exec() call taking longer than the threshold of the
+ * record being processed is counted and logged with timings of execution
+ * stages. Optionally, Python stack of the slow execution is captured by
+ * a monitor thread as soon as the threshold is crossed. Messages are
+ * rate-limited and printed from the monitor thread, executions that are
+ * not slow only pay for a couple of timestamps.
+ */
+class SlowExec {
+    public:
+        enum Stage {
+            GIL,        // waiting for GIL
+            COMPILE,
+            EXEC,
+            CONVERT,    // converting Python result
+            NUM_STAGES
+        };
+
+        /**
+         * Set global threshold in seconds, 0 disables detection.
+         */
+        static void setThreshold(double seconds);
+        /**
+         * Set threshold for a single record overriding global one,
+         * 0 disables detection for record, negative removes override.
+         */
+        static void setThreshold(const std::string& record, double seconds);
+        /**
+         * Configure logging, at most rate messages per second, and whether
+         * to capture Python stack of slow executions.
+         */
+        static void setLogging(double rate, bool captureStack);
+
+        /**
+         * Number of slow executions of given record, or all records when empty.
+         */
+        static uint64_t count(const std::string& record="");
+        /**
+         * Print configuration and number of slow executions, level > 0
+         * adds records with most slow executions.
+         */
+        static void report(int level);
+        static void shutdown();
+
+        /**
+         * Measures the enclosing PyWrapper::exec() call.
+         */
+        class Scope {
+            public:
+                Scope()
+                {
+                    if (s_minThreshold.load(std::memory_order_relaxed) > 0) {
+                        begin();
+                    }
+                }
+                ~Scope()
+                {
+                    if (m_points[0] != 0) {
+                        end();
+                    }
+                }
+                /**
+                 * Mark the end of stage.
+                 */
+                void mark(Stage stage)
+                {
+                    if (m_points[0] != 0) {
+                        m_points[stage + 1] = now();
+                    }
+                }
+            private:
+                void begin();
+                void end();
+                uint64_t m_points[NUM_STAGES + 1] = {};
+                uint64_t m_seq{0};
+        };
+
+    private:
+        friend class MonitorThread;
+        static inline uint64_t now()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+        static void updateMinThreshold();
+        static std::atomic<uint64_t> s_minThreshold;
+};
+
+#endif // SLOWEXEC_H
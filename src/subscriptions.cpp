@@ -0,0 +1,297 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include "subscriptions.h"
+
+#include <dbAccess.h>
+#include <dbEvent.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+#include <epicsVersion.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+
+#ifdef VERSION_INT
+#  if EPICS_VERSION_INT >= VERSION_INT(3,15,0,0)
+#    define HAVE_DBCHANNEL
+#    include <dbChannel.h>
+#  endif
+#endif
+
+struct Subscription {
+    long id;
+    void* ctx;
+#ifdef HAVE_DBCHANNEL
+    dbChannel* chan{nullptr};
+#endif
+    dbEventSubscription event{nullptr};
+    std::vector<char> scratch;
+    Subscriptions::Update latest;
+    bool pending{false};
+    bool removed{false};    // taken out of g_subscriptions, event being cancelled
+};
+
+static epicsMutex g_mutex;
+static epicsEvent g_wakeup;
+static dbEventCtx g_eventCtx = nullptr;
+static std::map<long, std::unique_ptr<Subscription>> g_subscriptions;
+static std::vector<Subscription*> g_pending;
+static std::vector<void*> g_released;
+static Subscriptions::Dispatcher g_dispatcher;
+static long g_lastId = 0;
+static unsigned g_removing = 0;
+
+static std::atomic<unsigned long long> g_events{0};
+static std::atomic<unsigned long long> g_coalesced{0};
+static std::atomic<unsigned long long> g_batches{0};
+static std::atomic<unsigned long long> g_dispatched{0};
+
+static void dispatch()
+{
+    std::vector<Subscriptions::Update> updates;
+    std::vector<void*> released;
+
+    g_mutex.lock();
+    updates.resize(g_pending.size());
+    for (size_t i = 0; i < g_pending.size(); i++) {
+        auto sub = g_pending[i];
+        updates[i].ctx = sub->ctx;
+        updates[i].type = sub->latest.type;
+        updates[i].nElements = sub->latest.nElements;
+        updates[i].array = sub->latest.array;
+        updates[i].data.swap(sub->latest.data);
+        sub->pending = false;
+    }
+    g_pending.clear();
+    released.swap(g_released);
+    g_mutex.unlock();
+
+    if (!updates.empty() || !released.empty()) {
+        g_batches++;
+        g_dispatched += updates.size();
+        g_dispatcher(updates, released);
+    }
+}
+
+class DispatchThread : public epicsThreadRunable {
+    public:
+        epicsThread thread;
+        std::atomic<bool> running{true};
+
+        DispatchThread()
+        : thread(*this, "PyDeviceSubscr", epicsThreadGetStackSize(epicsThreadStackMedium))
+        {
+            thread.start();
+        }
+
+        ~DispatchThread()
+        {
+            running = false;
+            g_wakeup.signal();
+            thread.exitWait();
+        }
+
+        void run() override
+        {
+            while (running) {
+                g_wakeup.wait(1.0);
+                dispatch();
+            }
+        }
+};
+static std::unique_ptr<DispatchThread> g_thread;
+
+#ifdef HAVE_DBCHANNEL
+static void eventCallback(void* arg, dbChannel* chan, int /*eventsRemaining*/, db_field_log* pfl)
+{
+    auto sub = reinterpret_cast<Subscription*>(arg);
+    short type = dbChannelExportType(chan);
+    long nElements = dbChannelFinalElements(chan);
+    long options = 0;
+
+    // Only event task invokes this function, scratch buffer needs no locking
+    sub->scratch.resize(nElements * dbValueSize(type));
+    if (dbChannelGetField(chan, type, sub->scratch.data(), &options, &nElements, pfl) != 0) {
+        return;
+    }
+    g_events++;
+
+    bool wakeup = false;
+    g_mutex.lock();
+    if (sub->removed) {
+        g_mutex.unlock();
+        return;
+    }
+    sub->latest.type = type;
+    sub->latest.nElements = nElements;
+    sub->latest.array = (dbChannelFinalElements(chan) > 1);
+    sub->latest.data.swap(sub->scratch);
+    if (sub->pending) {
+        g_coalesced++;
+    } else {
+        sub->pending = true;
+        g_pending.push_back(sub);
+        wakeup = true;
+    }
+    g_mutex.unlock();
+
+    if (wakeup) {
+        g_wakeup.signal();
+    }
+}
+#endif
+
+void Subscriptions::init(const Subscriptions::Dispatcher& dispatcher)
+{
+    g_dispatcher = dispatcher;
+}
+
+void Subscriptions::shutdown()
+{
+    g_thread.reset();
+
+    std::vector<void*> released;
+    g_mutex.lock();
+    auto subscriptions = std::move(g_subscriptions);
+    g_subscriptions.clear();
+    for (auto& it: subscriptions) {
+        it.second->removed = true;
+    }
+    g_pending.clear();
+
+    // Subscriptions being removed concurrently still need the event context
+    while (g_removing > 0) {
+        g_mutex.unlock();
+        epicsThreadSleep(0.01);
+        g_mutex.lock();
+    }
+    released.swap(g_released);
+    g_mutex.unlock();
+
+    for (auto& it: subscriptions) {
+        auto& sub = it.second;
+        db_cancel_event(sub->event);
+#ifdef HAVE_DBCHANNEL
+        dbChannelDelete(sub->chan);
+#endif
+        released.push_back(sub->ctx);
+    }
+    if (g_eventCtx != nullptr) {
+        db_close_events(g_eventCtx);
+        g_eventCtx = nullptr;
+    }
+
+    if (!released.empty() && g_dispatcher) {
+        std::vector<Subscriptions::Update> updates;
+        g_dispatcher(updates, released);
+    }
+}
+
+long Subscriptions::add(const std::string& pvname, unsigned mask, void* ctx)
+{
+#ifdef HAVE_DBCHANNEL
+    if (!g_dispatcher) {
+        return -1;
+    }
+
+    // Called from several Python threads at once, GIL is released
+    g_mutex.lock();
+    if (g_eventCtx == nullptr) {
+        g_eventCtx = db_init_events();
+        if (g_eventCtx == nullptr) {
+            g_mutex.unlock();
+            return -1;
+        }
+        if (db_start_events(g_eventCtx, "PyDeviceEvents", nullptr, nullptr, epicsThreadPriorityLow) != 0) {
+            db_close_events(g_eventCtx);
+            g_eventCtx = nullptr;
+            g_mutex.unlock();
+            return -1;
+        }
+    }
+    if (!g_thread) {
+        g_thread.reset(new DispatchThread);
+    }
+    g_mutex.unlock();
+
+    std::unique_ptr<Subscription> sub(new Subscription);
+    sub->ctx = ctx;
+    sub->chan = dbChannelCreate(pvname.c_str());
+    if (sub->chan == nullptr) {
+        return -1;
+    }
+    if (dbChannelOpen(sub->chan) != 0) {
+        dbChannelDelete(sub->chan);
+        return -1;
+    }
+
+    sub->event = db_add_event(g_eventCtx, sub->chan, eventCallback, sub.get(), mask);
+    if (sub->event == nullptr) {
+        dbChannelDelete(sub->chan);
+        return -1;
+    }
+
+    auto event = sub->event;
+    g_mutex.lock();
+    sub->id = ++g_lastId;
+    long id = sub->id;
+    g_subscriptions[id] = std::move(sub);
+    g_mutex.unlock();
+
+    // Deliver current value, just like Channel Access monitors do
+    db_event_enable(event);
+    db_post_single_event(event);
+    return id;
+#else
+    return -1;
+#endif
+}
+
+bool Subscriptions::remove(long id)
+{
+    // Only the caller taking subscription out of the map cancels its event
+    g_mutex.lock();
+    auto it = g_subscriptions.find(id);
+    if (it == g_subscriptions.end()) {
+        g_mutex.unlock();
+        return false;
+    }
+    std::unique_ptr<Subscription> sub = std::move(it->second);
+    g_subscriptions.erase(it);
+    g_pending.erase(std::remove(g_pending.begin(), g_pending.end(), sub.get()), g_pending.end());
+    sub->removed = true;
+    g_removing++;
+    g_mutex.unlock();
+
+    // Waits for event callback to complete, can't hold mutex meanwhile
+    db_cancel_event(sub->event);
+#ifdef HAVE_DBCHANNEL
+    dbChannelDelete(sub->chan);
+#endif
+
+    g_mutex.lock();
+    // Dispatcher may be processing a batch referencing this context,
+    // only release it from the dispatcher thread after the batch is done.
+    g_released.push_back(sub->ctx);
+    g_removing--;
+    g_mutex.unlock();
+
+    g_wakeup.signal();
+    return true;
+}
+
+Subscriptions::Stats Subscriptions::stats()
+{
+    Stats stats;
+    stats.events = g_events;
+    stats.coalesced = g_coalesced;
+    stats.batches = g_batches;
+    stats.dispatched = g_dispatched;
+    return stats;
+}
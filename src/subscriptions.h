@@ -0,0 +1,50 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef SUBSCRIPTIONS_H
+#define SUBSCRIPTIONS_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Monitors on local database records, delivered in batches.
+ *
+ * Database events are received on the EPICS event task, the value is copied
+ * to subscription's slot and subscription is queued for dispatching unless
+ * already queued. This way fast changing records never queue more than one
+ * value, the dispatcher only sees the latest value. A dedicated thread
+ * drains the queue and passes all pending updates to the dispatcher
+ * function at once.
+ */
+class Subscriptions {
+    public:
+        struct Update {
+            void* ctx;
+            short type;
+            long nElements;
+            bool array;
+            std::vector<char> data;
+        };
+        struct Stats {
+            unsigned long long events;
+            unsigned long long coalesced;
+            unsigned long long batches;
+            unsigned long long dispatched;
+        };
+        /**
+         * Dispatcher receives all pending updates and user contexts of removed
+         * subscriptions, which are no longer referenced and can be released.
+         */
+        using Dispatcher = std::function<void(std::vector<Update>& updates, std::vector<void*>& released)>;
+        static void init(const Dispatcher& dispatcher);
+        static void shutdown();
+        static long add(const std::string& pvname, unsigned mask, void* ctx);
+        static bool remove(long id);
+        static Stats stats();
+};
+
+#endif // SUBSCRIPTIONS_H
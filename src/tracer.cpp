@@ -0,0 +1,200 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#include "tracer.h"
+
+#include <epicsMutex.h>
+#include <epicsThread.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+std::atomic<bool> Tracer::s_enabled{false};
+
+struct TraceEntry {
+    // Sequence lock, index+1 of the event once written, 0 while writing
+    std::atomic<uint64_t> seq{0};
+    std::atomic<uint64_t> ts{0};
+    std::atomic<const char*> name{nullptr};
+    std::atomic<unsigned char> type{0};
+};
+
+struct ThreadBuffer {
+    std::string threadName;
+    unsigned tid;
+    unsigned capacity;
+    std::unique_ptr<TraceEntry[]> entries;
+    // Only modified by the owning thread
+    std::atomic<uint64_t> head{0};
+
+    ThreadBuffer(unsigned tid_, unsigned capacity_)
+    : threadName(epicsThreadGetNameSelf())
+    , tid(tid_)
+    , capacity(capacity_)
+    , entries(new TraceEntry[capacity_])
+    {}
+};
+
+static epicsMutex g_mutex;
+static std::vector<std::unique_ptr<ThreadBuffer>> g_buffers;
+static std::atomic<unsigned> g_capacity{0};
+static unsigned g_lastTid = 0;
+static thread_local ThreadBuffer* g_buffer = nullptr;
+
+static inline uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static ThreadBuffer* getBuffer()
+{
+    unsigned capacity = g_capacity.load(std::memory_order_relaxed);
+    if (g_buffer != nullptr && g_buffer->capacity == capacity) {
+        return g_buffer;
+    }
+    if (capacity == 0) {
+        return nullptr;
+    }
+
+    // First event from this thread or capacity changed, replace buffer.
+    // Dump only reads buffers while holding mutex, safe to delete old one.
+    g_mutex.lock();
+    unsigned tid = (g_buffer != nullptr ? g_buffer->tid : ++g_lastTid);
+    for (auto it = g_buffers.begin(); it != g_buffers.end(); ++it) {
+        if (it->get() == g_buffer) {
+            g_buffers.erase(it);
+            break;
+        }
+    }
+    g_buffer = new ThreadBuffer(tid, capacity);
+    g_buffers.emplace_back(g_buffer);
+    g_mutex.unlock();
+    return g_buffer;
+}
+
+void Tracer::record(Tracer::Event type, const char* name)
+{
+    auto buffer = getBuffer();
+    if (buffer == nullptr) {
+        return;
+    }
+
+    uint64_t index = buffer->head.load(std::memory_order_relaxed);
+    auto& entry = buffer->entries[index % buffer->capacity];
+    entry.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    entry.ts.store(now(), std::memory_order_relaxed);
+    entry.name.store(name, std::memory_order_relaxed);
+    entry.type.store(type, std::memory_order_relaxed);
+    entry.seq.store(index + 1, std::memory_order_release);
+    buffer->head.store(index + 1, std::memory_order_release);
+}
+
+void Tracer::enable(unsigned eventsPerThread)
+{
+    g_capacity = eventsPerThread;
+    s_enabled = (eventsPerThread > 0);
+}
+
+static std::string escape(const char* str)
+{
+    std::string out;
+    for (; str != nullptr && *str != 0; str++) {
+        if (*str == '"' || *str == '\\') {
+            out += '\\';
+        }
+        if (static_cast<unsigned char>(*str) >= 0x20) {
+            out += *str;
+        }
+    }
+    return out;
+}
+
+static void writeEvent(FILE* f, bool& first, unsigned tid, uint64_t ts, Tracer::Event type, const char* name)
+{
+    static const struct {
+        const char* phase;
+        const char* category;
+        const char* name;
+    } formats[] = {
+        { "b", "queue",  "queued"    }, // QUEUE_BEGIN
+        { "e", "queue",  "queued"    }, // QUEUE_END
+        { "B", "task",   nullptr     }, // TASK_BEGIN
+        { "E", "task",   nullptr     }, // TASK_END
+        { "B", "python", "exec"      }, // EXEC_BEGIN
+        { "E", "python", "exec"      }, // EXEC_END
+        { "B", "gil",    "GIL wait"  }, // GIL_WAIT_BEGIN
+        { "E", "gil",    "GIL wait"  }, // GIL_WAIT_END
+        { "B", "gil",    "GIL held"  }, // GIL_HELD_BEGIN
+        { "E", "gil",    "GIL held"  }, // GIL_HELD_END
+        { "b", "record", nullptr     }, // RECORD_BEGIN
+        { "e", "record", nullptr     }, // RECORD_END
+    };
+    if (type >= sizeof(formats)/sizeof(formats[0])) {
+        return;
+    }
+    auto& fmt = formats[type];
+    std::string label = escape(fmt.name != nullptr ? fmt.name : (name != nullptr ? name : "task"));
+
+    fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%u",
+            (first ? "" : ","), label.c_str(), fmt.category, fmt.phase, 1e-3 * ts, tid);
+    if (fmt.phase[0] == 'b' || fmt.phase[0] == 'e') {
+        // Async events are matched by id, record name pointer is unique per record
+        fprintf(f, ",\"id\":\"%p\"", static_cast<const void*>(name));
+        if (fmt.name != nullptr && name != nullptr) {
+            fprintf(f, ",\"args\":{\"record\":\"%s\"}", escape(name).c_str());
+        }
+    } else if (name != nullptr && fmt.name != nullptr) {
+        fprintf(f, ",\"args\":{\"record\":\"%s\"}", escape(name).c_str());
+    }
+    fprintf(f, "}");
+    first = false;
+}
+
+bool Tracer::dump(const std::string& path)
+{
+    FILE* f = fopen(path.c_str(), "w");
+    if (f == nullptr) {
+        printf("Failed to open '%s' for writing\n", path.c_str());
+        return false;
+    }
+
+    unsigned long long written = 0;
+    bool first = true;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    g_mutex.lock();
+    for (auto& buffer: g_buffers) {
+        fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                (first ? "" : ","), buffer->tid, escape(buffer->threadName.c_str()).c_str());
+        first = false;
+
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        uint64_t begin = (head > buffer->capacity ? head - buffer->capacity : 0);
+        for (uint64_t i = begin; i < head; i++) {
+            auto& entry = buffer->entries[i % buffer->capacity];
+            uint64_t seq = entry.seq.load(std::memory_order_acquire);
+            uint64_t ts = entry.ts.load(std::memory_order_relaxed);
+            const char* name = entry.name.load(std::memory_order_relaxed);
+            auto type = static_cast<Event>(entry.type.load(std::memory_order_relaxed));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            // Skip entries being overwritten by the owning thread meanwhile
+            if (seq != i + 1 || entry.seq.load(std::memory_order_relaxed) != seq) {
+                continue;
+            }
+            writeEvent(f, first, buffer->tid, ts, type, name);
+            written++;
+        }
+    }
+    g_mutex.unlock();
+
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    printf("Written %llu events to '%s'\n", written, path.c_str());
+    return true;
+}
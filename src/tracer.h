@@ -0,0 +1,83 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <string>
+
+/**
+ * Opt-in execution timeline tracer.
+ *
+ * When enabled, each thread records events into its own ring buffer
+ * without any locking. Buffers can be dumped at any time to a file in
+ * Chrome Trace Event format, which can be loaded into chrome://tracing
+ * or Perfetto UI. When disabled, recording an event costs one relaxed
+ * atomic load.
+ */
+class Tracer {
+    public:
+        // Every *_END must directly follow its *_BEGIN, Span relies on it
+        enum Event : unsigned char {
+            QUEUE_BEGIN,    // task scheduled
+            QUEUE_END,      // task picked up by a worker
+            TASK_BEGIN,
+            TASK_END,
+            EXEC_BEGIN,     // PyWrapper::exec() called
+            EXEC_END,
+            GIL_WAIT_BEGIN,
+            GIL_WAIT_END,
+            GIL_HELD_BEGIN,
+            GIL_HELD_END,
+            RECORD_BEGIN,   // record processing started
+            RECORD_END,     // record processing completed
+        };
+
+        /**
+         * Record event on calling thread's timeline.
+         *
+         * Name must remain valid for the lifetime of the program.
+         */
+        static inline void event(Event type, const char* name=nullptr)
+        {
+            if (s_enabled.load(std::memory_order_relaxed)) {
+                record(type, name);
+            }
+        }
+
+        /**
+         * Enable tracing keeping last eventsPerThread events for each thread,
+         * 0 disables tracing.
+         */
+        static void enable(unsigned eventsPerThread);
+        static bool dump(const std::string& path);
+
+        /**
+         * Records begin event when created and matching end event when destroyed.
+         */
+        class Span {
+            public:
+                Span(Event begin, const char* name=nullptr)
+                : m_begin(begin)
+                , m_name(name)
+                {
+                    event(begin, name);
+                }
+                ~Span()
+                {
+                    event(static_cast<Event>(m_begin + 1), m_name);
+                }
+            private:
+                Event m_begin;
+                const char* m_name;
+        };
+
+    private:
+        static void record(Event type, const char* name);
+        static std::atomic<bool> s_enabled;
+};
+
+#endif // TRACER_H
@@ -0,0 +1,317 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+/*
+ * AsyncExec scheduler benchmark and stress test.
+ *
+ * Usage: benchasyncexec [-o FILE] [-workers N] [-producers N] [-tasks N] [-work NS] [-skip-idle]
+ *
+ * Producer threads flood AsyncExec::schedule() with empty or short busy
+ * tasks. Every task is accounted for, program exits with non-zero status
+ * when any task is lost or executed more than once. Build with
+ * -fsanitize=thread to check the scheduler for data races at the same time.
+ *
+ * Measured are throughput, fairness across producers, wake-up latency of
+ * idle workers, including workers which went through the dequeue timeout,
+ * and duration of shutdown. Results are written as JSON.
+ */
+
+#include <asyncexec.h>
+
+#include <epicsEvent.h>
+#include <epicsThread.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static inline uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+static void busy(uint64_t ns)
+{
+    auto end = now() + ns;
+    while (now() < end);
+}
+
+struct Flood {
+    unsigned producers;
+    unsigned tasksPerProducer;
+    uint64_t work;
+    std::unique_ptr<std::atomic<unsigned>[]> runs;
+    std::unique_ptr<std::atomic<uint64_t>[]> lastDone;
+    std::atomic<unsigned long long> completed{0};
+    std::atomic<unsigned long long> rejected{0};
+    uint64_t start{0};
+
+    Flood(unsigned producers_, unsigned tasks_, uint64_t work_)
+    : producers(producers_)
+    , tasksPerProducer(tasks_)
+    , work(work_)
+    , runs(new std::atomic<unsigned>[producers_ * tasks_])
+    , lastDone(new std::atomic<uint64_t>[producers_])
+    {
+        for (unsigned i = 0; i < producers * tasksPerProducer; i++) {
+            runs[i] = 0;
+        }
+        for (unsigned i = 0; i < producers; i++) {
+            lastDone[i] = 0;
+        }
+    }
+};
+
+class Producer : public epicsThreadRunable {
+    public:
+        epicsThread thread;
+        epicsEvent go;
+        Flood& flood;
+        unsigned id;
+
+        Producer(Flood& flood_, unsigned id_)
+        : thread(*this, ("producer" + std::to_string(id_)).c_str(), epicsThreadGetStackSize(epicsThreadStackSmall))
+        , flood(flood_)
+        , id(id_)
+        {
+            thread.start();
+        }
+
+        void run() override
+        {
+            go.wait();
+            Flood* f = &flood;
+            unsigned producer = id;
+            for (unsigned i = 0; i < flood.tasksPerProducer; i++) {
+                unsigned index = producer * f->tasksPerProducer + i;
+                bool scheduled = AsyncExec::schedule([f, producer, index]() {
+                    if (f->work > 0) {
+                        busy(f->work);
+                    }
+                    f->runs[index]++;
+                    f->lastDone[producer] = now() - f->start;
+                    f->completed++;
+                });
+                if (!scheduled) {
+                    flood.rejected++;
+                }
+            }
+        }
+};
+
+struct FloodResult {
+    double seconds;
+    double tasksPerSec;
+    unsigned long long lost;
+    unsigned long long duplicated;
+    unsigned long long rejected;
+    double fairness;
+    double slowestProducer;
+    double fastestProducer;
+};
+
+/**
+ * Jain's fairness index, 1.0 when all producers were served equally.
+ */
+static double jain(const std::vector<double>& x)
+{
+    double sum = 0.0, sumSq = 0.0;
+    for (auto v: x) {
+        sum += v;
+        sumSq += v * v;
+    }
+    return (sumSq > 0.0 ? (sum * sum) / (x.size() * sumSq) : 1.0);
+}
+
+static FloodResult flood(unsigned numProducers, unsigned tasksPerProducer, uint64_t work)
+{
+    Flood f(numProducers, tasksPerProducer, work);
+    std::vector<std::unique_ptr<Producer>> producers;
+    for (unsigned i = 0; i < numProducers; i++) {
+        producers.emplace_back(new Producer(f, i));
+    }
+
+    f.start = now();
+    for (auto& p: producers) {
+        p->go.signal();
+    }
+    for (auto& p: producers) {
+        p->thread.exitWait();
+    }
+
+    // Wait for completion, but don't hang forever if tasks got lost
+    unsigned long long total = (unsigned long long)numProducers * tasksPerProducer - f.rejected;
+    auto deadline = Clock::now() + std::chrono::seconds(30);
+    while (f.completed < total && Clock::now() < deadline) {
+        epicsThreadSleep(0.001);
+    }
+    uint64_t end = now();
+    // Give any duplicate executions a chance to show up
+    epicsThreadSleep(0.1);
+
+    FloodResult result;
+    result.seconds = 1e-9 * (end - f.start);
+    result.tasksPerSec = f.completed / result.seconds;
+    result.lost = 0;
+    result.duplicated = 0;
+    result.rejected = f.rejected;
+    for (unsigned i = 0; i < numProducers * tasksPerProducer; i++) {
+        if (f.runs[i] == 0) {
+            result.lost++;
+        } else if (f.runs[i] > 1) {
+            result.duplicated++;
+        }
+    }
+
+    std::vector<double> rates;
+    for (unsigned i = 0; i < numProducers; i++) {
+        double seconds = 1e-9 * f.lastDone[i];
+        rates.push_back(seconds > 0.0 ? tasksPerProducer / seconds : 0.0);
+    }
+    result.fairness = jain(rates);
+    result.slowestProducer = *std::min_element(rates.begin(), rates.end());
+    result.fastestProducer = *std::max_element(rates.begin(), rates.end());
+    return result;
+}
+
+struct WakeupResult {
+    unsigned samples;
+    double p50;
+    double max;
+};
+
+/**
+ * Measure time from schedule() until task starts while all workers are idle.
+ *
+ * Burst schedules one blocking task per worker at once, the reported
+ * latency is the one of the last started task.
+ */
+static WakeupResult wakeup(unsigned samples, double idle, unsigned burst)
+{
+    std::vector<double> latencies;
+    for (unsigned i = 0; i < samples; i++) {
+        epicsThreadSleep(idle);
+
+        std::atomic<unsigned> started{0};
+        std::atomic<unsigned> finished{0};
+        std::atomic<uint64_t> lastStart{0};
+        uint64_t t0 = now();
+        for (unsigned j = 0; j < burst; j++) {
+            AsyncExec::schedule([&started, &finished, &lastStart, burst]() {
+                lastStart = now();
+                started++;
+                // Keep worker busy until all tasks started
+                auto deadline = now() + 2000000000ULL;
+                while (started < burst && now() < deadline) {
+                    epicsThreadSleep(0.0001);
+                }
+                finished++;
+            });
+        }
+        // Tasks reference locals, wait for all of them to return
+        while (finished < burst) {
+            epicsThreadSleep(0.0001);
+        }
+        latencies.push_back(1e-3 * (lastStart - t0));
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    WakeupResult result;
+    result.samples = samples;
+    result.p50 = latencies[latencies.size() / 2];
+    result.max = latencies.back();
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* output = nullptr;
+    unsigned numWorkers = 3;
+    unsigned numProducers = 8;
+    unsigned numTasks = 100000;
+    uint64_t work = 1000;
+    bool skipIdle = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "-workers") == 0 && i + 1 < argc) {
+            numWorkers = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-producers") == 0 && i + 1 < argc) {
+            numProducers = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-tasks") == 0 && i + 1 < argc) {
+            numTasks = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-work") == 0 && i + 1 < argc) {
+            work = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-skip-idle") == 0) {
+            skipIdle = true;
+        } else {
+            fprintf(stderr, "Usage: %s [-o FILE] [-workers N] [-producers N] [-tasks N] [-work NS] [-skip-idle]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    AsyncExec::init(numWorkers);
+
+    fprintf(stderr, "Flooding with empty tasks\n");
+    auto empty = flood(numProducers, numTasks, 0);
+    fprintf(stderr, "Flooding with %llu ns tasks\n", (unsigned long long)work);
+    auto shortTasks = flood(numProducers, numTasks / 10, work);
+
+    fprintf(stderr, "Measuring wake-up latency\n");
+    auto single = wakeup(20, 0.01, 1);
+    auto burst = wakeup(5, 0.01, numWorkers);
+    WakeupResult timeout{0, 0.0, 0.0};
+    if (!skipIdle) {
+        // Workers went through at least one dequeue timeout
+        timeout = wakeup(3, 1.2, numWorkers);
+    }
+
+    fprintf(stderr, "Measuring shutdown\n");
+    auto t0 = now();
+    AsyncExec::shutdown();
+    double shutdown = 1e-9 * (now() - t0);
+
+    FILE* out = (output != nullptr ? fopen(output, "w") : stdout);
+    if (out == nullptr) {
+        fprintf(stderr, "Failed to open output file '%s'\n", output);
+        return 1;
+    }
+    fprintf(out, "{\n");
+    fprintf(out, "  \"workers\": %u, \"producers\": %u, \"tasks_per_producer\": %u,\n", numWorkers, numProducers, numTasks);
+    auto printFlood = [out](const char* name, const FloodResult& r) {
+        fprintf(out, "  \"%s\": {\"seconds\": %.3f, \"tasks_per_sec\": %.1f, \"lost\": %llu, \"duplicated\": %llu, \"rejected\": %llu, "
+                "\"fairness\": %.3f, \"slowest_producer_per_sec\": %.1f, \"fastest_producer_per_sec\": %.1f},\n",
+                name, r.seconds, r.tasksPerSec, r.lost, r.duplicated, r.rejected,
+                r.fairness, r.slowestProducer, r.fastestProducer);
+    };
+    printFlood("flood_empty", empty);
+    printFlood("flood_short", shortTasks);
+    auto printWakeup = [out](const char* name, const WakeupResult& r) {
+        fprintf(out, "  \"%s\": {\"samples\": %u, \"p50_us\": %.1f, \"max_us\": %.1f},\n", name, r.samples, r.p50, r.max);
+    };
+    printWakeup("wakeup_single", single);
+    printWakeup("wakeup_burst", burst);
+    printWakeup("wakeup_after_timeout", timeout);
+    fprintf(out, "  \"shutdown_sec\": %.3f\n", shutdown);
+    fprintf(out, "}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    bool ok = (empty.lost == 0 && empty.duplicated == 0 && shortTasks.lost == 0 && shortTasks.duplicated == 0);
+    if (!ok) {
+        fprintf(stderr, "ERROR: tasks lost or executed more than once\n");
+    }
+    return (ok ? 0 : 2);
+}
@@ -0,0 +1,149 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+/*
+ * Native expression evaluator compared to PyWrapper::exec().
+ *
+ * Usage: benchnativeexpr [-csv] [-duration SEC]
+ *
+ * Cases are pycalc records from testApp/Db/pycalcrectest.db followed by
+ * typical arithmetic expressions. Python path substitutes arguments into
+ * the code and executes it like pycalc record does, native path evaluates
+ * the expression compiled once. Expressions that evaluator doesn't support
+ * are only measured in Python.
+ */
+
+#include <nativeexpr.h>
+#include <pywrapper.h>
+#include <util.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchCase {
+    std::string name;
+    std::string calc;
+    std::vector<NativeExpr::Value> args;
+};
+
+static NativeExpr::Value intArg(int64_t i)
+{
+    NativeExpr::Value v;
+    v.type = NativeExpr::Value::Type::INTEGER;
+    v.i = i;
+    return v;
+}
+
+static NativeExpr::Value floatArg(double f)
+{
+    NativeExpr::Value v;
+    v.type = NativeExpr::Value::Type::FLOAT;
+    v.f = f;
+    return v;
+}
+
+/**
+ * Run operation for given duration, return average time in ns.
+ */
+static double measure(const std::function<bool()>& op, double duration, unsigned long long& ops)
+{
+    auto deadline = Clock::now() + std::chrono::microseconds(static_cast<long long>(duration * 1e6));
+    ops = 0;
+    auto t0 = Clock::now();
+    do {
+        // Check the clock every few iterations, native evaluation is faster than reading it
+        for (int i = 0; i < 100; i++) {
+            if (!op()) {
+                return -1.0;
+            }
+        }
+        ops += 100;
+    } while (Clock::now() < deadline);
+    return std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / ops;
+}
+
+int main(int argc, char* argv[])
+{
+    bool csv = false;
+    double duration = 1.0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-csv") == 0) {
+            csv = true;
+        } else if (strcmp(argv[i], "-duration") == 0 && i + 1 < argc) {
+            duration = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [-csv] [-duration SEC]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    const std::vector<std::string> names = { "A", "B", "C", "D", "E", "F", "G", "H", "I", "J" };
+    std::vector<BenchCase> cases = {
+        // testApp/Db/pycalcrectest.db
+        { "PyCalcTest:MathExpr",        "A*B",                        { floatArg(17), floatArg(3) } },
+        { "PyCalcTest:AdaptiveTypes",   "pow(max([A, B]), 2)",        { intArg(1), floatArg(6.4) } },
+        // Typical expressions
+        { "square",                     "A**2",                       { floatArg(1.5) } },
+        { "average",                    "(A+B)/2",                    { floatArg(2.5), floatArg(3.5) } },
+        { "scale",                      "A*B + C",                    { intArg(12), floatArg(0.25), floatArg(-1) } },
+        { "threshold",                  "1 if A > B and A < C else 0", { floatArg(5), floatArg(1), floatArg(10) } },
+        { "clip",                       "min(max(A, B), C)",          { floatArg(12), floatArg(0), floatArg(10) } },
+    };
+
+    PyWrapper::init();
+
+    if (csv) {
+        printf("name,calc,native,python_ns,native_ns,speedup\n");
+    } else {
+        printf("%-26s %-30s %6s %12s %12s %8s\n", "name", "calc", "native", "python ns", "native ns", "speedup");
+    }
+    for (auto& bench: cases) {
+        std::vector<NativeExpr::Value> args = bench.args;
+        args.resize(names.size(), intArg(0));
+
+        Util::Template code(bench.calc);
+        for (auto& field: code.fields()) {
+            auto& arg = args[field.first[0] - 'A'];
+            field.second = (arg.type == NativeExpr::Value::Type::FLOAT ? Util::to_string(arg.f) : Util::to_string(arg.i));
+        }
+
+        unsigned long long ops;
+        double python = measure([&code]() {
+            const std::string& rendered = code.render();
+            auto ret = PyWrapper::exec(rendered, false);
+            return (ret.type != PyWrapper::MultiTypeValue::Type::NONE);
+        }, duration, ops);
+
+        NativeExpr expr;
+        double native = -1.0;
+        if (expr.compile(bench.calc.c_str(), names)) {
+            native = measure([&expr, &args]() {
+                NativeExpr::Value result;
+                return expr.eval(args.data(), result);
+            }, duration, ops);
+        }
+
+        if (csv) {
+            printf("%s,\"%s\",%d,%.1f,%.1f,%.1f\n", bench.name.c_str(), bench.calc.c_str(), (native >= 0.0),
+                   python, native, (native > 0.0 ? python / native : 0.0));
+        } else if (native >= 0.0) {
+            printf("%-26s %-30s %6s %12.1f %12.1f %7.1fx\n", bench.name.c_str(), bench.calc.c_str(), "yes",
+                   python, native, python / native);
+        } else {
+            printf("%-26s %-30s %6s %12.1f %12s %8s\n", bench.name.c_str(), bench.calc.c_str(), "no", python, "-", "-");
+        }
+    }
+
+    PyWrapper::shutdown();
+    return 0;
+}
@@ -0,0 +1,257 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+/*
+ * PyWrapper::exec() throughput benchmark.
+ *
+ * Usage: benchpywrapper [-csv] [-o FILE] [-threads N] [-duration SEC] [-max-size N]
+ *
+ * Every case is executed for the given duration, first from a single
+ * thread and then from N threads concurrently. Results are written to
+ * FILE or stdout as JSON (default) or CSV, one entry per case and thread
+ * count.
+ */
+
+#include <pywrapper.h>
+
+#include <epicsEvent.h>
+#include <epicsThread.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchCase {
+    std::string name;
+    std::string kind;
+    size_t size;
+    std::function<bool()> op;
+};
+
+struct BenchResult {
+    std::string name;
+    std::string kind;
+    size_t size;
+    unsigned threads;
+    unsigned long long ops;
+    unsigned long long errors;
+    double seconds;
+    double p50;
+    double p99;
+    double max;
+};
+
+class BenchThread : public epicsThreadRunable {
+    public:
+        epicsThread thread;
+        epicsEvent start;
+        const BenchCase& bench;
+        Clock::time_point deadline;
+        std::vector<uint64_t> samples;
+        unsigned long long errors{0};
+
+        BenchThread(const std::string& name, const BenchCase& bench_, Clock::time_point deadline_)
+        : thread(*this, name.c_str(), epicsThreadGetStackSize(epicsThreadStackMedium))
+        , bench(bench_)
+        , deadline(deadline_)
+        {
+            thread.start();
+        }
+
+        void run() override
+        {
+            start.wait();
+            // Run at least a few iterations even for the slow cases
+            while (samples.size() < 3 || Clock::now() < deadline) {
+                auto t0 = Clock::now();
+                bool ok;
+                try {
+                    ok = bench.op();
+                } catch (...) {
+                    ok = false;
+                }
+                auto t1 = Clock::now();
+                if (!ok) {
+                    errors++;
+                }
+                samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+            }
+        }
+};
+
+static BenchResult runCase(const BenchCase& bench, unsigned numThreads, double duration)
+{
+    std::vector<std::unique_ptr<BenchThread>> threads;
+
+    auto deadline = Clock::now() + std::chrono::microseconds(static_cast<long long>(duration * 1e6));
+    for (unsigned i = 0; i < numThreads; i++) {
+        threads.emplace_back(new BenchThread("bench" + std::to_string(i), bench, deadline));
+    }
+
+    auto t0 = Clock::now();
+    for (auto& t: threads) {
+        t->start.signal();
+    }
+    for (auto& t: threads) {
+        t->thread.exitWait();
+    }
+    auto t1 = Clock::now();
+
+    BenchResult result;
+    result.name = bench.name;
+    result.kind = bench.kind;
+    result.size = bench.size;
+    result.threads = numThreads;
+    result.errors = 0;
+    result.seconds = std::chrono::duration<double>(t1 - t0).count();
+
+    std::vector<uint64_t> samples;
+    for (auto& t: threads) {
+        samples.insert(samples.end(), t->samples.begin(), t->samples.end());
+        result.errors += t->errors;
+    }
+    std::sort(samples.begin(), samples.end());
+    result.ops = samples.size();
+    result.p50 = 1e-3 * samples[samples.size() * 50 / 100];
+    result.p99 = 1e-3 * samples[samples.size() * 99 / 100];
+    result.max = 1e-3 * samples.back();
+    return result;
+}
+
+static std::vector<BenchCase> createCases(size_t maxSize)
+{
+    std::vector<BenchCase> cases;
+
+    cases.push_back({"int", "expression", 1, []() {
+        long val;
+        return PyWrapper::exec("17", false, &val);
+    }});
+    cases.push_back({"float", "expression", 1, []() {
+        double val;
+        return PyWrapper::exec("13.5", false, &val);
+    }});
+    cases.push_back({"string", "expression", 1, []() {
+        std::string val;
+        return PyWrapper::exec("'The quick brown fox'", false, val);
+    }});
+    cases.push_back({"arith", "expression", 1, []() {
+        double val;
+        return PyWrapper::exec("(17 * 2.5 + 3) / 4.0", false, &val);
+    }});
+    cases.push_back({"assign", "statement", 1, []() {
+        PyWrapper::exec("bench_a = 12", false);
+        return true;
+    }});
+    cases.push_back({"call", "statement", 1, []() {
+        PyWrapper::exec("bench_l = len('abc')", false);
+        return true;
+    }});
+
+    for (size_t size = 1; size <= maxSize; size *= 10) {
+        std::string n = std::to_string(size);
+
+        // Vectors are prepared once, only evaluation and conversion is measured
+        PyWrapper::exec("bench_vi_" + n + " = list(range(" + n + "))", false);
+        PyWrapper::exec("bench_vf_" + n + " = [float(x) for x in range(" + n + ")]", false);
+
+        std::string vi = "bench_vi_" + n;
+        cases.push_back({"vector_int", "expression", size, [vi]() {
+            std::vector<long> val;
+            return PyWrapper::exec(vi, false, val);
+        }});
+        std::string vf = "bench_vf_" + n;
+        cases.push_back({"vector_float", "expression", size, [vf]() {
+            std::vector<double> val;
+            return PyWrapper::exec(vf, false, val);
+        }});
+    }
+
+    return cases;
+}
+
+static void printJson(FILE* out, const std::vector<BenchResult>& results)
+{
+    fprintf(out, "[\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        auto& r = results[i];
+        fprintf(out, "  {\"name\": \"%s\", \"kind\": \"%s\", \"size\": %zu, \"threads\": %u, \"ops\": %llu, \"errors\": %llu, "
+               "\"ops_per_sec\": %.1f, \"p50_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f}%s\n",
+               r.name.c_str(), r.kind.c_str(), r.size, r.threads, r.ops, r.errors,
+               r.ops / r.seconds, r.p50, r.p99, r.max, (i + 1 < results.size() ? "," : ""));
+    }
+    fprintf(out, "]\n");
+}
+
+static void printCsv(FILE* out, const std::vector<BenchResult>& results)
+{
+    fprintf(out, "name,kind,size,threads,ops,errors,ops_per_sec,p50_us,p99_us,max_us\n");
+    for (auto& r: results) {
+        fprintf(out, "%s,%s,%zu,%u,%llu,%llu,%.1f,%.3f,%.3f,%.3f\n",
+               r.name.c_str(), r.kind.c_str(), r.size, r.threads, r.ops, r.errors,
+               r.ops / r.seconds, r.p50, r.p99, r.max);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    bool csv = false;
+    const char* output = nullptr;
+    unsigned numThreads = 4;
+    double duration = 1.0;
+    size_t maxSize = 1000000;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-csv") == 0) {
+            csv = true;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            numThreads = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-duration") == 0 && i + 1 < argc) {
+            duration = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-max-size") == 0 && i + 1 < argc) {
+            maxSize = std::max(1L, atol(argv[++i]));
+        } else {
+            fprintf(stderr, "Usage: %s [-csv] [-o FILE] [-threads N] [-duration SEC] [-max-size N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    PyWrapper::init();
+
+    std::vector<BenchResult> results;
+    for (auto& bench: createCases(maxSize)) {
+        results.push_back(runCase(bench, 1, duration));
+        if (numThreads > 1) {
+            results.push_back(runCase(bench, numThreads, duration));
+        }
+        fprintf(stderr, "%s/%s/%zu done\n", bench.name.c_str(), bench.kind.c_str(), bench.size);
+    }
+
+    FILE* out = (output != nullptr ? fopen(output, "w") : stdout);
+    if (out == nullptr) {
+        fprintf(stderr, "Failed to open output file '%s'\n", output);
+    } else {
+        if (csv) {
+            printCsv(out, results);
+        } else {
+            printJson(out, results);
+        }
+        if (out != stdout) {
+            fclose(out);
+        }
+    }
+
+    PyWrapper::shutdown();
+    return 0;
+}
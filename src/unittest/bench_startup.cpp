@@ -0,0 +1,159 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+/*
+ * IOC startup benchmark, record code precompiled during iocInit or not.
+ *
+ * Usage: benchstartup [-csv] [-threads N] [-records N,N,...] [-cache DIR]
+ *
+ * Generates code of records like macro expanded databases do, reading
+ * and writing through device objects with and without fields. Lazy mode
+ * is the first processing of all records parsing the template and
+ * compiling the code. Precompiled mode first runs Precompile with given
+ * number of threads, as pydevInitHook does, then processes all records
+ * once. Both times are reported, first scan is when values appear.
+ *
+ * With -cache, compiled code is also kept in given directory. First run
+ * fills it, running again measures an IOC restart loading compiled code.
+ */
+
+#include <codecache.h>
+#include <precompile.h>
+#include <pywrapper.h>
+#include <util.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct Record {
+    std::string name;
+    std::string text;
+    std::unique_ptr<Util::Template> code;
+};
+
+static std::vector<Record> generate(size_t n)
+{
+    std::vector<Record> records(n);
+    for (size_t i = 0; i < n; i++) {
+        auto dev = std::to_string(i % 100);
+        // Unique across sizes, code compiled for smaller size must not be found
+        auto ch = std::to_string(n) + "_" + std::to_string(i / 100);
+        records[i].name = "Bench:Dev" + dev + ":Ch" + ch;
+        switch (i % 10) {
+        case 0: case 1: case 2: case 3:
+            records[i].text = "devs[" + dev + "].read('ch" + ch + "')";
+            break;
+        case 4: case 5: case 6:
+            records[i].text = "devs[" + dev + "].write('ch" + ch + "', %VAL%)";
+            break;
+        default:
+            records[i].text = "devs[" + dev + "].read('ch" + ch + "') * %ASLO% + %AOFF%";
+            break;
+        }
+        records[i].code.reset(new Util::Template());
+    }
+    return records;
+}
+
+/**
+ * Process every record once, returns number of failures.
+ */
+static size_t firstScan(std::vector<Record>& records)
+{
+    size_t failures = 0;
+    for (auto& rec: records) {
+        for (auto& field: rec.code->fields(rec.text.c_str())) {
+            field.second = "1.5";
+        }
+        double val;
+        try {
+            if (!PyWrapper::exec(rec.code->render(), false, &val)) {
+                failures++;
+            }
+        } catch (...) {
+            failures++;
+        }
+    }
+    return failures;
+}
+
+int main(int argc, char* argv[])
+{
+    bool csv = false;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<size_t> sizes = { 1000, 10000, 50000 };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-csv") == 0) {
+            csv = true;
+        } else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            threads = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-cache") == 0 && i + 1 < argc) {
+            CodeCache::setDirectory(argv[++i]);
+        } else if (strcmp(argv[i], "-records") == 0 && i + 1 < argc) {
+            sizes.clear();
+            for (char* tok = strtok(argv[++i], ","); tok != nullptr; tok = strtok(nullptr, ",")) {
+                sizes.push_back(strtoul(tok, nullptr, 10));
+            }
+        } else {
+            fprintf(stderr, "Usage: %s [-csv] [-threads N] [-records N,N,...] [-cache DIR]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    PyWrapper::init();
+    PyWrapper::exec("class Dev:\n"
+                    "    def read(self, ch): return 1.0\n"
+                    "    def write(self, ch, value): return value\n", false);
+    PyWrapper::exec("devs = [Dev()] * 100", false);
+
+    if (csv) {
+        printf("records,threads,lazy_scan_ms,precompile_ms,scan_ms,total_ms,speedup,loaded,failures\n");
+    } else {
+        printf("%10s %8s %14s %14s %10s %10s %8s %8s\n", "records", "threads", "lazy scan ms", "precompile ms", "scan ms", "total ms", "speedup", "loaded");
+    }
+    for (auto n: sizes) {
+        // Separate records for each mode, cache is only filled by the precompiled run
+        auto lazy = generate(n);
+        auto t0 = Clock::now();
+        size_t failures = firstScan(lazy);
+        auto t1 = Clock::now();
+
+        auto precompiled = generate(n);
+        for (auto& rec: precompiled) {
+            Precompile::add(rec.name.c_str(), rec.code.get(), rec.text.c_str());
+        }
+        auto t2 = Clock::now();
+        auto stats = Precompile::run(threads);
+        auto t3 = Clock::now();
+        failures += firstScan(precompiled) + stats.errors;
+        auto t4 = Clock::now();
+
+        double lazyMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        double precompileMs = std::chrono::duration<double, std::milli>(t3 - t2).count();
+        double scanMs = std::chrono::duration<double, std::milli>(t4 - t3).count();
+        double totalMs = precompileMs + scanMs;
+        if (csv) {
+            printf("%zu,%u,%.1f,%.1f,%.1f,%.1f,%.2f,%zu,%zu\n", n, threads, lazyMs, precompileMs, scanMs, totalMs, lazyMs / totalMs, stats.loaded, failures);
+        } else {
+            printf("%10zu %8u %14.1f %14.1f %10.1f %10.1f %7.2fx %8zu\n", n, threads, lazyMs, precompileMs, scanMs, totalMs, lazyMs / totalMs, stats.loaded);
+            if (failures > 0) {
+                printf("%zu executions failed\n", failures);
+            }
+        }
+    }
+
+    PyWrapper::shutdown();
+    return 0;
+}
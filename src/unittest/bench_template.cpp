@@ -0,0 +1,139 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+/*
+ * Memory of record code templates per record.
+ *
+ * Usage: benchtemplate [-csv] [-records N]
+ *
+ * Generates code of records like macro expanded databases do, either the
+ * same text for all records taking their differences from fields, or text
+ * with different constants for every record, or half and half. Every
+ * record parses its template, sets field values and renders the code
+ * once, like device support does. Heap memory is counted by replacing
+ * global operator new and delete.
+ */
+
+#include <util.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<long long> g_allocated{0};
+static std::atomic<long long> g_blocks{0};
+
+// Size is kept in front of the block, aligned for any type
+static const size_t g_header = alignof(std::max_align_t);
+
+void* operator new(size_t size)
+{
+    auto block = static_cast<char*>(malloc(size + g_header));
+    if (block == nullptr) {
+        throw std::bad_alloc();
+    }
+    *reinterpret_cast<size_t*>(block) = size;
+    g_allocated += size;
+    g_blocks++;
+    return block + g_header;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (ptr != nullptr) {
+        auto block = static_cast<char*>(ptr) - g_header;
+        g_allocated -= *reinterpret_cast<size_t*>(block);
+        g_blocks--;
+        free(block);
+    }
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+struct Record {
+    std::string name;
+    std::string text;
+};
+
+/**
+ * Texts of records, shared percent of them from the same template text.
+ */
+static std::vector<Record> generate(size_t n, unsigned shared)
+{
+    std::vector<Record> records(n);
+    for (size_t i = 0; i < n; i++) {
+        auto dev = std::to_string(i % 100);
+        auto ch = std::to_string(i / 100);
+        records[i].name = "Bench:Dev" + dev + ":Ch" + ch;
+        if (i % 100 < shared) {
+            records[i].text = "devs[%DESC%].read_channel('%NAME%') * %ASLO% + %AOFF%";
+        } else {
+            records[i].text = "devs[" + dev + "].read_channel('ch" + ch + "') * %ASLO% + %AOFF%";
+        }
+    }
+    return records;
+}
+
+int main(int argc, char* argv[])
+{
+    bool csv = false;
+    size_t n = 50000;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-csv") == 0) {
+            csv = true;
+        } else if (strcmp(argv[i], "-records") == 0 && i + 1 < argc) {
+            n = strtoul(argv[++i], nullptr, 10);
+        } else {
+            fprintf(stderr, "Usage: %s [-csv] [-records N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (csv) {
+        printf("shared_percent,records,bytes_per_record,blocks_per_record,init_ms\n");
+    } else {
+        printf("%8s %10s %14s %15s %10s\n", "shared", "records", "bytes/record", "blocks/record", "init ms");
+    }
+    for (unsigned shared: { 0, 50, 100 }) {
+        auto records = generate(n, shared);
+
+        long long bytes = g_allocated, blocks = g_blocks;
+        auto t0 = Clock::now();
+        std::vector<Util::Template> templates(n);
+        size_t length = 0;
+        for (size_t i = 0; i < n; i++) {
+            for (auto& field: templates[i].fields(records[i].text.c_str())) {
+                field.second = (field.first == "NAME" ? records[i].name : "1.5");
+            }
+            length += templates[i].render().size();
+        }
+        auto t1 = Clock::now();
+        double perRecord = double(g_allocated - bytes) / n;
+        double blocksPerRecord = double(g_blocks - blocks) / n;
+        double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+        if (csv) {
+            printf("%u,%zu,%.1f,%.2f,%.1f\n", shared, n, perRecord, blocksPerRecord, ms);
+        } else {
+            printf("%7u%% %10zu %14.1f %15.2f %10.1f\n", shared, n, perRecord, blocksPerRecord, ms);
+        }
+        if (length == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
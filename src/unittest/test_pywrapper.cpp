@@ -1,4 +1,5 @@
 #include <util.h>
+#include <nativeexpr.h>
 #include <pywrapper.h>
 
 #include <epicsUnitTest.h>
@@ -71,14 +72,111 @@ struct TestPyWrapper {
         testOk1(PyWrapper::exec("[4.0,5.0]", false, vi) == true && vi.size() == 2 && vi[0] == 4   && vi[1] == 5);
         testOk1(PyWrapper::exec("[4.0,5.0]", false, vf) == true && vf.size() == 2 && vf[0] == 4.0 && vf[1] == 5.0);
     }
+
+    /**
+     * Native evaluator must give the same result as Python executing substituted code.
+     */
+    static void nativeMatchesPython()
+    {
+        const std::vector<std::string> names = { "A", "B" };
+        NativeExpr::Value args[2];
+        args[0].type = NativeExpr::Value::Type::INTEGER;
+        args[0].i = -3;
+        args[1].type = NativeExpr::Value::Type::FLOAT;
+        args[1].f = 2.5;
+
+        const char* supported[] = {
+            "A*B", "(A+B)/2", "A**2", "%A%**B", "A//2 + A%2", "B//-0.75", "-A%B",
+            "A < B <= 3", "not A or B", "A and B", "A if A > B else B", "2**52", "17/2", "A ** -B",
+            "max(A, B, -7)", "min(A, float(A))", "abs(A) + pow(B, 2)", "int(-B) == -2", "True + 1", "2**A**2",
+        };
+        for (auto code: supported) {
+            NativeExpr expr;
+            Util::Template tmpl(code);
+            for (auto& field: tmpl.fields()) {
+                field.second = (field.first == "A" ? Util::to_string(args[0].i) : Util::to_string(args[1].f));
+            }
+            NativeExpr::Value result;
+            auto ret = PyWrapper::exec(tmpl.render(), false);
+            bool ok = expr.compile(code, names) && expr.eval(args, result);
+            if (ok && result.type == NativeExpr::Value::Type::FLOAT) {
+                ok = (ret.type == PyWrapper::MultiTypeValue::Type::FLOAT && ret.f == result.f);
+            } else if (ok) {
+                ok = (ret.type == PyWrapper::MultiTypeValue::Type::INTEGER && ret.i == result.i);
+            }
+            testOk(ok, "%s", code);
+        }
+
+        // Python raises, or integer would not be exact
+        const char* failing[] = { "A // 0", "(A) ** B", "B % 0.0", "2**54" };
+        for (auto code: failing) {
+            NativeExpr expr;
+            NativeExpr::Value result;
+            testOk(expr.compile(code, names) && !expr.eval(args, result), "%s fails", code);
+        }
+
+        const char* unsupported[] = { "max([A, B])", "A.real", "math.sqrt(A)", "%OTHER:PV.VAL% + A", "'A' + str(B)", "C * 2", "A = 1" };
+        for (auto code: unsupported) {
+            NativeExpr expr;
+            testOk(!expr.compile(code, names), "%s not supported", code);
+        }
+    }
+
+    /**
+     * Values of group members are picked from a single result by key.
+     */
+    static void execItems()
+    {
+        auto values = PyWrapper::execItems("{'a': 1, 'b': [2.5, 3.5], 3: 'x'}", false, { "a", "b", "3", "c" });
+        testOk1(values.size() == 4);
+        testOk1(values[0].type == PyWrapper::MultiTypeValue::Type::INTEGER && values[0].i == 1);
+        testOk1(values[1].type == PyWrapper::MultiTypeValue::Type::VECTOR_FLOAT && values[1].vf.size() == 2);
+        testOk1(values[2].type == PyWrapper::MultiTypeValue::Type::STRING && values[2].s == "x");
+        testOk1(values[3].type == PyWrapper::MultiTypeValue::Type::NONE);
+
+        values = PyWrapper::execItems("(7, 8.5, True)", false, { "1", "-1", "3", "a" });
+        testOk1(values[0].type == PyWrapper::MultiTypeValue::Type::FLOAT && values[0].f == 8.5);
+        testOk1(values[1].type == PyWrapper::MultiTypeValue::Type::INTEGER && values[1].i == 1);
+        testOk1(values[2].type == PyWrapper::MultiTypeValue::Type::NONE && values[3].type == PyWrapper::MultiTypeValue::Type::NONE);
+
+        double d;
+        testOk1(PyWrapper::convert(values[0], &d) == true && d == 8.5);
+        testOk1(PyWrapper::convert(values[2], &d) == false);
+
+        // pycalc outputs, tuple items by position and dict items by key
+        values = PyWrapper::execItems("[4, 'y']", false, { "A", "B", "C" }, true);
+        testOk1(values[0].i == 4 && values[1].s == "y" && values[2].type == PyWrapper::MultiTypeValue::Type::NONE);
+        values = PyWrapper::execItems("{'B': 5, 0: 6}", false, { "A", "B" }, true);
+        testOk1(values[0].type == PyWrapper::MultiTypeValue::Type::NONE && values[1].i == 5);
+    }
+
+    /**
+     * Compiled code survives marshalling, loaded code is used for its line.
+     */
+    static void compiledCode()
+    {
+        auto errors = PyWrapper::compile({ "40 + 2", "x = (" }, true);
+        testOk1(errors.size() == 2 && errors[0].empty() && !errors[1].empty());
+
+        auto data = PyWrapper::dumpCompiled({ "40 + 2", "x = (", "not compiled" });
+        testOk1(data.size() == 3 && data[0].size() > 1 && data[1].empty() && data[2].empty());
+
+        testOk1(PyWrapper::loadCompiled({ "loaded_code" }, { data[0] }) == 1);
+        long l = 0;
+        testOk1(PyWrapper::exec("loaded_code", false, &l) == true && l == 42);
+        testOk1(PyWrapper::loadCompiled({ "invalid_code", "empty_code" }, { "einvalid", "" }) == 0);
+    }
 };
 
 MAIN(testpywrapper)
 {
-    testPlan(42);
+    testPlan(90);
 
     TestPyWrapper::init();
     TestPyWrapper::returnFromEval();
+    TestPyWrapper::nativeMatchesPython();
+    TestPyWrapper::execItems();
+    TestPyWrapper::compiledCode();
 
     return testDone();
 }
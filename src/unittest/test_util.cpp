@@ -4,8 +4,11 @@
 #include <epicsUnitTest.h>
 #include <testMain.h>
 
+#include <atomic>
 #include <map>
 #include <string>
+#include <thread>
+#include <vector>
 
 struct TestEscape {
     static void newLine()
@@ -142,9 +145,102 @@ struct TestGetReplacables {
     }
 };
 
+struct TestGetReferences {
+    static void getReferences()
+    {
+        auto refs = Util::getReferences("%OTHER:PV.HOPR% + %B:C% * %VAL% - %B:C%");
+        testOk1(refs.size() == 2 && refs[0] == "OTHER:PV.HOPR" && refs[1] == "B:C");
+        testOk1(Util::getReferences("%OTHER:PV%").size() == 1);
+        testOk1(Util::getReferences("'%d, %s' % (1, 'a')").empty());
+        testOk1(Util::getReferences("OTHER:PV.VAL").empty());
+    }
+};
+
+struct TestTemplate {
+    static void render()
+    {
+        Util::Template tmpl("set(VAL, '%NAME%')");
+        auto& fields = tmpl.fields();
+        testOk1(fields.size() == 2 && fields[0].first == "NAME" && fields[1].first == "VAL");
+        fields[0].second = "Test:PV";
+        fields[1].second = "1";
+        testOk1(tmpl.render() == "set(1, 'Test:PV')");
+        fields[1].second = "22";
+        testOk1(tmpl.render() == "set(22, 'Test:PV')");
+    }
+
+    static void textChanged()
+    {
+        Util::Template tmpl;
+        testOk1(tmpl.fields("VAL+1").size() == 1);
+        testOk1(tmpl.render() == "VAL+1");
+        auto& fields = tmpl.fields("A*B");
+        testOk1(fields.size() == 2);
+        fields[0].second = "17";
+        fields[1].second = "3";
+        testOk1(tmpl.render() == "17*3");
+        testOk1(tmpl.fields("A*B")[0].second == "17");
+    }
+
+    static void references()
+    {
+        Util::Template tmpl("%OTHER:PV.HOPR% + OTHER:PV.HOPR");
+        auto& fields = tmpl.fields();
+        // Plain HOPR and PV are fields too
+        testOk1(fields.size() == 3 && fields[1].first == "OTHER:PV.HOPR");
+        testOk1(tmpl.render() == "%OTHER:PV.HOPR% + OTHER:PV.HOPR");
+        fields[1].second = "5";
+        testOk1(tmpl.render() == "5 + OTHER:PV.HOPR");
+        testOk1(Util::Template("'%s:%s' % (A, B)").render() == "'%s:%s' % (A, B)");
+    }
+
+    static void shared()
+    {
+        auto interned = Util::Template::interned();
+        {
+            Util::Template a("read('%NAME%', VAL)");
+            Util::Template b("read('%NAME%', VAL)");
+            testOk1(Util::Template::interned() == interned + 1);
+            a.fields()[0].second = "A:PV";
+            b.fields()[0].second = "B:PV";
+            testOk1(a.render() == "read('A:PV', VAL)" && b.render() == "read('B:PV', VAL)");
+            b.fields("read('%NAME%', VAL) + 1");
+            testOk1(Util::Template::interned() == interned + 2 && a.render() == "read('A:PV', VAL)");
+        }
+        testOk1(Util::Template::interned() == interned);
+    }
+
+    /**
+     * Same text parsed and released by several threads at once, entry
+     * released by one thread may be taken over by another meanwhile.
+     */
+    static void sharedConcurrently()
+    {
+        auto interned = Util::Template::interned();
+        std::vector<std::thread> threads;
+        std::atomic<unsigned> mismatches{0};
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&mismatches]() {
+                for (int i = 0; i < 20000; i++) {
+                    Util::Template a("read('%NAME%', VAL)");
+                    a.fields()[0].second = "A:PV";
+                    if (a.render() != "read('A:PV', VAL)") {
+                        mismatches++;
+                    }
+                }
+            });
+        }
+        for (auto& thread: threads) {
+            thread.join();
+        }
+        testOk1(mismatches == 0);
+        testOk1(Util::Template::interned() == interned);
+    }
+};
+
 MAIN(testutil)
 {
-    testPlan(55);
+    testPlan(78);
     TestReplace::basic();
     TestReplace::multipleInstances();
     TestReplace::multipleFields();
@@ -157,6 +253,13 @@ MAIN(testutil)
     TestEscape::singleQuote();
 
     TestGetReplacables::getReplacables();
+    TestGetReferences::getReferences();
+
+    TestTemplate::render();
+    TestTemplate::textChanged();
+    TestTemplate::references();
+    TestTemplate::shared();
+    TestTemplate::sharedConcurrently();
 
     return testDone();
 }
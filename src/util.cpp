@@ -5,11 +5,15 @@
 
 #include "util.h"
 #include <envDefs.h>
+#include <epicsMutex.h>
+#include <algorithm>
 #include <cctype>
 #include <cfloat>
+#include <cstring>
 #include <iomanip>
 #include <sstream>
 #include <stdexcept>
+#include <unordered_map>
 
 
 namespace Util {
@@ -47,43 +51,247 @@ std::map<std::string, std::string> getFields(const std::string& text)
     return fields;
 }
 
+static bool isReference(const std::string& name)
+{
+    return (name.find_first_of(":.") != std::string::npos);
+}
+
+std::vector<std::string> getReferences(const std::string& text)
+{
+    const char delimiter = '%';
+    std::vector<std::string> refs;
+
+    size_t pos = text.find(delimiter);
+    while (pos != std::string::npos) {
+        size_t end = text.find(delimiter, pos + 1);
+        if (end == std::string::npos) {
+            break;
+        }
+        auto name = text.substr(pos + 1, end - pos - 1);
+        bool valid = !name.empty() && isReference(name);
+        for (auto c: name) {
+            valid = valid && (isalnum(c) || strchr("_-+:;.[]<>", c) != nullptr);
+        }
+        if (valid) {
+            if (std::find(refs.begin(), refs.end(), name) == refs.end()) {
+                refs.push_back(name);
+            }
+            end = text.find(delimiter, end + 1);
+        }
+        pos = end;
+    }
+    return refs;
+}
+
 std::string replaceFields(const std::string& text, const std::map<std::string, std::string>& fields)
 {
-    const std::string delimiter = "%";
-    std::string out = text;
+    std::vector<std::string> names;
+    for (auto& field: fields) {
+        names.push_back(field.first);
+    }
+    Template tmpl(text, names);
+    for (auto& field: tmpl.fields()) {
+        field.second = fields.at(field.first);
+    }
+    return tmpl.render();
+}
+
+Template::Template(const std::string& text)
+{
+    fields(text.c_str());
+}
+
+Template::Template(const std::string& text, const std::vector<std::string>& names)
+{
+    parse(text, names);
+}
+
+Template::Fields& Template::fields(const char* text)
+{
+    if (!m_parsed || m_parsed->key.compare(0, m_parsed->length, text) != 0) {
+        std::vector<std::string> names;
+        for (auto& field: getFields(text)) {
+            names.push_back(field.first);
+        }
+        for (auto& ref: getReferences(text)) {
+            names.push_back(ref);
+        }
+        parse(text, names);
+    }
+    return m_fields;
+}
+
+void Template::parse(const std::string& text, const std::vector<std::string>& names)
+{
+    const char delimiter = '%';
+
+    m_generation++;
+    m_parsed = intern(text, names);
+    m_fields.clear();
+    auto& key = m_parsed->key;
+    for (size_t pos = m_parsed->length; pos < key.length(); ) {
+        size_t end = key.find('\0', pos + 1);
+        auto name = key.substr(pos + 1, end == std::string::npos ? std::string::npos : end - pos - 1);
+        // Unresolved references must render unchanged, ie. '%d:%d' % (1, 2)
+        m_fields.emplace_back(name, (isReference(name) ? delimiter + name + delimiter : name));
+        pos = (end == std::string::npos ? key.length() : end);
+    }
+}
+
+struct Template::Pool {
+    struct Hash {
+        size_t operator()(const std::string* key) const { return std::hash<std::string>()(*key); }
+    };
+    struct Equal {
+        bool operator()(const std::string* a, const std::string* b) const { return *a == *b; }
+    };
+    struct Entry {
+        std::weak_ptr<const Parsed> parsed;
+        const Parsed* owner;    // whose key the entry refers to
+    };
+    epicsMutex mutex;
+    std::unordered_map<const std::string*, Entry, Hash, Equal> entries;
+};
+
+Template::Pool& Template::pool()
+{
+    // Never destroyed, templates may outlive static objects
+    static Pool* pool = new Pool;
+    return *pool;
+}
+
+/**
+ * Last template using parsed text removes it from the pool, unless text
+ * was parsed again in the meantime and the entry was taken over.
+ */
+Template::Parsed::~Parsed()
+{
+    auto& pool = Template::pool();
+    pool.mutex.lock();
+    auto it = pool.entries.find(&key);
+    if (it != pool.entries.end() && it->second.owner == this) {
+        pool.entries.erase(it);
+    }
+    pool.mutex.unlock();
+}
+
+/**
+ * Get parsed text shared with other templates, parse it when not found.
+ */
+std::shared_ptr<const Template::Parsed> Template::intern(const std::string& text, std::vector<std::string> names)
+{
+    std::sort(names.begin(), names.end());
+    std::string key = text;
+    for (auto& name: names) {
+        key += '\0' + name;
+    }
+
+    // Parsing is done without lock, templates are often parsed in parallel
+    auto& pool = Template::pool();
+    pool.mutex.lock();
+    auto found = pool.entries.find(&key);
+    std::shared_ptr<const Parsed> parsed;
+    if (found != pool.entries.end()) {
+        parsed = found->second.parsed.lock();
+    }
+    pool.mutex.unlock();
+    if (parsed) {
+        return parsed;
+    }
+
+    const char delimiter = '%';
+    auto p = std::make_shared<Parsed>(std::move(key), text.length());
+    auto& tokens = p->tokens;
+
+    size_t literal = 0;
+    auto addToken = [&](size_t pos, size_t length, int field, bool afterValue) {
+        if (pos > literal) {
+            tokens.push_back({uint32_t(literal), uint32_t(pos - literal), -1, false});
+        }
+        tokens.push_back({uint32_t(pos), uint32_t(length), int16_t(field), afterValue});
+        literal = pos + length;
+    };
 
     bool replaced = false;
-    for (size_t pos = 0; pos < out.length(); pos++) {
-        for (auto& field: fields) {
-            std::string token;
+    size_t pos = 0;
+    while (pos < text.length()) {
+        bool matched = false;
+        for (size_t i = 0; i < names.size() && !matched; i++) {
+            auto& name = names[i];
 
-            // Try exact match first, ie. VAL, but needs to be surrounded by non-alnum characters
-            token = field.first;
-            if (out.compare(pos, token.length(), token) == 0) {
-                char charBefore = (pos == 0 || replaced ? '.' : out.at(pos-1));
-                char charAfter  = (pos+token.length() >= out.length() ? '.' : out.at(pos+token.length()));
+            // Try exact match first, ie. VAL, but needs to be surrounded by non-alnum characters.
+            // Right after substituted field, only the first field is matched unconditionally,
+            // others are compared against the last character of substituted value.
+            if (!name.empty() && !isReference(name) && text.compare(pos, name.length(), name) == 0) {
+                bool afterValue = (replaced && i > 0);
+                char charBefore = (pos == 0 || replaced ? '.' : text.at(pos-1));
+                char charAfter  = (pos+name.length() >= text.length() ? '.' : text.at(pos+name.length()));
                 if (!isalnum(charBefore) && !isalnum(charAfter)) {
-                    out.replace(pos, token.length(), field.second);
-                    pos += field.second.length() - 1;
-                    replaced = true;
+                    addToken(pos, name.length(), i, afterValue);
+                    pos += name.length();
+                    matched = true;
                     break;
                 }
             }
 
             // Put % sign around the field name, ie. %VAL%
-            token = delimiter + field.first + delimiter;
-            if (out.compare(pos, token.length(), token) == 0) {
-                out.replace(pos, token.length(), field.second);
-                pos += field.second.length() - 1;
-                replaced = true;
-                break;
+            if (pos + name.length() + 2 <= text.length() && text.at(pos) == delimiter &&
+                text.compare(pos+1, name.length(), name) == 0 && text.at(pos+name.length()+1) == delimiter) {
+                addToken(pos, name.length() + 2, i, false);
+                pos += name.length() + 2;
+                matched = true;
             }
+        }
+        replaced = matched;
+        if (!matched) {
+            pos++;
+        }
+    }
+    if (text.length() > literal) {
+        tokens.push_back({uint32_t(literal), uint32_t(text.length() - literal), -1, false});
+    }
+    tokens.shrink_to_fit();
 
-            replaced = false;
+    pool.mutex.lock();
+    auto it = pool.entries.find(&p->key);
+    if (it != pool.entries.end()) {
+        parsed = it->second.parsed.lock();
+    }
+    if (!parsed) {
+        // Expired entry refers to the key of text being destroyed, replace it with own
+        if (it != pool.entries.end()) {
+            pool.entries.erase(it);
         }
+        pool.entries.emplace(&p->key, Pool::Entry{p, p.get()});
+        parsed = p;
     }
+    pool.mutex.unlock();
+    return parsed;
+}
 
-    return out;
+size_t Template::interned()
+{
+    auto& pool = Template::pool();
+    pool.mutex.lock();
+    size_t size = pool.entries.size();
+    pool.mutex.unlock();
+    return size;
+}
+
+const std::string& Template::render()
+{
+    m_out.clear();
+    if (!m_parsed) {
+        return m_out;
+    }
+    for (auto& token: m_parsed->tokens) {
+        if (token.field < 0 || (token.afterValue && !m_out.empty() && isalnum(m_out.back()))) {
+            m_out.append(m_parsed->key, token.offset, token.length);
+        } else {
+            m_out += m_fields[token.field].second;
+        }
+    }
+    return m_out;
 }
 
 std::string replace(const std::string& text, const std::map<std::string, std::string>& fields)
@@ -6,18 +6,107 @@
 #ifndef UTIL_H
 #define UTIL_H
 
-#include <string>
+#include <cstdint>
 #include <map>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace Util {
 
 std::map<std::string, std::string> getFields(const std::string& text);
+/**
+ * Find references to other records enclosed by % sign, ie. %OTHER:PV.FIELD%.
+ *
+ * Reference must contain ':' or '.' to tell it apart from %FIELD%.
+ */
+std::vector<std::string> getReferences(const std::string& text);
 std::string replaceFields(const std::string& text, const std::map<std::string, std::string>& fields);
 std::string escape(const std::string& text);
 std::string join(const std::vector<std::string>& tokens, const std::string& glue);
 long getEnvConfig(const std::string& name, long defval);
 
+/**
+ * Code with field names, parsed once and rendered many times.
+ *
+ * Parsing splits text into literal spans and field slots using the same
+ * rules as getFields() and replaceFields(). Rendering is a single pass
+ * appending spans and field values into a buffer reused between calls.
+ *
+ * Records generated from the same database template often have identical
+ * text. Parsed text is interned, all templates of the same text and field
+ * names share it and only keep their field values.
+ */
+class Template {
+    public:
+        using Fields = std::vector<std::pair<std::string, std::string>>;
+
+        Template() = default;
+        /**
+         * Parse text for fields found by getFields().
+         */
+        explicit Template(const std::string& text);
+        /**
+         * Parse text for given field names.
+         */
+        Template(const std::string& text, const std::vector<std::string>& names);
+
+        /**
+         * Fields and references found in text sorted by name, with values
+         * defaulting to the original text.
+         *
+         * Text is only parsed again when it differs from the last one.
+         */
+        Fields& fields(const char* text);
+        Fields& fields() { return m_fields; }
+        const Fields& fields() const { return m_fields; }
+
+        /**
+         * Substitute current field values, returned string is valid until next call.
+         */
+        const std::string& render();
+
+        /**
+         * Incremented every time text is parsed, allows caching data per field.
+         */
+        unsigned generation() const { return m_generation; }
+
+        /**
+         * Number of distinct parsed texts currently shared by templates.
+         */
+        static size_t interned();
+
+    private:
+        void parse(const std::string& text, const std::vector<std::string>& names);
+
+        struct Token {
+            uint32_t offset;
+            uint32_t length;
+            int16_t field;  // index into fields, -1 for literal text
+            bool afterValue;// substituted only when preceding value doesn't end with alnum
+        };
+        /**
+         * Parsed text shared by templates, key is the text followed by
+         * sorted field names, each after a null character. Pool refers
+         * to the key of the entry it holds.
+         */
+        struct Parsed {
+            Parsed(std::string&& key_, size_t length_) : key(std::move(key_)), length(length_) {}
+            ~Parsed();
+            std::string key;
+            size_t length;
+            std::vector<Token> tokens;
+        };
+        struct Pool;
+        static Pool& pool();
+        static std::shared_ptr<const Parsed> intern(const std::string& text, std::vector<std::string> names);
+
+        unsigned m_generation{0};
+        std::shared_ptr<const Parsed> m_parsed;
+        Fields m_fields;
+        std::string m_out;
+};
+
 namespace detail {
 // conversion from python basis types to strings
 // std::to_string has only limited accuracy for floot double etc.
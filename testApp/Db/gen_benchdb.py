@@ -0,0 +1,79 @@
+#!/usr/bin/env python
+"""
+Generate synthetic PyDevice database for benchmarking.
+
+Creates N records of each requested record type, all executing a trivial
+Python expression or statement so that PyDevice overhead dominates.
+Records are Passive by default, to be driven by pydevbench at a chosen
+rate, or can be periodically scanned by the IOC itself with --scan.
+
+Example, 10k records split among 4 types, processed 10 times per second:
+
+    gen_benchdb.py -n 2500 -t ai,ao,longin,stringout -o bench.db
+    pydevbench -db bench.db -rate 10 -duration 30
+"""
+from __future__ import print_function
+
+import argparse
+import sys
+
+# Record type: (link field, default code, extra fields)
+RECORD_TYPES = {
+    "ai":        ("INP", "1.5", {}),
+    "ao":        ("OUT", "bench_ao=VAL", {}),
+    "longin":    ("INP", "42", {}),
+    "longout":   ("OUT", "bench_longout=VAL", {}),
+    "bi":        ("INP", "1", {}),
+    "bo":        ("OUT", "bench_bo=VAL", {}),
+    "mbbi":      ("INP", "1", {}),
+    "mbbo":      ("OUT", "bench_mbbo=VAL", {}),
+    "stringin":  ("INP", "'bench'", {}),
+    "stringout": ("OUT", "bench_stringout='VAL'", {}),
+    "lsi":       ("INP", "'bench'", {"SIZV": "40"}),
+    "lso":       ("OUT", "bench_lso='VAL'", {"SIZV": "40"}),
+    "waveform":  ("INP", "[1.0]*{nelm}", {"FTVL": "DOUBLE", "NELM": "{nelm}"}),
+    "aao":       ("OUT", "bench_aao=VAL", {"FTVL": "DOUBLE", "NELM": "{nelm}"}),
+    "pycalc":    ("CALC", "A+B", {"INPA": "1", "INPB": "2"}),
+}
+
+def record(rtype, name, code, scan, nelm):
+    link, default, extra = RECORD_TYPES[rtype]
+    lines = ['record(%s, "%s") {' % (rtype, name)]
+    if rtype == "pycalc":
+        lines.append('  field(CALC, "%s")' % (code or default).format(nelm=nelm))
+    else:
+        lines.append('  field(DTYP, "pydev")')
+        lines.append('  field(%s,  "@%s")' % (link, (code or default).format(nelm=nelm)))
+    if scan != "Passive":
+        lines.append('  field(SCAN, "%s")' % scan)
+    for field, value in sorted(extra.items()):
+        lines.append('  field(%s, "%s")' % (field, value.format(nelm=nelm)))
+    lines.append('}')
+    return "\n".join(lines)
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate synthetic PyDevice benchmark database")
+    parser.add_argument("-n", "--num", type=int, default=100, help="number of records per type")
+    parser.add_argument("-t", "--types", default="ai,ao", help="comma separated record types, one of: " + ",".join(sorted(RECORD_TYPES)))
+    parser.add_argument("-p", "--prefix", default="Bench:", help="record name prefix")
+    parser.add_argument("-s", "--scan", default="Passive", help="SCAN field value, ie. '1 second' or '.1 second'")
+    parser.add_argument("-c", "--code", default=None, help="Python code for all records instead of the default")
+    parser.add_argument("--nelm", type=int, default=100, help="number of elements of array records")
+    parser.add_argument("-o", "--output", default=None, help="output file, stdout when not specified")
+    args = parser.parse_args()
+
+    types = [t.strip() for t in args.types.split(",") if t.strip()]
+    for t in types:
+        if t not in RECORD_TYPES:
+            parser.error("unsupported record type '%s'" % t)
+
+    out = open(args.output, "w") if args.output else sys.stdout
+    print("# Generated by gen_benchdb.py: %d x %s, SCAN=%s" % (args.num, ",".join(types), args.scan), file=out)
+    for t in types:
+        for i in range(args.num):
+            print(record(t, "%s%s:%d" % (args.prefix, t, i), args.code, args.scan, args.nelm), file=out)
+    if out is not sys.stdout:
+        out.close()
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,373 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+/*
+ * Headless record processing benchmark.
+ *
+ * Usage: pydevbench [-dbd FILE] -db FILE [-macros M] [-py CODE]... [-rate HZ]
+ *                   [-duration SEC] [-warmup SEC] [-put VALUE] [-o FILE]
+ *
+ * Loads database(s), initializes IOC in isolated mode (no Channel Access
+ * server nor client) and processes all PyDevice records through
+ * dbProcessNotify(), which is the same mechanism used by CA put-callback.
+ * Completion latency is measured from the request until the record
+ * finishes asynchronous processing, including the worker thread and
+ * the callback thread completing the record.
+ *
+ * With -rate each record is processed HZ times per second, requests are
+ * spread evenly in time. Without it every record is processed again as
+ * soon as it completes. With -put VALUE records are written with VALUE
+ * before processing, like dbPutField() does.
+ *
+ * Use testApp/Db/gen_benchdb.py to generate synthetic databases.
+ */
+
+#include <dbAccess.h>
+#include <dbChannel.h>
+#include <dbNotify.h>
+#include <dbStaticLib.h>
+#include <epicsEvent.h>
+#include <epicsExit.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+#include <iocInit.h>
+#include <iocsh.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+extern "C" int pydevbench_registerRecordDeviceDriver(struct dbBase *pdbbase);
+extern "C" int pydev(const char *line);
+
+using Clock = std::chrono::steady_clock;
+
+static inline uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+struct Target {
+    processNotify notify;
+    std::string name;
+    std::string type;
+    std::atomic<bool> busy{false};
+    uint64_t requested{0};
+};
+
+static std::vector<Target*> g_targets;
+static std::string g_putValue;
+static bool g_closedLoop = true;
+static std::atomic<bool> g_collecting{false};
+static std::atomic<unsigned long long> g_requests{0};
+static std::atomic<unsigned long long> g_completed{0};
+static std::atomic<unsigned long long> g_overruns{0};
+static std::atomic<unsigned long long> g_failed{0};
+static std::atomic<long> g_inFlight{0};
+static epicsMutex g_mutex;
+static std::map<std::string, std::vector<uint64_t>> g_samples;
+static std::vector<Target*> g_ready;
+static epicsEvent g_readyEvent;
+
+static int putCallback(processNotify* pn, notifyPutType type)
+{
+    long status;
+    switch (type) {
+    case putDisabledType:
+        pn->status = notifyPutDisabled;
+        return 0;
+    case putFieldType:
+        status = dbChannelPutField(pn->chan, DBR_STRING, g_putValue.c_str(), 1);
+        break;
+    case putType:
+    default:
+        status = dbChannelPut(pn->chan, DBR_STRING, g_putValue.c_str(), 1);
+        break;
+    }
+    if (status != 0) {
+        pn->status = notifyError;
+        return 0;
+    }
+    return 1;
+}
+
+static void getCallback(processNotify*, notifyGetType)
+{
+}
+
+static void doneCallback(processNotify* pn)
+{
+    auto target = reinterpret_cast<Target*>(pn->usrPvt);
+    auto latency = now() - target->requested;
+
+    if (pn->status != notifyOK) {
+        g_failed++;
+    }
+    g_completed++;
+    if (g_collecting) {
+        g_mutex.lock();
+        g_samples[target->type].push_back(latency);
+        g_mutex.unlock();
+    }
+
+    target->busy = false;
+    g_inFlight--;
+
+    if (g_closedLoop) {
+        g_mutex.lock();
+        g_ready.push_back(target);
+        g_mutex.unlock();
+        g_readyEvent.signal();
+    }
+}
+
+static void request(Target* target)
+{
+    bool idle = false;
+    if (!target->busy.compare_exchange_strong(idle, true)) {
+        g_overruns++;
+        return;
+    }
+    g_inFlight++;
+    g_requests++;
+    target->requested = now();
+    dbProcessNotify(&target->notify);
+}
+
+static bool isPyDevRecord(DBENTRY* entry)
+{
+    if (strcmp(dbGetRecordTypeName(entry), "pycalc") == 0) {
+        return true;
+    }
+    if (dbFindField(entry, "DTYP") != 0) {
+        return false;
+    }
+    const char* dtyp = dbGetString(entry);
+    return (dtyp != nullptr && strcmp(dtyp, "pydev") == 0);
+}
+
+static void findTargets()
+{
+    DBENTRY entry;
+    dbInitEntry(pdbbase, &entry);
+    for (long status = dbFirstRecordType(&entry); status == 0; status = dbNextRecordType(&entry)) {
+        for (status = dbFirstRecord(&entry); status == 0; status = dbNextRecord(&entry)) {
+            if (dbIsAlias(&entry) || !isPyDevRecord(&entry)) {
+                continue;
+            }
+            auto target = new Target;
+            target->name = dbGetRecordName(&entry);
+            target->type = dbGetRecordTypeName(&entry);
+            g_targets.push_back(target);
+        }
+    }
+    dbFinishEntry(&entry);
+
+    for (auto it = g_targets.begin(); it != g_targets.end(); ) {
+        auto target = *it;
+        memset(&target->notify, 0, sizeof(target->notify));
+        target->notify.chan = dbChannelCreate(target->name.c_str());
+        if (target->notify.chan == nullptr || dbChannelOpen(target->notify.chan) != 0) {
+            fprintf(stderr, "Failed to open channel '%s'\n", target->name.c_str());
+            delete target;
+            it = g_targets.erase(it);
+            continue;
+        }
+        target->notify.requestType = (g_putValue.empty() ? processRequest : putProcessRequest);
+        target->notify.putCallback = putCallback;
+        target->notify.getCallback = getCallback;
+        target->notify.doneCallback = doneCallback;
+        target->notify.usrPvt = target;
+        ++it;
+    }
+}
+
+static void run(double rate, double duration, double warmup)
+{
+    uint64_t start = now();
+    uint64_t warmupEnd = start + warmup * 1e9;
+    uint64_t end = warmupEnd + duration * 1e9;
+    unsigned long long issued = 0;
+
+    g_closedLoop = (rate <= 0.0);
+    if (g_closedLoop) {
+        // Closed loop, keep every record busy all the time
+        for (auto target: g_targets) {
+            request(target);
+        }
+    }
+
+    while (now() < end) {
+        if (!g_collecting && now() >= warmupEnd) {
+            g_collecting = true;
+        }
+
+        if (!g_closedLoop) {
+            // Requests spread evenly, record i is requested at i/(rate*N)
+            double elapsed = 1e-9 * (now() - start);
+            auto due = static_cast<unsigned long long>(elapsed * rate * g_targets.size());
+            for (; issued < due; issued++) {
+                request(g_targets[issued % g_targets.size()]);
+            }
+            epicsThreadSleep(0.0005);
+        } else {
+            g_readyEvent.wait(0.01);
+            std::vector<Target*> ready;
+            g_mutex.lock();
+            ready.swap(g_ready);
+            g_mutex.unlock();
+            for (auto target: ready) {
+                request(target);
+            }
+        }
+    }
+    g_collecting = false;
+
+    auto deadline = Clock::now() + std::chrono::seconds(10);
+    while (g_inFlight > 0 && Clock::now() < deadline) {
+        epicsThreadSleep(0.01);
+    }
+    for (auto target: g_targets) {
+        if (target->busy) {
+            dbNotifyCancel(&target->notify);
+        }
+    }
+}
+
+static void printResults(FILE* out, double rate, double duration)
+{
+    fprintf(out, "{\n");
+    fprintf(out, "  \"records\": %zu, \"rate_hz\": %.3f, \"duration_sec\": %.3f,\n", g_targets.size(), rate, duration);
+    fprintf(out, "  \"requests\": %llu, \"completed\": %llu, \"overruns\": %llu, \"failed\": %llu,\n",
+            g_requests.load(), g_completed.load(), g_overruns.load(), g_failed.load());
+
+    std::vector<uint64_t> all;
+    g_mutex.lock();
+    for (auto& it: g_samples) {
+        all.insert(all.end(), it.second.begin(), it.second.end());
+    }
+    g_samples["all"] = all;
+
+    fprintf(out, "  \"latency\": {\n");
+    size_t i = 0;
+    for (auto& it: g_samples) {
+        auto& samples = it.second;
+        std::sort(samples.begin(), samples.end());
+        double mean = 0.0;
+        for (auto s: samples) {
+            mean += s;
+        }
+        mean = (samples.empty() ? 0.0 : mean / samples.size());
+        auto pct = [&samples](unsigned p) {
+            return (samples.empty() ? 0.0 : 1e-3 * samples[samples.size() * p / 100]);
+        };
+        fprintf(out, "    \"%s\": {\"samples\": %zu, \"per_sec\": %.1f, \"mean_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}%s\n",
+                it.first.c_str(), samples.size(), samples.size() / duration, 1e-3 * mean, pct(50), pct(99),
+                (samples.empty() ? 0.0 : 1e-3 * samples.back()), (++i < g_samples.size() ? "," : ""));
+    }
+    g_mutex.unlock();
+    fprintf(out, "  }\n");
+    fprintf(out, "}\n");
+}
+
+int main(int argc, char* argv[])
+{
+    std::string dbd;
+    std::vector<std::pair<std::string, std::string>> dbs;
+    std::vector<std::string> pycode;
+    std::string macros;
+    const char* output = nullptr;
+    double rate = 0.0;
+    double duration = 10.0;
+    double warmup = 1.0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (arg == "-dbd" && hasValue) {
+            dbd = argv[++i];
+        } else if (arg == "-macros" && hasValue) {
+            macros = argv[++i];
+        } else if (arg == "-db" && hasValue) {
+            dbs.emplace_back(argv[++i], macros);
+        } else if (arg == "-py" && hasValue) {
+            pycode.push_back(argv[++i]);
+        } else if (arg == "-rate" && hasValue) {
+            rate = atof(argv[++i]);
+        } else if (arg == "-duration" && hasValue) {
+            duration = atof(argv[++i]);
+        } else if (arg == "-warmup" && hasValue) {
+            warmup = atof(argv[++i]);
+        } else if (arg == "-put" && hasValue) {
+            g_putValue = argv[++i];
+        } else if (arg == "-o" && hasValue) {
+            output = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [-dbd FILE] [-macros M] -db FILE [-py CODE]... [-rate HZ] [-duration SEC] [-warmup SEC] [-put VALUE] [-o FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (dbs.empty()) {
+        fprintf(stderr, "No database specified\n");
+        return 1;
+    }
+    if (dbd.empty()) {
+        // Installed next to bin/<arch>/pydevbench
+        std::string self = argv[0];
+        auto slash = self.rfind('/');
+        dbd = (slash == std::string::npos ? std::string(".") : self.substr(0, slash)) + "/../../dbd/pydevbench.dbd";
+    }
+
+    if (dbLoadDatabase(dbd.c_str(), nullptr, nullptr) != 0) {
+        fprintf(stderr, "Failed to load '%s'\n", dbd.c_str());
+        return 1;
+    }
+    pydevbench_registerRecordDeviceDriver(pdbbase);
+    for (auto& db: dbs) {
+        if (dbLoadRecords(db.first.c_str(), db.second.empty() ? nullptr : db.second.c_str()) != 0) {
+            fprintf(stderr, "Failed to load '%s'\n", db.first.c_str());
+            return 1;
+        }
+    }
+    for (auto& code: pycode) {
+        pydev(code.c_str());
+    }
+
+    // No Channel Access server and CA links resolved locally only
+    if (iocBuildIsolated() != 0 || iocRun() != 0) {
+        fprintf(stderr, "Failed to initialize IOC\n");
+        return 1;
+    }
+
+    findTargets();
+    if (g_targets.empty()) {
+        fprintf(stderr, "No PyDevice records found\n");
+        epicsExit(1);
+        return 1;
+    }
+    fprintf(stderr, "Processing %zu records for %.1f s\n", g_targets.size(), duration);
+
+    run(rate, duration, warmup);
+
+    FILE* out = (output != nullptr ? fopen(output, "w") : stdout);
+    if (out == nullptr) {
+        fprintf(stderr, "Failed to open output file '%s'\n", output);
+    } else {
+        printResults(out, rate, duration);
+        if (out != stdout) {
+            fclose(out);
+        }
+    }
+
+    iocshCmd("pydevReport(0)");
+    epicsExit(0);
+    return 0;
+}
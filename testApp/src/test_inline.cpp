@@ -0,0 +1,132 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+/*
+ * Inline execution of record code with the record locked by the caller.
+ *
+ * Code putting to its own record must not process it again while it
+ * executes, and Python threads triggering processing of a record while
+ * the scan thread holds it and waits for GIL must not deadlock.
+ */
+
+#include <dbAccess.h>
+#include <dbLock.h>
+#include <dbUnitTest.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+extern "C" int pydevbench_registerRecordDeviceDriver(struct dbBase *pdbbase);
+extern "C" int pydev(const char *line);
+
+static double getValue(const char* pv)
+{
+    DBADDR addr;
+    double val = 0.0;
+    long n = 1;
+    if (dbNameToAddr(pv, &addr) == 0) {
+        dbGetField(&addr, DBR_DOUBLE, &val, nullptr, &n, nullptr);
+    }
+    return val;
+}
+
+/**
+ * Wait for asynchronous processing to reach the value, up to 5 seconds.
+ */
+static bool waitValue(const char* pv, double val)
+{
+    for (int i = 0; i < 500 && getValue(pv) != val; i++) {
+        epicsThreadSleep(0.01);
+    }
+    return (getValue(pv) == val);
+}
+
+struct Processing {
+    dbCommon* rec;
+    unsigned count;
+    epicsEvent done;
+
+    Processing(dbCommon* rec_, unsigned count_)
+    : rec(rec_)
+    , count(count_)
+    {}
+
+    static void thread(void* arg)
+    {
+        auto self = reinterpret_cast<Processing*>(arg);
+        for (unsigned i = 0; i < self->count; i++) {
+            dbScanLock(self->rec);
+            dbProcess(self->rec);
+            dbScanUnlock(self->rec);
+        }
+        self->done.signal();
+    }
+};
+
+static void selfPut()
+{
+    pydev("depth = 0\n"
+          "max_depth = 0\n"
+          "def self_put(val):\n"
+          "    global depth, max_depth\n"
+          "    depth += 1\n"
+          "    max_depth = max(max_depth, depth)\n"
+          "    if val < 3:\n"
+          "        pydev.put('Inline:Self', val + 1)\n"
+          "    depth -= 1\n");
+
+    // First execution is asynchronous, every next one is inline
+    testdbPutFieldOk("Inline:Self", DBR_DOUBLE, 0.0);
+    testOk(waitValue("Inline:Self", 3.0), "Code putting to its own record reprocesses it");
+
+    pydev("pydev.put('Inline:Result', max_depth)");
+    testdbGetFieldEqual("Inline:Result", DBR_LONG, 1);
+}
+
+static void ioIntrFromPython()
+{
+    DBADDR addr;
+    if (dbNameToAddr("Inline:Intr", &addr) != 0) {
+        testAbort("Record Inline:Intr not found");
+    }
+
+    // Python thread holds GIL when processing the record, scan thread holds the record when waiting for GIL
+    pydev("import threading\n"
+          "def notify(n):\n"
+          "    for i in range(n):\n"
+          "        pydev.iointr('inline_test', i)\n"
+          "notifier = threading.Thread(target=notify, args=(2000,))\n");
+
+    Processing processing(addr.precord, 2000);
+    pydev("notifier.start()");
+    epicsThreadCreate("testInline", epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackMedium),
+                      Processing::thread, &processing);
+    if (!processing.done.wait(30.0)) {
+        testAbort("Deadlock processing record from Python and scan thread");
+    }
+    testPass("Record processed from Python and scan thread");
+
+    pydev("notifier.join(5.0)");
+    pydev("pydev.put('Inline:Result', int(notifier.is_alive()))");
+    testdbGetFieldEqual("Inline:Result", DBR_LONG, 0);
+}
+
+MAIN(testinline)
+{
+    testPlan(5);
+    testdbPrepare();
+    testdbReadDatabase("pydevbench.dbd", nullptr, nullptr);
+    pydevbench_registerRecordDeviceDriver(pdbbase);
+    testdbReadDatabase("test_inline.db", nullptr, nullptr);
+    testIocInitOk();
+
+    selfPut();
+    ioIntrFromPython();
+
+    testIocShutdownOk();
+    testdbCleanup();
+    return testDone();
+}
@@ -0,0 +1,118 @@
+/*************************************************************************\
+* PyDevice is distributed subject to a Software License Agreement found
+* in file LICENSE that is included with this distribution.
+\*************************************************************************/
+
+/*
+ * Processing of pycalc records in a database.
+ */
+
+#include <dbAccess.h>
+#include <dbUnitTest.h>
+#include <epicsThread.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+extern "C" int pydevbench_registerRecordDeviceDriver(struct dbBase *pdbbase);
+extern "C" int pydev(const char *line);
+
+static double getValue(const char* pv)
+{
+    DBADDR addr;
+    double val = 0.0;
+    long n = 1;
+    if (dbNameToAddr(pv, &addr) == 0) {
+        dbGetField(&addr, DBR_DOUBLE, &val, nullptr, &n, nullptr);
+    }
+    return val;
+}
+
+/**
+ * Wait for asynchronous processing to reach the value, up to 5 seconds.
+ */
+static bool waitValue(const char* pv, double val)
+{
+    for (int i = 0; i < 500 && getValue(pv) != val; i++) {
+        epicsThreadSleep(0.01);
+    }
+    return (getValue(pv) == val);
+}
+
+static void missingOutput()
+{
+    testdbPutFieldOk("PyCalc:Outputs.A", DBR_DOUBLE, 0.0);
+    testOk(waitValue("PyCalc:Outputs.VALA", 1.0), "All outputs stored");
+    testdbGetFieldEqual("PyCalc:Outputs.VALB", DBR_DOUBLE, 2.0);
+
+    // Result without 'b' keeps the previous value of VALB
+    testdbPutFieldOk("PyCalc:Outputs.A", DBR_DOUBLE, 1.0);
+    testOk(waitValue("PyCalc:Outputs.VALA", 3.0), "Output in the result stored");
+    testdbGetFieldEqual("PyCalc:Outputs.VALB", DBR_DOUBLE, 2.0);
+    testdbGetFieldEqual("PyCalc:Outputs.NEVB", DBR_LONG, 1);
+}
+
+static void deadband()
+{
+    pydev("executions = 0\n"
+          "def executed(*args):\n"
+          "    global executions\n"
+          "    executions += 1\n"
+          "    return executions\n");
+
+    testdbPutFieldOk("PyCalc:Deadband.A", DBR_DOUBLE, 1.0);
+    testOk(waitValue("PyCalc:Deadband", 1.0), "First processing executes");
+
+    testdbPutFieldOk("PyCalc:Deadband.A", DBR_DOUBLE, 1.2);
+    testdbPutFieldOk("PyCalc:Deadband.A", DBR_DOUBLE, 2.0);
+    testOk(waitValue("PyCalc:Deadband", 2.0), "Input within deadband skipped, beyond it executes");
+
+    const double array[] = {1.0, 2.0, 3.0};
+    testdbPutArrFieldOk("PyCalc:Deadband.B", DBR_DOUBLE, 3, array);
+    testOk(waitValue("PyCalc:Deadband", 3.0), "Changed array executes");
+
+    testdbPutArrFieldOk("PyCalc:Deadband.B", DBR_DOUBLE, 3, array);
+    testdbPutFieldOk("PyCalc:Deadband.A", DBR_DOUBLE, 2.4);
+    testdbPutFieldOk("PyCalc:Deadband.A", DBR_DOUBLE, 3.0);
+    testOk(waitValue("PyCalc:Deadband", 4.0), "Unchanged array and input within deadband skipped");
+
+    // Deadband only applies to scalars, any change of array executes
+    const double changed[] = {1.0, 2.0, 3.1};
+    testdbPutArrFieldOk("PyCalc:Deadband.B", DBR_DOUBLE, 3, changed);
+    testOk(waitValue("PyCalc:Deadband", 5.0), "Array element changed within deadband executes");
+
+    // Any execution that wasn't skipped would still be completing
+    epicsThreadSleep(0.5);
+    testdbGetFieldEqual("PyCalc:Deadband", DBR_LONG, 5);
+}
+
+static void arrayInput()
+{
+    const double values[] = {1.0, 2.0, 3.0};
+
+    testdbPutArrFieldOk("PyCalc:Array.A", DBR_DOUBLE, 3, values);
+    testdbGetFieldEqual("PyCalc:Array.NEA", DBR_LONG, 3);
+    testOk(waitValue("PyCalc:Array", 3.0), "Code gets all elements put to input");
+
+    // Shorter array replaces the previous one rather than its first elements
+    testdbPutArrFieldOk("PyCalc:Array.A", DBR_DOUBLE, 2, values);
+    testdbGetFieldEqual("PyCalc:Array.NEA", DBR_LONG, 2);
+    testOk(waitValue("PyCalc:Array", 2.0), "Code gets only elements of the last put");
+}
+
+MAIN(testpycalc)
+{
+    testPlan(27);
+    testdbPrepare();
+    testdbReadDatabase("pydevbench.dbd", nullptr, nullptr);
+    pydevbench_registerRecordDeviceDriver(pdbbase);
+    testdbReadDatabase("test_pycalc.db", nullptr, nullptr);
+    testIocInitOk();
+
+    missingOutput();
+    deadband();
+    arrayInput();
+
+    testIocShutdownOk();
+    testdbCleanup();
+    return testDone();
+}